@@ -0,0 +1,944 @@
+#include <string.h>
+#include <math.h>
+#include "absorbing_chain.h"
+#include "markov_chain.h"
+
+/**
+ * Sparse matrix in CSR form: row i has the coefficients
+ * coefficients[row_start[i] .. row_start[i + 1] - 1], at the columns
+ * columns[row_start[i] .. row_start[i + 1] - 1].
+ */
+typedef struct SparseMatrix {
+    uint32_t size;
+    uint32_t *row_start;
+    uint32_t *columns;
+    double *coefficients;
+} SparseMatrix;
+
+static void sparse_matrix_free (SparseMatrix *matrix)
+{
+  free (matrix->row_start);
+  free (matrix->columns);
+  free (matrix->coefficients);
+}
+
+static bool sparse_matrix_alloc (SparseMatrix *matrix, uint32_t size,
+                                 uint32_t entries)
+{
+  matrix->size = size;
+  matrix->row_start = calloc ((size_t) size + 1, sizeof (uint32_t));
+  matrix->columns = malloc (((size_t) entries + 1) * sizeof (uint32_t));
+  matrix->coefficients = malloc (((size_t) entries + 1) * sizeof (double));
+  if (matrix->row_start == NULL || matrix->columns == NULL
+      || matrix->coefficients == NULL)
+    {
+      sparse_matrix_free (matrix);
+      return false;
+    }
+  return true;
+}
+
+static bool is_transient (const FrozenChain *frozen, uint32_t node)
+{
+  const FrozenNode *frozen_node = &frozen->nodes[node];
+  return (frozen_node->flags & FROZEN_NODE_CONTINUES)
+         && frozen_node->edge_count > 0;
+}
+
+/**
+ * @return the probability of the edge-th out-edge of a node.
+ */
+static double edge_probability (const FrozenChain *frozen,
+                                const FrozenNode *frozen_node, uint32_t edge)
+{
+  uint32_t first_edge = frozen_node->first_edge;
+  uint32_t previous = (edge == 0) ? 0 : frozen_edge_cumulative_frequency
+      (frozen, first_edge + edge - 1);
+  return (double) (frozen_edge_cumulative_frequency (frozen,
+                                                     first_edge + edge)
+                   - previous)
+         / frozen_edge_cumulative_frequency
+             (frozen, first_edge + frozen_node->edge_count - 1);
+}
+
+/**
+ * build Q, the transitions between transient nodes (rows of absorbing
+ * nodes are empty).
+ */
+static bool build_transitions (const FrozenChain *frozen,
+                               SparseMatrix *transitions)
+{
+  if (!sparse_matrix_alloc (transitions, frozen->node_count,
+                            frozen->edge_count))
+    {
+      return false;
+    }
+  uint32_t entry = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      transitions->row_start[i] = entry;
+      if (!is_transient (frozen, i))
+        {
+          continue;
+        }
+      const FrozenNode *frozen_node = &frozen->nodes[i];
+      for (uint32_t edge = 0; edge < frozen_node->edge_count; edge++)
+        {
+          uint32_t target = frozen_edge_target (frozen,
+                                                frozen_node->first_edge
+                                                + edge);
+          if (is_transient (frozen, target))
+            {
+              transitions->columns[entry] = target;
+              transitions->coefficients[entry] = edge_probability
+                  (frozen, frozen_node, edge);
+              entry++;
+            }
+        }
+    }
+  transitions->row_start[frozen->node_count] = entry;
+  return true;
+}
+
+static bool transpose (const SparseMatrix *matrix, SparseMatrix *transposed)
+{
+  uint32_t entries = matrix->row_start[matrix->size];
+  if (!sparse_matrix_alloc (transposed, matrix->size, entries))
+    {
+      return false;
+    }
+  // count the entries of every column, then turn the counts into offsets.
+  for (uint32_t entry = 0; entry < entries; entry++)
+    {
+      transposed->row_start[matrix->columns[entry] + 1]++;
+    }
+  for (uint32_t i = 0; i < matrix->size; i++)
+    {
+      transposed->row_start[i + 1] += transposed->row_start[i];
+    }
+  for (uint32_t i = 0; i < matrix->size; i++)
+    {
+      for (uint32_t entry = matrix->row_start[i];
+           entry < matrix->row_start[i + 1]; entry++)
+        {
+          uint32_t position = transposed->row_start[matrix->columns[entry]]++;
+          transposed->columns[position] = i;
+          transposed->coefficients[position] = matrix->coefficients[entry];
+        }
+    }
+  // every row start was moved to the start of the next row.
+  for (uint32_t i = matrix->size; i > 0; i--)
+    {
+      transposed->row_start[i] = transposed->row_start[i - 1];
+    }
+  transposed->row_start[0] = 0;
+  return true;
+}
+
+/**
+ * LU factors of I - Q in profile (skyline) form, computed in the node
+ * order with no pivoting (I - Q of an absorbing chain is an M-matrix, so
+ * every pivot is positive). Fill-in stays within the profile: row i of L
+ * spans the columns row_first[i] .. i - 1, column j of U spans the rows
+ * column_first[j] .. j - 1, and the diagonal of U is kept apart (L has a
+ * unit diagonal). Chains whose steps are mostly short in the node order
+ * (like a board) have a thin profile, so factorizing is about linear.
+ */
+typedef struct ProfileLU {
+    uint32_t size;
+    uint32_t *row_first;
+    size_t *row_offset;
+    double *lower;
+    uint32_t *column_first;
+    size_t *column_offset;
+    double *upper;
+    double *diagonal;
+} ProfileLU;
+
+static void profile_lu_free (ProfileLU *lu)
+{
+  free (lu->row_first);
+  free (lu->row_offset);
+  free (lu->lower);
+  free (lu->column_first);
+  free (lu->column_offset);
+  free (lu->upper);
+  free (lu->diagonal);
+}
+
+static double *lower_at (const ProfileLU *lu, uint32_t row, uint32_t column)
+{
+  return lu->lower + lu->row_offset[row] + (column - lu->row_first[row]);
+}
+
+static double *upper_at (const ProfileLU *lu, uint32_t row, uint32_t column)
+{
+  return lu->upper + lu->column_offset[column]
+         + (row - lu->column_first[column]);
+}
+
+/**
+ * sum of L[row][m] * U[m][column] over the m both profiles cover, below
+ * end.
+ */
+static double profile_dot (const ProfileLU *lu, uint32_t row,
+                           uint32_t column, uint32_t end)
+{
+  uint32_t first = lu->row_first[row] > lu->column_first[column]
+                   ? lu->row_first[row] : lu->column_first[column];
+  double sum = 0;
+  for (uint32_t m = first; m < end; m++)
+    {
+      sum += *lower_at (lu, row, m) * *upper_at (lu, m, column);
+    }
+  return sum;
+}
+
+/**
+ * find the profile of I - Q, and allocate it unless it is bigger than
+ * ABSORBING_CHAIN_MAX_PROFILE entries.
+ * @return true if the profile was allocated.
+ */
+static bool profile_lu_alloc (ProfileLU *lu, const SparseMatrix *transitions)
+{
+  uint32_t size = transitions->size;
+  lu->size = size;
+  lu->row_first = malloc (size * sizeof (uint32_t));
+  lu->column_first = malloc (size * sizeof (uint32_t));
+  lu->row_offset = malloc (((size_t) size + 1) * sizeof (size_t));
+  lu->column_offset = malloc (((size_t) size + 1) * sizeof (size_t));
+  lu->diagonal = malloc (size * sizeof (double));
+  if (lu->row_first == NULL || lu->column_first == NULL
+      || lu->row_offset == NULL || lu->column_offset == NULL
+      || lu->diagonal == NULL)
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < size; i++)
+    {
+      lu->row_first[i] = i;
+      lu->column_first[i] = i;
+    }
+  for (uint32_t i = 0; i < size; i++)
+    {
+      for (uint32_t entry = transitions->row_start[i];
+           entry < transitions->row_start[i + 1]; entry++)
+        {
+          uint32_t column = transitions->columns[entry];
+          if (column < lu->row_first[i])
+            {
+              lu->row_first[i] = column;
+            }
+          if (i < lu->column_first[column])
+            {
+              lu->column_first[column] = i;
+            }
+        }
+    }
+  lu->row_offset[0] = 0;
+  lu->column_offset[0] = 0;
+  for (uint32_t i = 0; i < size; i++)
+    {
+      lu->row_offset[i + 1] = lu->row_offset[i] + (i - lu->row_first[i]);
+      lu->column_offset[i + 1] = lu->column_offset[i]
+                                 + (i - lu->column_first[i]);
+    }
+  if (lu->row_offset[size] + lu->column_offset[size]
+      > ABSORBING_CHAIN_MAX_PROFILE)
+    {
+      return false;
+    }
+  // one more entry, so empty profiles are not allocated as size 0.
+  lu->lower = calloc (lu->row_offset[size] + 1, sizeof (double));
+  lu->upper = calloc (lu->column_offset[size] + 1, sizeof (double));
+  return lu->lower != NULL && lu->upper != NULL;
+}
+
+/**
+ * factorize I - Q in place: for every k, column k of U, then row k of L,
+ * then the pivot.
+ * @return true on success, false if the profile is too big, or in case of
+ * allocation error, or if a pivot is not positive (the walk may never be
+ * absorbed).
+ */
+static bool profile_lu_factorize (ProfileLU *lu,
+                                  const SparseMatrix *transitions)
+{
+  if (!profile_lu_alloc (lu, transitions))
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < lu->size; i++)
+    {
+      lu->diagonal[i] = 1;
+      for (uint32_t entry = transitions->row_start[i];
+           entry < transitions->row_start[i + 1]; entry++)
+        {
+          uint32_t column = transitions->columns[entry];
+          double coefficient = transitions->coefficients[entry];
+          if (column == i)
+            {
+              lu->diagonal[i] -= coefficient;
+            }
+          else if (column < i)
+            {
+              *lower_at (lu, i, column) -= coefficient;
+            }
+          else
+            {
+              *upper_at (lu, i, column) -= coefficient;
+            }
+        }
+    }
+
+  for (uint32_t k = 0; k < lu->size; k++)
+    {
+      for (uint32_t i = lu->column_first[k]; i < k; i++)
+        {
+          *upper_at (lu, i, k) -= profile_dot (lu, i, k, i);
+        }
+      for (uint32_t j = lu->row_first[k]; j < k; j++)
+        {
+          double *entry = lower_at (lu, k, j);
+          *entry = (*entry - profile_dot (lu, k, j, j)) / lu->diagonal[j];
+        }
+      lu->diagonal[k] -= profile_dot (lu, k, k, k);
+      if (!(lu->diagonal[k] > 0))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * solve (I - Q) x = b with the factors: L y = b, then U x = y.
+ */
+static void profile_lu_solve (const ProfileLU *lu, const double *b,
+                              double *x)
+{
+  for (uint32_t i = 0; i < lu->size; i++)
+    {
+      double value = b[i];
+      for (uint32_t m = lu->row_first[i]; m < i; m++)
+        {
+          value -= *lower_at (lu, i, m) * x[m];
+        }
+      x[i] = value;
+    }
+  for (uint32_t k = lu->size; k-- > 0;)
+    {
+      x[k] /= lu->diagonal[k];
+      for (uint32_t i = lu->column_first[k]; i < k; i++)
+        {
+          x[i] -= *upper_at (lu, i, k) * x[k];
+        }
+    }
+}
+
+/**
+ * solve (I - Q)^T x = b with the factors: U^T w = b, then L^T x = w.
+ */
+static void profile_lu_solve_transposed (const ProfileLU *lu,
+                                         const double *b, double *x)
+{
+  for (uint32_t k = 0; k < lu->size; k++)
+    {
+      double value = b[k];
+      for (uint32_t i = lu->column_first[k]; i < k; i++)
+        {
+          value -= *upper_at (lu, i, k) * x[i];
+        }
+      x[k] = value / lu->diagonal[k];
+    }
+  for (uint32_t k = lu->size; k-- > 0;)
+    {
+      for (uint32_t m = lu->row_first[k]; m < k; m++)
+        {
+          x[m] -= *lower_at (lu, k, m) * x[k];
+        }
+    }
+}
+
+/**
+ * The (I - A) x = b system of an iterative solve, with its preconditioner: the
+ * triangle of A (above or below the diagonal, whichever holds more
+ * weight) is inverted exactly by substitution, which alone would be one
+ * Gauss-Seidel sweep.
+ */
+typedef struct LinearSystem {
+    const SparseMatrix *matrix;
+    // true when the substitution runs from the last row to the first.
+    bool backward;
+} LinearSystem;
+
+static double dot (const double *x, const double *y, uint32_t size)
+{
+  double sum = 0;
+  for (uint32_t i = 0; i < size; i++)
+    {
+      sum += x[i] * y[i];
+    }
+  return sum;
+}
+
+/**
+ * y = (I - A) x
+ */
+static void apply_system (const LinearSystem *system, const double *x,
+                          double *y)
+{
+  const SparseMatrix *matrix = system->matrix;
+  for (uint32_t i = 0; i < matrix->size; i++)
+    {
+      double value = x[i];
+      for (uint32_t entry = matrix->row_start[i];
+           entry < matrix->row_start[i + 1]; entry++)
+        {
+          value -= matrix->coefficients[entry] * x[matrix->columns[entry]];
+        }
+      y[i] = value;
+    }
+}
+
+/**
+ * z = M^-1 r, where M is I minus the diagonal and the chosen triangle of A.
+ */
+static void precondition (const LinearSystem *system, const double *r,
+                          double *z)
+{
+  const SparseMatrix *matrix = system->matrix;
+  for (uint32_t k = 0; k < matrix->size; k++)
+    {
+      uint32_t i = system->backward ? matrix->size - 1 - k : k;
+      double value = r[i];
+      double diagonal = 1;
+      for (uint32_t entry = matrix->row_start[i];
+           entry < matrix->row_start[i + 1]; entry++)
+        {
+          uint32_t column = matrix->columns[entry];
+          if (column == i)
+            {
+              diagonal -= matrix->coefficients[entry];
+            }
+          else if ((column > i) == system->backward)
+            {
+              value += matrix->coefficients[entry] * z[column];
+            }
+        }
+      z[i] = value / diagonal;
+    }
+}
+
+static bool heavier_above_diagonal (const SparseMatrix *matrix)
+{
+  double above = 0, below = 0;
+  for (uint32_t i = 0; i < matrix->size; i++)
+    {
+      for (uint32_t entry = matrix->row_start[i];
+           entry < matrix->row_start[i + 1]; entry++)
+        {
+          if (matrix->columns[entry] > i)
+            {
+              above += matrix->coefficients[entry];
+            }
+          else if (matrix->columns[entry] < i)
+            {
+              below += matrix->coefficients[entry];
+            }
+        }
+    }
+  return above >= below;
+}
+
+/**
+ * solve x = b + A x, i.e. (I - A) x = b, with preconditioned BiCGSTAB.
+ * @return true if the iteration converged, false if it didn't or in case
+ * of allocation error (x is then the last approximation).
+ */
+static bool solve_iteratively (const SparseMatrix *matrix, const double *b,
+                               double *x)
+{
+  uint32_t size = matrix->size;
+  LinearSystem system = {matrix, heavier_above_diagonal (matrix)};
+  // r, r_hat, p, v, s, t, y, z, one after the other.
+  double *vectors = calloc ((size_t) size * 8, sizeof (double));
+  if (vectors == NULL)
+    {
+      return false;
+    }
+  double *r = vectors, *r_hat = r + size, *p = r_hat + size, *v = p + size;
+  double *s = v + size, *t = s + size, *y = t + size, *z = y + size;
+
+  precondition (&system, b, x);
+  apply_system (&system, x, t);
+  for (uint32_t i = 0; i < size; i++)
+    {
+      r[i] = b[i] - t[i];
+    }
+  memcpy (r_hat, r, size * sizeof (double));
+  double tolerance = ABSORBING_CHAIN_TOLERANCE * sqrt (dot (b, b, size));
+  double rho = 1, alpha = 1, omega = 1;
+  bool converged = sqrt (dot (r, r, size)) <= tolerance;
+  for (int iteration = 0; !converged
+                          && iteration < ABSORBING_CHAIN_MAX_ITERATIONS;
+       iteration++)
+    {
+      double rho_next = dot (r_hat, r, size);
+      if (rho_next == 0 || omega == 0)
+        {
+          break;
+        }
+      double beta = (rho_next / rho) * (alpha / omega);
+      rho = rho_next;
+      for (uint32_t i = 0; i < size; i++)
+        {
+          p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        }
+      precondition (&system, p, y);
+      apply_system (&system, y, v);
+      alpha = rho / dot (r_hat, v, size);
+      for (uint32_t i = 0; i < size; i++)
+        {
+          x[i] += alpha * y[i];
+          s[i] = r[i] - alpha * v[i];
+        }
+      if (sqrt (dot (s, s, size)) <= tolerance)
+        {
+          converged = true;
+          break;
+        }
+      precondition (&system, s, z);
+      apply_system (&system, z, t);
+      double t_norm = dot (t, t, size);
+      omega = (t_norm == 0) ? 0 : dot (t, s, size) / t_norm;
+      for (uint32_t i = 0; i < size; i++)
+        {
+          x[i] += omega * z[i];
+          r[i] = s[i] - omega * t[i];
+        }
+      converged = sqrt (dot (r, r, size)) <= tolerance;
+    }
+  free (vectors);
+  return converged;
+}
+
+/**
+ * Solves the systems of I - Q and of its transpose: directly with the
+ * profile LU factors when they could be computed, iteratively otherwise.
+ */
+typedef struct AbsorbingSolver {
+    const SparseMatrix *transitions;
+    const SparseMatrix *transposed;
+    ProfileLU lu;
+    bool factorized;
+} AbsorbingSolver;
+
+/**
+ * solve (I - Q) x = b, or (I - Q)^T x = b when transposed is true.
+ * @return true if x is exact, false if an iterative solve didn't converge.
+ */
+static bool solver_solve (const AbsorbingSolver *solver, bool transposed,
+                          const double *b, double *x)
+{
+  if (solver->factorized)
+    {
+      if (transposed)
+        {
+          profile_lu_solve_transposed (&solver->lu, b, x);
+        }
+      else
+        {
+          profile_lu_solve (&solver->lu, b, x);
+        }
+      return true;
+    }
+  return solve_iteratively (transposed ? solver->transposed
+                                       : solver->transitions, b, x);
+}
+
+/**
+ * y = A x
+ */
+static void multiply (const SparseMatrix *matrix, const double *x, double *y)
+{
+  for (uint32_t i = 0; i < matrix->size; i++)
+    {
+      double value = 0;
+      for (uint32_t entry = matrix->row_start[i];
+           entry < matrix->row_start[i + 1]; entry++)
+        {
+          value += matrix->coefficients[entry] * x[matrix->columns[entry]];
+        }
+      y[i] = value;
+    }
+}
+
+static bool counts (const bool *counts_step, uint32_t node)
+{
+  return counts_step == NULL || counts_step[node];
+}
+
+/**
+ * The distribution of a walk over the transient nodes, kept sparse: only
+ * the active nodes may hold mass. A walk from one node reaches few nodes
+ * in few steps (on a board, the cells a few rolls away), so moving it
+ * costs the out-edges of the active nodes, not of the whole chain. Once
+ * the walk spreads over more than 1 / WALK_DENSE_FRACTION of the nodes,
+ * it is dense: the nodes are scanned in order instead, which is faster
+ * than following the active list around memory.
+ */
+typedef struct WalkMass {
+    double *mass;
+    bool *is_active;
+    uint32_t *active;
+    uint32_t active_count;
+    bool dense;
+} WalkMass;
+
+#define WALK_DENSE_FRACTION 16
+
+static void walk_mass_free (WalkMass *walk)
+{
+  free (walk->mass);
+  free (walk->is_active);
+  free (walk->active);
+}
+
+static bool walk_mass_alloc (WalkMass *walk, uint32_t size)
+{
+  walk->mass = calloc (size, sizeof (double));
+  walk->is_active = calloc (size, sizeof (bool));
+  walk->active = malloc (size * sizeof (uint32_t));
+  walk->active_count = 0;
+  walk->dense = false;
+  return walk->mass != NULL && walk->is_active != NULL
+         && walk->active != NULL;
+}
+
+static void add_mass (WalkMass *walk, uint32_t node, double mass)
+{
+  if (!walk->dense && !walk->is_active[node])
+    {
+      walk->is_active[node] = true;
+      walk->active[walk->active_count++] = node;
+    }
+  walk->mass[node] += mass;
+}
+
+/**
+ * move the mass of a node to its successors in next.
+ */
+static void move_node_mass (const SparseMatrix *transitions, WalkMass *walk,
+                            uint32_t node, WalkMass *next)
+{
+  double mass = walk->mass[node];
+  for (uint32_t entry = transitions->row_start[node];
+       entry < transitions->row_start[node + 1]; entry++)
+    {
+      add_mass (next, transitions->columns[entry],
+                transitions->coefficients[entry] * mass);
+    }
+  walk->mass[node] = 0;
+}
+
+/**
+ * move all the mass of the walk one step on, to next, which is empty.
+ */
+static void move_mass (const SparseMatrix *transitions, WalkMass *walk,
+                       WalkMass *next)
+{
+  if (walk->dense)
+    {
+      for (uint32_t node = 0; node < transitions->size; node++)
+        {
+          if (walk->mass[node] != 0)
+            {
+              move_node_mass (transitions, walk, node, next);
+            }
+        }
+      return;
+    }
+  for (uint32_t i = 0; i < walk->active_count; i++)
+    {
+      move_node_mass (transitions, walk, walk->active[i], next);
+      walk->is_active[walk->active[i]] = false;
+    }
+  walk->active_count = 0;
+  if (next->active_count > transitions->size / WALK_DENSE_FRACTION)
+    {
+      walk->dense = true;
+      next->dense = true;
+    }
+}
+
+/**
+ * move the mass of the walk that is at the detours (the transient nodes
+ * whose step doesn't count) on, until it all is at nodes whose step counts
+ * (or absorbed).
+ */
+static void settle (const SparseMatrix *transitions, const uint32_t *detours,
+                    uint32_t detour_count, WalkMass *walk)
+{
+  bool moved = true;
+  for (uint32_t round = 0; moved && round < transitions->size; round++)
+    {
+      moved = false;
+      for (uint32_t i = 0; i < detour_count; i++)
+        {
+          if (walk->mass[detours[i]] != 0)
+            {
+              move_node_mass (transitions, walk, detours[i], walk);
+              moved = true;
+            }
+        }
+    }
+}
+
+static double walk_mass_total (const WalkMass *walk, uint32_t size)
+{
+  double total = 0;
+  if (walk->dense)
+    {
+      for (uint32_t node = 0; node < size; node++)
+        {
+          total += walk->mass[node];
+        }
+      return total;
+    }
+  for (uint32_t i = 0; i < walk->active_count; i++)
+    {
+      total += walk->mass[walk->active[i]];
+    }
+  return total;
+}
+
+/**
+ * @return a new array of the transient nodes whose step doesn't count, and
+ * their amount in detour_count; NULL in case of allocation failure.
+ */
+static uint32_t *find_detours (const SparseMatrix *transitions,
+                               const bool *counts_step,
+                               uint32_t *detour_count)
+{
+  uint32_t *detours = malloc (((size_t) transitions->size + 1)
+                              * sizeof (uint32_t));
+  *detour_count = 0;
+  for (uint32_t i = 0; detours != NULL && i < transitions->size; i++)
+    {
+      if (!counts (counts_step, i)
+          && transitions->row_start[i] < transitions->row_start[i + 1])
+        {
+          detours[(*detour_count)++] = i;
+        }
+    }
+  return detours;
+}
+
+/**
+ * fill stats->finish_probability by moving the distribution of the walk
+ * over the transient nodes one counted step at a time, until at most
+ * curve_tail of it is left or the horizon is reached. stats->horizon is
+ * set to the last step computed.
+ */
+static bool compute_finish_probability (const SparseMatrix *transitions,
+                                        const bool *counts_step,
+                                        uint32_t start_node,
+                                        double curve_tail,
+                                        AbsorbingChainStats *stats)
+{
+  WalkMass walk, next;
+  uint32_t detour_count;
+  uint32_t *detours = find_detours (transitions, counts_step,
+                                    &detour_count);
+  bool allocated = walk_mass_alloc (&walk, transitions->size);
+  allocated = walk_mass_alloc (&next, transitions->size) && allocated;
+  if (!allocated || detours == NULL)
+    {
+      walk_mass_free (&walk);
+      walk_mass_free (&next);
+      free (detours);
+      return false;
+    }
+  add_mass (&walk, start_node, 1);
+  settle (transitions, detours, detour_count, &walk);
+  uint32_t horizon = stats->horizon;
+  for (uint32_t k = 0; k <= horizon; k++)
+    {
+      if (k > 0)
+        {
+          move_mass (transitions, &walk, &next);
+          WalkMass swap = walk;
+          walk = next;
+          next = swap;
+          settle (transitions, detours, detour_count, &walk);
+        }
+      double remaining = walk_mass_total (&walk, transitions->size);
+      // rounding may leave a little more mass than there is.
+      stats->finish_probability[k] = fmax (0, 1 - remaining);
+      stats->horizon = k;
+      if (remaining <= curve_tail)
+        {
+          break;
+        }
+    }
+  walk_mass_free (&walk);
+  walk_mass_free (&next);
+  free (detours);
+  return true;
+}
+
+/**
+ * fill stats->expected_length and stats->length_variance, from the first
+ * two moments of the length: t = c + Q t, m = c + 2 c (Q t) + Q m.
+ */
+static bool compute_length_moments (const AbsorbingSolver *solver,
+                                    const bool *counts_step,
+                                    uint32_t start_node,
+                                    AbsorbingChainStats *stats)
+{
+  uint32_t size = solver->transitions->size;
+  double *cost = calloc (size, sizeof (double));
+  double *length = malloc (size * sizeof (double));
+  double *square = malloc (size * sizeof (double));
+  if (cost == NULL || length == NULL || square == NULL)
+    {
+      free (cost);
+      free (length);
+      free (square);
+      return false;
+    }
+  for (uint32_t i = 0; i < size; i++)
+    {
+      cost[i] = counts (counts_step, i) ? 1 : 0;
+    }
+  stats->converged = solver_solve (solver, false, cost, length)
+                     && stats->converged;
+
+  multiply (solver->transitions, length, square);
+  for (uint32_t i = 0; i < size; i++)
+    {
+      // cost is 0 or 1, so it is its own square.
+      cost[i] += 2 * cost[i] * square[i];
+    }
+  stats->converged = solver_solve (solver, false, cost, square)
+                     && stats->converged;
+
+  stats->expected_length = length[start_node];
+  stats->length_variance = square[start_node]
+                           - length[start_node] * length[start_node];
+  free (cost);
+  free (length);
+  free (square);
+  return true;
+}
+
+/**
+ * fill stats->expected_visits: v = e_start + Q^T v for the transient
+ * nodes, and the absorption probabilities for the rest.
+ */
+static void compute_expected_visits (const FrozenChain *frozen,
+                                     const AbsorbingSolver *solver,
+                                     double *start_vector,
+                                     uint32_t start_node,
+                                     AbsorbingChainStats *stats)
+{
+  start_vector[start_node] = 1;
+  stats->converged = solver_solve (solver, true, start_vector,
+                                   stats->expected_visits)
+                     && stats->converged;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (!is_transient (frozen, i))
+        {
+          stats->expected_visits[i] = (i == start_node) ? 1 : 0;
+        }
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (!is_transient (frozen, i))
+        {
+          continue;
+        }
+      const FrozenNode *frozen_node = &frozen->nodes[i];
+      for (uint32_t edge = 0; edge < frozen_node->edge_count; edge++)
+        {
+          uint32_t target = frozen_edge_target (frozen,
+                                                frozen_node->first_edge
+                                                + edge);
+          if (!is_transient (frozen, target))
+            {
+              stats->expected_visits[target] += stats->expected_visits[i]
+                  * edge_probability (frozen, frozen_node, edge);
+            }
+        }
+    }
+}
+
+bool absorbing_chain_analyze (const FrozenChain *frozen, uint32_t start_node,
+                              const bool *counts_step, uint32_t horizon,
+                              double curve_tail, AbsorbingChainStats *stats)
+{
+  stats->node_count = frozen->node_count;
+  stats->horizon = horizon;
+  stats->converged = true;
+  stats->expected_length = 0;
+  stats->length_variance = 0;
+  stats->expected_visits = calloc (frozen->node_count, sizeof (double));
+  stats->finish_probability = malloc (((size_t) horizon + 1)
+                                      * sizeof (double));
+  double *start_vector = calloc (frozen->node_count, sizeof (double));
+  SparseMatrix transitions = {0}, transposed = {0};
+  bool ans = stats->expected_visits != NULL
+             && stats->finish_probability != NULL && start_vector != NULL
+             && build_transitions (frozen, &transitions);
+  if (ans && !transpose (&transitions, &transposed))
+    {
+      sparse_matrix_free (&transitions);
+      ans = false;
+    }
+  if (!ans)
+    {
+      free (start_vector);
+      absorbing_chain_stats_free (stats);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+
+  if (is_transient (frozen, start_node))
+    {
+      AbsorbingSolver solver = {&transitions, &transposed, {0}, false};
+      solver.factorized = profile_lu_factorize (&solver.lu, &transitions);
+      ans = compute_length_moments (&solver, counts_step, start_node, stats)
+            && compute_finish_probability (&transitions, counts_step,
+                                           start_node, curve_tail, stats);
+      compute_expected_visits (frozen, &solver, start_vector, start_node,
+                               stats);
+      profile_lu_free (&solver.lu);
+    }
+  else
+    {
+      // the walk is absorbed right away.
+      stats->expected_visits[start_node] = 1;
+      stats->finish_probability[0] = 1;
+      stats->horizon = 0;
+    }
+
+  free (start_vector);
+  sparse_matrix_free (&transitions);
+  sparse_matrix_free (&transposed);
+  if (!ans)
+    {
+      absorbing_chain_stats_free (stats);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+    }
+  return ans;
+}
+
+void absorbing_chain_stats_free (AbsorbingChainStats *stats)
+{
+  free (stats->expected_visits);
+  free (stats->finish_probability);
+  stats->expected_visits = NULL;
+  stats->finish_probability = NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef _ABSORBING_CHAIN_H_
+#define _ABSORBING_CHAIN_H_
+
+#include "frozen_chain.h"
+
+// chains whose LU profile (see absorbing_chain_analyze) has more entries
+// than this are solved iteratively.
+#define ABSORBING_CHAIN_MAX_PROFILE (1UL << 25)
+
+// iterative linear solves stop once the norm of the residual is this small,
+// relative to the norm of the right hand side.
+#define ABSORBING_CHAIN_TOLERANCE 1e-14
+#define ABSORBING_CHAIN_MAX_ITERATIONS 10000
+
+/**
+ * Exact statistics of a walk on a frozen chain, from a start node until it
+ * is absorbed. Absorbing nodes are the ones a walk stops at (see
+ * frozen_walk): nodes without FROZEN_NODE_CONTINUES, or without out-edges.
+ * The length of a walk is the amount of steps it takes that count (see
+ * absorbing_chain_analyze).
+ */
+typedef struct AbsorbingChainStats {
+    uint32_t node_count;
+
+    // expected length of the walk, and its variance.
+    double expected_length;
+    double length_variance;
+
+    // expected_visits[i] is the expected amount of times the walk is at
+    // node i (the start counts as a visit). For an absorbing node it is the
+    // probability that the walk ends there.
+    double *expected_visits;
+
+    // finish_probability[k] is the probability that the walk is absorbed
+    // within k counted steps, for k = 0 .. horizon. The curve stops at the
+    // first k where it reaches 1 - curve_tail (see absorbing_chain_analyze),
+    // so horizon may be smaller than the one asked for.
+    double *finish_probability;
+    uint32_t horizon;
+
+    // false if the chain had to be solved iteratively and that didn't
+    // converge within ABSORBING_CHAIN_MAX_ITERATIONS, e.g. when the walk
+    // may never be absorbed.
+    bool converged;
+} AbsorbingChainStats;
+
+/**
+ * Compute the statistics of a walk on a frozen chain exactly, instead of
+ * sampling walks, from the sparse transition matrix Q between the
+ * transient nodes. The moments of the length and the visits come from the
+ * systems of the fundamental matrix (I - Q)^-1, solved with one sparse LU
+ * factorization in the node order when its profile is small enough (as
+ * for a board, whose steps are short in the node order), and with
+ * preconditioned BiCGSTAB otherwise. finish_probability comes from
+ * moving the distribution of the walk step by step, over the nodes it
+ * reached only.
+ * @param frozen the frozen chain
+ * @param start_node index of the node every walk starts from
+ * @param counts_step counts_step[i] tells if a step from node i adds to the
+ * length of the walk (steps that don't count, e.g. following a ladder,
+ * must not form a cycle). NULL to count every step.
+ * @param horizon biggest k of finish_probability
+ * @param curve_tail finish_probability stops once the walk is absorbed
+ * with probability at least 1 - curve_tail (0 to always reach horizon)
+ * @param stats filled with the statistics, its arrays are allocated
+ * @return true on success, false in case of allocation error.
+ */
+bool absorbing_chain_analyze (const FrozenChain *frozen, uint32_t start_node,
+                              const bool *counts_step, uint32_t horizon,
+                              double curve_tail, AbsorbingChainStats *stats);
+
+/**
+ * Free the arrays of stats filled by absorbing_chain_analyze.
+ * @param stats the stats to free
+ */
+void absorbing_chain_stats_free (AbsorbingChainStats *stats);
+
+#endif //_ABSORBING_CHAIN_H_
@@ -0,0 +1,96 @@
+#include "alias_table.h"
+#include "markov_chain.h"
+
+bool alias_table_build (AliasTable *table, const uint32_t *weights,
+                        uint32_t size)
+{
+  table->size = size;
+  table->alias = malloc (size * sizeof (uint32_t));
+  table->threshold = malloc (size * sizeof (uint32_t));
+  double *probability = malloc (size * sizeof (double));
+  // small indexes are stacked from the start of work_list, large ones from
+  // its end.
+  uint32_t *work_list = malloc (size * sizeof (uint32_t));
+  if (table->alias == NULL || table->threshold == NULL
+      || probability == NULL || work_list == NULL)
+    {
+      free (probability);
+      free (work_list);
+      alias_table_free (table);
+      return false;
+    }
+
+  double sigma_weights = 0;
+  for (uint32_t i = 0; i < size; i++)
+    {
+      sigma_weights += weights[i];
+    }
+
+  uint32_t small_count = 0;
+  uint32_t large_start = size;
+  for (uint32_t i = 0; i < size; i++)
+    {
+      probability[i] = weights[i] * (double) size / sigma_weights;
+      if (probability[i] < 1)
+        {
+          work_list[small_count++] = i;
+        }
+      else
+        {
+          work_list[--large_start] = i;
+        }
+    }
+
+  while (small_count > 0 && large_start < size)
+    {
+      uint32_t small = work_list[--small_count];
+      uint32_t large = work_list[large_start++];
+      table->threshold[small] = (uint32_t) (probability[small]
+                                            * ALIAS_PROBABILITY_SCALE);
+      table->alias[small] = large;
+      probability[large] += probability[small] - 1;
+      if (probability[large] < 1)
+        {
+          work_list[small_count++] = large;
+        }
+      else
+        {
+          work_list[--large_start] = large;
+        }
+    }
+
+  // whatever is left has a probability of 1, up to rounding errors.
+  while (small_count > 0)
+    {
+      uint32_t index = work_list[--small_count];
+      table->threshold[index] = ALIAS_PROBABILITY_SCALE;
+      table->alias[index] = index;
+    }
+  while (large_start < size)
+    {
+      uint32_t index = work_list[large_start++];
+      table->threshold[index] = ALIAS_PROBABILITY_SCALE;
+      table->alias[index] = index;
+    }
+
+  free (probability);
+  free (work_list);
+  return true;
+}
+
+uint32_t alias_table_sample (const AliasTable *table, RandomStream *stream)
+{
+  uint32_t index = random_stream_below (stream, table->size);
+  // the top 30 bits of a draw are uniform over ALIAS_PROBABILITY_SCALE.
+  uint32_t coin = random_stream_next (stream) >> 2;
+  return (coin < table->threshold[index]) ? index : table->alias[index];
+}
+
+void alias_table_free (AliasTable *table)
+{
+  free (table->alias);
+  free (table->threshold);
+  table->alias = NULL;
+  table->threshold = NULL;
+  table->size = 0;
+}
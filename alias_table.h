@@ -0,0 +1,47 @@
+#ifndef _ALIAS_TABLE_H_
+#define _ALIAS_TABLE_H_
+
+#include <stdint.h>  // for uint32_t
+#include <stdbool.h> // for bool
+#include "random_stream.h"
+
+// probabilities in the table are stored as fractions of this value.
+#define ALIAS_PROBABILITY_SCALE (1 << 30)
+
+/**
+ * Walker / Vose alias table: samples an index 0..size-1 with probability
+ * proportional to its weight in O(1). Entry i is kept with probability
+ * threshold[i] / ALIAS_PROBABILITY_SCALE, and replaced by alias[i]
+ * otherwise.
+ */
+typedef struct AliasTable {
+    uint32_t size;
+    uint32_t *alias;
+    uint32_t *threshold;
+} AliasTable;
+
+/**
+ * Build an alias table over the given weights.
+ * @param table the table to build, its arrays are allocated
+ * @param weights the weight of each index, not all zero
+ * @param size amount of weights, bigger than 0
+ * @return true on success, false in case of allocation error.
+ */
+bool alias_table_build (AliasTable *table, const uint32_t *weights,
+                        uint32_t size);
+
+/**
+ * Sample one index from the table.
+ * @param table a built table
+ * @param stream the stream to draw from
+ * @return the chosen index.
+ */
+uint32_t alias_table_sample (const AliasTable *table, RandomStream *stream);
+
+/**
+ * Free the arrays of a table built by alias_table_build.
+ * @param table the table to free
+ */
+void alias_table_free (AliasTable *table);
+
+#endif //_ALIAS_TABLE_H_
@@ -0,0 +1,122 @@
+#include <sys/mman.h>
+#include "arena.h"
+#include "markov_stats.h"
+
+static size_t align_size (size_t size)
+{
+  return (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+Arena *arena_create (size_t slab_size)
+{
+  Arena *arena = malloc (sizeof (Arena));
+  if (arena == NULL)
+    {
+      return NULL;
+    }
+  arena->slabs = NULL;
+  arena->slab_size = align_size (slab_size);
+  arena->mappings = NULL;
+  return arena;
+}
+
+/**
+ * allocate a new slab able to hold at least size bytes and push it in
+ * front of the arena's slabs.
+ */
+static ArenaSlab *arena_add_slab (Arena *arena, size_t size)
+{
+  size_t capacity = size > arena->slab_size ? size : arena->slab_size;
+  MARKOV_STATS_ALLOCATION (align_size (sizeof (ArenaSlab)) + capacity);
+  // the slab header is followed by its memory, in the same mapping. Slabs
+  // are mapped rather than taken from malloc, so freeing them always gives
+  // their pages back, whatever was allocated after them.
+  ArenaSlab *slab = mmap (NULL, align_size (sizeof (ArenaSlab)) + capacity,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slab == MAP_FAILED)
+    {
+      return NULL;
+    }
+  slab->memory = (unsigned char *) slab + align_size (sizeof (ArenaSlab));
+  slab->used = 0;
+  slab->capacity = capacity;
+
+  if (arena->slabs != NULL && capacity > arena->slab_size)
+    {
+      // keep filling the current slab, an oversized slab is full at once.
+      slab->next = arena->slabs->next;
+      arena->slabs->next = slab;
+    }
+  else
+    {
+      slab->next = arena->slabs;
+      arena->slabs = slab;
+    }
+  return slab;
+}
+
+void *arena_alloc (Arena *arena, size_t size)
+{
+  size = align_size (size);
+  ArenaSlab *slab = arena->slabs;
+  if (slab == NULL || slab->capacity - slab->used < size)
+    {
+      slab = arena_add_slab (arena, size);
+      if (slab == NULL)
+        {
+          return NULL;
+        }
+    }
+  void *memory = slab->memory + slab->used;
+  slab->used += size;
+  return memory;
+}
+
+bool arena_adopt_mapping (Arena *arena, void *address, size_t length)
+{
+  ArenaMapping *mapping = arena_alloc (arena, sizeof (ArenaMapping));
+  if (mapping == NULL)
+    {
+      return false;
+    }
+  mapping->address = address;
+  mapping->length = length;
+  mapping->next = arena->mappings;
+  arena->mappings = mapping;
+  return true;
+}
+
+size_t arena_reserved_bytes (const Arena *arena, size_t *slab_count)
+{
+  size_t bytes = 0;
+  *slab_count = 0;
+  for (const ArenaSlab *slab = arena->slabs; slab != NULL; slab = slab->next)
+    {
+      bytes += align_size (sizeof (ArenaSlab)) + slab->capacity;
+      (*slab_count)++;
+    }
+  return bytes;
+}
+
+void arena_free (Arena *arena)
+{
+  if (arena == NULL)
+    {
+      return;
+    }
+  // the list of mappings lives in the slabs, so it goes first.
+  for (ArenaMapping *mapping = arena->mappings; mapping != NULL;
+       mapping = mapping->next)
+    {
+      munmap (mapping->address, mapping->length);
+    }
+  ArenaSlab *slab = arena->slabs;
+  while (slab != NULL)
+    {
+      ArenaSlab *next_slab = slab->next;
+      munmap (slab, align_size (sizeof (ArenaSlab)) + slab->capacity);
+      slab = next_slab;
+    }
+  free (arena);
+}
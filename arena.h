@@ -0,0 +1,82 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdlib.h>  // For malloc()
+#include <stdbool.h> // For bool
+
+#define ARENA_DEFAULT_SLAB_SIZE (1UL << 20)
+#define ARENA_ALIGNMENT 16
+
+/**
+ * One large block of memory, handed out front to back.
+ */
+typedef struct ArenaSlab {
+    struct ArenaSlab *next;
+    size_t used;
+    size_t capacity;
+    unsigned char *memory;
+} ArenaSlab;
+
+/**
+ * A mapping the arena owns, unmapped by arena_free (see
+ * arena_adopt_mapping).
+ */
+typedef struct ArenaMapping {
+    struct ArenaMapping *next;
+    void *address;
+    size_t length;
+} ArenaMapping;
+
+/**
+ * Bump-pointer allocator: memory is carved from slabs and can only be
+ * released all at once, by arena_free.
+ */
+typedef struct Arena {
+    ArenaSlab *slabs;
+    size_t slab_size;
+    ArenaMapping *mappings;
+} Arena;
+
+/**
+ * Create an empty arena.
+ * @param slab_size size in bytes of each slab
+ * @return the new arena, NULL in case of allocation failure.
+ */
+Arena *arena_create (size_t slab_size);
+
+/**
+ * Allocate memory from the arena, aligned to ARENA_ALIGNMENT. Requests
+ * bigger than the slab size get a slab of their own.
+ * @param arena the arena to allocate from
+ * @param size number of bytes to allocate
+ * @return pointer to the memory, NULL in case of allocation failure.
+ */
+void *arena_alloc (Arena *arena, size_t size);
+
+/**
+ * Make the arena own a mapping (of a file, for example), so it lives as
+ * long as the memory carved from the arena and is unmapped with it. The
+ * mapping is not counted by arena_reserved_bytes.
+ * @param arena the arena
+ * @param address start of the mapping, as returned by mmap
+ * @param length length of the mapping in bytes
+ * @return true on success, false in case of allocation failure (the
+ * mapping is then left to the caller).
+ */
+bool arena_adopt_mapping (Arena *arena, void *address, size_t length);
+
+/**
+ * @param arena the arena
+ * @param slab_count output, amount of slabs of the arena
+ * @return the bytes of all the slabs of the arena, used or not.
+ */
+size_t arena_reserved_bytes (const Arena *arena, size_t *slab_count);
+
+/**
+ * Release all the slabs and mappings of the arena and the arena itself, in
+ * O(number of slabs and mappings).
+ * @param arena the arena to free, may be NULL
+ */
+void arena_free (Arena *arena);
+
+#endif //_ARENA_H_
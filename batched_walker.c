@@ -0,0 +1,366 @@
+// the AVX2 path exists on x86 only; other targets step with
+// step_group_scalar.
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCHED_WALKER_X86 1
+#include <immintrin.h>
+#endif
+#include "batched_walker.h"
+#include "markov_chain.h"
+
+/**
+ * The walkers of a run, as arrays by lane (struct of arrays), so a group
+ * of lanes is loaded into vectors at once. rng_* is the xoshiro128** state
+ * of every lane.
+ */
+typedef struct WalkerLanes {
+    uint32_t node[BATCHED_WALKER_LANES];
+    uint32_t steps[BATCHED_WALKER_LANES];
+    uint32_t redirects[BATCHED_WALKER_LANES];
+    uint32_t rng_0[BATCHED_WALKER_LANES];
+    uint32_t rng_1[BATCHED_WALKER_LANES];
+    uint32_t rng_2[BATCHED_WALKER_LANES];
+    uint32_t rng_3[BATCHED_WALKER_LANES];
+    // the nodes the lanes of the last stepped group were at.
+    uint32_t previous_node[BATCHED_WALKER_GROUP];
+} WalkerLanes;
+
+static inline uint32_t rotate_left (uint32_t value, int shift)
+{
+  return (value << shift) | (value >> (32 - shift));
+}
+
+/**
+ * step the lanes first_lane .. first_lane + BATCHED_WALKER_GROUP - 1 one
+ * at a time. Lanes that are done (absorbed, at the step cap, or without a
+ * walk) stay where they are.
+ * @return a mask of the lanes that are done, bit i for lane first_lane + i.
+ */
+static uint32_t step_group_scalar (const BatchedWalker *walker,
+                                   WalkerLanes *lanes, uint32_t first_lane,
+                                   uint32_t max_steps)
+{
+  uint32_t done_mask = 0;
+  for (uint32_t i = 0; i < BATCHED_WALKER_GROUP; i++)
+    {
+      uint32_t lane = first_lane + i;
+      uint32_t node = lanes->node[lane];
+      uint32_t info = walker->info[node];
+      bool counts = info & BATCHED_WALKER_COUNTS_STEP;
+      lanes->previous_node[i] = node;
+      if ((info & BATCHED_WALKER_ABSORBING)
+          || (counts && lanes->steps[lane] == max_steps))
+        {
+          done_mask |= 1u << i;
+          continue;
+        }
+
+      uint32_t *rng_0 = &lanes->rng_0[lane], *rng_1 = &lanes->rng_1[lane];
+      uint32_t *rng_2 = &lanes->rng_2[lane], *rng_3 = &lanes->rng_3[lane];
+      uint32_t random = rotate_left (*rng_1 * 5, 7) * 9;
+      uint32_t shifted = *rng_1 << 9;
+      *rng_2 ^= *rng_0;
+      *rng_3 ^= *rng_1;
+      *rng_1 ^= *rng_2;
+      *rng_0 ^= *rng_3;
+      *rng_2 ^= shifted;
+      *rng_3 = rotate_left (*rng_3, 11);
+
+      uint32_t roll = (uint32_t) (((uint64_t) random
+                                   * (info >> BATCHED_WALKER_COUNT_SHIFT))
+                                  >> 32);
+      lanes->node[lane] = walker->targets[walker->first_edge[node] + roll];
+      lanes->steps[lane] += counts;
+      lanes->redirects[lane] += !counts;
+    }
+  return done_mask;
+}
+
+#ifdef BATCHED_WALKER_X86
+// the AVX2 functions are compiled for AVX2 whatever the build flags are,
+// and called only after checking the cpu.
+#define AVX2_FUNCTION __attribute__((target ("avx2")))
+
+AVX2_FUNCTION
+static inline __m256i rotate_left_avx2 (__m256i value, int shift)
+{
+  return _mm256_or_si256 (_mm256_slli_epi32 (value, shift),
+                          _mm256_srli_epi32 (value, 32 - shift));
+}
+
+/**
+ * step_group_scalar, with AVX2: the tables are gathered, and the dice of
+ * all the lanes are drawn at once.
+ */
+AVX2_FUNCTION
+static uint32_t step_group_avx2 (const BatchedWalker *walker,
+                                 WalkerLanes *lanes, uint32_t first_lane,
+                                 uint32_t max_steps)
+{
+#define LANE_VECTOR(array) ((__m256i *) (lanes->array + first_lane))
+  __m256i node = _mm256_loadu_si256 (LANE_VECTOR (node));
+  __m256i steps = _mm256_loadu_si256 (LANE_VECTOR (steps));
+  __m256i info = _mm256_i32gather_epi32 ((const int *) walker->info, node,
+                                         4);
+  _mm256_storeu_si256 ((__m256i *) lanes->previous_node, node);
+
+  __m256i absorbing_flag = _mm256_set1_epi32 (BATCHED_WALKER_ABSORBING);
+  __m256i counts_flag = _mm256_set1_epi32 (BATCHED_WALKER_COUNTS_STEP);
+  __m256i counts = _mm256_cmpeq_epi32 (_mm256_and_si256 (info, counts_flag),
+                                       counts_flag);
+  __m256i done = _mm256_or_si256 (
+      _mm256_cmpeq_epi32 (_mm256_and_si256 (info, absorbing_flag),
+                          absorbing_flag),
+      _mm256_and_si256 (counts, _mm256_cmpeq_epi32 (
+          steps, _mm256_set1_epi32 ((int) max_steps))));
+  uint32_t done_mask = (uint32_t) _mm256_movemask_ps (
+      _mm256_castsi256_ps (done));
+  if (done_mask == (1u << BATCHED_WALKER_GROUP) - 1)
+    {
+      return done_mask;
+    }
+
+  __m256i rng_0 = _mm256_loadu_si256 (LANE_VECTOR (rng_0));
+  __m256i rng_1 = _mm256_loadu_si256 (LANE_VECTOR (rng_1));
+  __m256i rng_2 = _mm256_loadu_si256 (LANE_VECTOR (rng_2));
+  __m256i rng_3 = _mm256_loadu_si256 (LANE_VECTOR (rng_3));
+  __m256i random = _mm256_mullo_epi32 (
+      rotate_left_avx2 (_mm256_mullo_epi32 (rng_1, _mm256_set1_epi32 (5)),
+                        7), _mm256_set1_epi32 (9));
+  __m256i shifted = _mm256_slli_epi32 (rng_1, 9);
+  __m256i next_2 = _mm256_xor_si256 (rng_2, rng_0);
+  __m256i next_3 = _mm256_xor_si256 (rng_3, rng_1);
+  __m256i next_1 = _mm256_xor_si256 (rng_1, next_2);
+  __m256i next_0 = _mm256_xor_si256 (rng_0, next_3);
+  next_2 = _mm256_xor_si256 (next_2, shifted);
+  next_3 = rotate_left_avx2 (next_3, 11);
+  // lanes that are done keep their state.
+  _mm256_storeu_si256 (LANE_VECTOR (rng_0),
+                       _mm256_blendv_epi8 (next_0, rng_0, done));
+  _mm256_storeu_si256 (LANE_VECTOR (rng_1),
+                       _mm256_blendv_epi8 (next_1, rng_1, done));
+  _mm256_storeu_si256 (LANE_VECTOR (rng_2),
+                       _mm256_blendv_epi8 (next_2, rng_2, done));
+  _mm256_storeu_si256 (LANE_VECTOR (rng_3),
+                       _mm256_blendv_epi8 (next_3, rng_3, done));
+
+  // roll = (random * edge_count) >> 32, from the 64 bit products of the
+  // even and of the odd lanes.
+  __m256i edge_count = _mm256_srli_epi32 (info, BATCHED_WALKER_COUNT_SHIFT);
+  __m256i even = _mm256_srli_epi64 (_mm256_mul_epu32 (random, edge_count),
+                                    32);
+  __m256i odd = _mm256_mul_epu32 (_mm256_srli_epi64 (random, 32),
+                                  _mm256_srli_epi64 (edge_count, 32));
+  __m256i roll = _mm256_blend_epi32 (even, odd, 0xAA);
+
+  __m256i first_edge = _mm256_i32gather_epi32 (
+      (const int *) walker->first_edge, node, 4);
+  __m256i next_node = _mm256_i32gather_epi32 (
+      (const int *) walker->targets, _mm256_add_epi32 (first_edge, roll), 4);
+  _mm256_storeu_si256 (LANE_VECTOR (node),
+                       _mm256_blendv_epi8 (next_node, node, done));
+
+  // the masks are -1 where true, so subtracting them adds 1.
+  __m256i moving = _mm256_xor_si256 (done, _mm256_set1_epi32 (-1));
+  _mm256_storeu_si256 (LANE_VECTOR (steps),
+                       _mm256_sub_epi32 (steps,
+                                         _mm256_and_si256 (counts, moving)));
+  __m256i redirects = _mm256_loadu_si256 (LANE_VECTOR (redirects));
+  _mm256_storeu_si256 (LANE_VECTOR (redirects),
+                       _mm256_sub_epi32 (redirects,
+                                         _mm256_andnot_si256 (counts,
+                                                              moving)));
+#undef LANE_VECTOR
+  return done_mask;
+}
+#endif // BATCHED_WALKER_X86
+
+bool batched_walker_fits (const FrozenChain *frozen)
+{
+  if (frozen->edge_count >= INT32_MAX || frozen->node_count >= INT32_MAX)
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const FrozenNode *frozen_node = &frozen->nodes[i];
+      if (!(frozen_node->flags & FROZEN_NODE_CONTINUES)
+          || frozen_node->edge_count == 0)
+        {
+          continue;
+        }
+      uint32_t first_edge = frozen_node->first_edge;
+      for (uint32_t j = 0; j < frozen_node->edge_count; j++)
+        {
+          if (frozen_edge_cumulative_frequency (frozen, first_edge + j)
+              != (j + 1) * frozen_edge_cumulative_frequency (frozen,
+                                                             first_edge))
+            {
+              return false;
+            }
+        }
+    }
+  return true;
+}
+
+bool batched_walker_init (BatchedWalker *walker, const FrozenChain *frozen,
+                          const bool *counts_step)
+{
+  walker->node_count = frozen->node_count;
+  walker->first_edge = malloc ((frozen->node_count + 1) * sizeof (uint32_t));
+  walker->info = malloc ((frozen->node_count + 1) * sizeof (uint32_t));
+  walker->targets = malloc ((frozen->edge_count + 1) * sizeof (uint32_t));
+  if (walker->first_edge == NULL || walker->info == NULL
+      || walker->targets == NULL)
+    {
+      batched_walker_free (walker);
+      return false;
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const FrozenNode *frozen_node = &frozen->nodes[i];
+      walker->first_edge[i] = frozen_node->first_edge;
+      walker->info[i] = frozen_node->edge_count << BATCHED_WALKER_COUNT_SHIFT;
+      if (!(frozen_node->flags & FROZEN_NODE_CONTINUES)
+          || frozen_node->edge_count == 0)
+        {
+          walker->info[i] |= BATCHED_WALKER_ABSORBING;
+        }
+      if (counts_step == NULL || counts_step[i])
+        {
+          walker->info[i] |= BATCHED_WALKER_COUNTS_STEP;
+        }
+    }
+  // the place of the walkers without a walk.
+  walker->first_edge[frozen->node_count] = 0;
+  walker->info[frozen->node_count] = BATCHED_WALKER_ABSORBING;
+  for (uint32_t i = 0; i < frozen->edge_count; i++)
+    {
+      walker->targets[i] = frozen_edge_target (frozen, i);
+    }
+
+#ifdef BATCHED_WALKER_X86
+  __builtin_cpu_init ();
+  walker->step_group = __builtin_cpu_supports ("avx2") ? step_group_avx2
+                                                       : step_group_scalar;
+#else
+  walker->step_group = step_group_scalar;
+#endif
+  return true;
+}
+
+/**
+ * start a walk on a lane, with a generator seeded from its stream.
+ */
+static void start_walk (WalkerLanes *lanes, uint32_t lane,
+                        uint32_t start_node, uint64_t seed, uint64_t walk)
+{
+  RandomStream stream;
+  random_stream_init (&stream, seed, walk);
+  lanes->node[lane] = start_node;
+  lanes->steps[lane] = 0;
+  lanes->redirects[lane] = 0;
+  lanes->rng_0[lane] = random_stream_next (&stream);
+  lanes->rng_1[lane] = random_stream_next (&stream);
+  lanes->rng_2[lane] = random_stream_next (&stream);
+  lanes->rng_3[lane] = random_stream_next (&stream);
+  if ((lanes->rng_0[lane] | lanes->rng_1[lane] | lanes->rng_2[lane]
+       | lanes->rng_3[lane]) == 0)
+    {
+      // xoshiro must not start from the all zero state.
+      lanes->rng_0[lane] = 1;
+    }
+}
+
+/**
+ * add the walk that just ended on a lane to stats.
+ */
+static void record_walk (const BatchedWalker *walker, const WalkerLanes *lanes,
+                      uint32_t lane, WalkSimulationStats *stats)
+{
+  uint32_t node = lanes->node[lane];
+  uint32_t redirects = lanes->redirects[lane];
+  if (walker->info[node] & BATCHED_WALKER_ABSORBING)
+    {
+      stats->visits[node]++;
+      stats->finished++;
+      stats->finished_steps += lanes->steps[lane];
+      stats->length_histogram[lanes->steps[lane]]++;
+    }
+  if (redirects > stats->max_steps + 1)
+    {
+      redirects = stats->max_steps + 1;
+    }
+  stats->redirect_histogram[redirects]++;
+}
+
+bool batched_walker_run (const BatchedWalker *walker, uint32_t start_node,
+                         uint64_t seed, uint64_t first_walk,
+                         uint64_t end_walk, WalkSimulationStats *stats)
+{
+  WalkerLanes *lanes = malloc (sizeof (WalkerLanes));
+  if (lanes == NULL)
+    {
+      return false;
+    }
+  uint32_t idle_node = walker->node_count;
+  uint64_t next_walk = first_walk;
+  uint32_t running = 0;
+  for (uint32_t lane = 0; lane < BATCHED_WALKER_LANES; lane++)
+    {
+      if (next_walk < end_walk)
+        {
+          start_walk (lanes, lane, start_node, seed, next_walk++);
+          running++;
+        }
+      else
+        {
+          start_walk (lanes, lane, idle_node, seed, 0);
+        }
+    }
+
+  while (running > 0)
+    {
+      for (uint32_t first_lane = 0; first_lane < BATCHED_WALKER_LANES;
+           first_lane += BATCHED_WALKER_GROUP)
+        {
+          uint32_t done_mask = walker->step_group (walker, lanes, first_lane,
+                                                   stats->max_steps);
+          for (uint32_t i = 0; i < BATCHED_WALKER_GROUP; i++)
+            {
+              uint32_t lane = first_lane + i;
+              if (!(done_mask & (1u << i)))
+                {
+                  stats->visits[lanes->previous_node[i]]++;
+                  continue;
+                }
+              if (lanes->node[lane] == idle_node)
+                {
+                  continue;
+                }
+              record_walk (walker, lanes, lane, stats);
+              if (next_walk < end_walk)
+                {
+                  start_walk (lanes, lane, start_node, seed, next_walk++);
+                }
+              else
+                {
+                  lanes->node[lane] = idle_node;
+                  running--;
+                }
+            }
+        }
+    }
+  stats->walks += end_walk - first_walk;
+  free (lanes);
+  return true;
+}
+
+void batched_walker_free (BatchedWalker *walker)
+{
+  free (walker->first_edge);
+  free (walker->info);
+  free (walker->targets);
+  walker->first_edge = NULL;
+  walker->info = NULL;
+  walker->targets = NULL;
+}
@@ -0,0 +1,86 @@
+#ifndef _BATCHED_WALKER_H_
+#define _BATCHED_WALKER_H_
+
+#include "frozen_chain.h"
+#include "walk_simulation.h"
+
+// walkers advanced together by batched_walker_run.
+#define BATCHED_WALKER_LANES 1024
+// walkers advanced by one vector step.
+#define BATCHED_WALKER_GROUP 8
+
+// BatchedWalker info flags, below the edge count:
+// the walk stops at the node.
+#define BATCHED_WALKER_ABSORBING 1u
+// a step from the node adds to the length of the walk.
+#define BATCHED_WALKER_COUNTS_STEP 2u
+#define BATCHED_WALKER_COUNT_SHIFT 2
+
+struct WalkerLanes;
+
+/**
+ * Dense tables of a frozen chain whose nodes all pick their next node
+ * uniformly (like the cells of a board), for walking many walks at once.
+ * A step from node n takes the edge first_edge[n] + r, where r is drawn
+ * uniformly below info[n] >> BATCHED_WALKER_COUNT_SHIFT, so the next node
+ * is two table gathers away. The extra node node_count is the place of
+ * walkers that have no walk left.
+ */
+typedef struct BatchedWalker {
+    uint32_t node_count;
+    uint32_t *first_edge;
+    uint32_t *info;
+    uint32_t *targets;
+
+    // steps one group of walkers, with AVX2 on an x86 cpu that supports
+    // it.
+    uint32_t (*step_group) (const struct BatchedWalker *walker,
+                            struct WalkerLanes *lanes, uint32_t first_lane,
+                            uint32_t max_steps);
+} BatchedWalker;
+
+/**
+ * @param frozen a frozen chain
+ * @return true if every node a walk doesn't stop at has out-edges of the
+ * same frequency, so the chain can be walked by a BatchedWalker.
+ */
+bool batched_walker_fits (const FrozenChain *frozen);
+
+/**
+ * Build the tables of a frozen chain that batched_walker_fits.
+ * @param walker the walker to build, its tables are allocated
+ * @param frozen the frozen chain
+ * @param counts_step counts_step[i] tells if a step from node i adds to the
+ * length of the walk, NULL to count every step
+ * @return true on success, false in case of allocation error.
+ */
+bool batched_walker_init (BatchedWalker *walker, const FrozenChain *frozen,
+                          const bool *counts_step);
+
+/**
+ * Run the walks first_walk .. end_walk - 1, BATCHED_WALKER_LANES at a
+ * time, and add their statistics to stats (as walk_simulation_run does).
+ * Every walker draws from a xoshiro128** generator of its own, seeded
+ * from the stream (seed, walk) (see random_stream_init), so the results
+ * depend only on the seed and the walks, and are the same with and
+ * without AVX2. They are not the same as the ones of the walks of
+ * walk_simulation_run, only of the same distribution.
+ * @param walker the walker
+ * @param start_node index of the node every walk starts from
+ * @param seed the seed of the run
+ * @param first_walk number of the first walk
+ * @param end_walk number of the walk after the last one
+ * @param stats the stats to add to, allocated for the chain
+ * @return true on success, false in case of allocation error.
+ */
+bool batched_walker_run (const BatchedWalker *walker, uint32_t start_node,
+                         uint64_t seed, uint64_t first_walk,
+                         uint64_t end_walk, WalkSimulationStats *stats);
+
+/**
+ * Free the tables of a walker built by batched_walker_init.
+ * @param walker the walker to free
+ */
+void batched_walker_free (BatchedWalker *walker);
+
+#endif //_BATCHED_WALKER_H_
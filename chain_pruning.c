@@ -0,0 +1,654 @@
+#include <math.h>   // for log2()
+#include <string.h>
+#include "chain_pruning.h"
+#include "markov_chain.h"
+
+// the upper bounds of the divergence buckets but the last, see
+// PRUNE_DIVERGENCE_BUCKETS.
+static const double DIVERGENCE_BUCKET_BOUNDS[PRUNE_DIVERGENCE_BUCKETS - 1] =
+    {0, 0.01, 0.1, 1};
+
+/**
+ * an edge of the frozen chain, by its frequency, for sorting.
+ */
+typedef struct EdgeRank {
+    uint32_t frequency;
+    uint32_t edge;
+} EdgeRank;
+
+/**
+ * the working state of frozen_chain_prune, one entry per node or per edge
+ * of the original chain.
+ */
+typedef struct Pruning {
+    const FrozenChain *frozen;
+
+    // store the weights of the pruned chain quantized.
+    bool quantize;
+
+    // true for the nodes a walk draws a successor from: the start nodes,
+    // and the nodes a sequence continues after.
+    bool *walked;
+
+    // the most frequent edge of each node (the first of them on a tie).
+    uint32_t *top_edge;
+
+    // the edges that are kept.
+    bool *kept;
+
+    // the index of each node in the pruned chain, FROZEN_NO_NODE for the
+    // removed nodes.
+    uint32_t *remap;
+
+    // room for one EdgeRank per edge, and for one node index per node.
+    EdgeRank *ranks;
+    uint32_t *queue;
+} Pruning;
+
+/**
+ * @return the frequency of edges[edge], the i-th edge of node.
+ */
+static uint32_t edge_frequency (const FrozenChain *frozen,
+                                const FrozenNode *node, uint32_t i)
+{
+  uint32_t edge = node->first_edge + i;
+  return frozen_edge_cumulative_frequency (frozen, edge)
+         - ((i > 0) ? frozen_edge_cumulative_frequency (frozen, edge - 1)
+                    : 0);
+}
+
+/**
+ * @return the bytes the state of a node takes in the payload, with the
+ * padding up to the next state. The states are packed in the order of
+ * their nodes, also the ones frozen_chain_update appends.
+ */
+static size_t payload_span (const FrozenChain *frozen, uint32_t node_index)
+{
+  size_t end = (node_index + 1 < frozen->node_count)
+               ? frozen->nodes[node_index + 1].payload_offset
+               : frozen->payload_size;
+  return end - frozen->nodes[node_index].payload_offset;
+}
+
+/**
+ * rank the most frequent edges first, and the earlier ones first on a tie.
+ */
+static int compare_descending (const void *first, const void *second)
+{
+  const EdgeRank *rank1 = first, *rank2 = second;
+  if (rank1->frequency != rank2->frequency)
+    {
+      return (rank1->frequency > rank2->frequency) ? -1 : 1;
+    }
+  return (rank1->edge > rank2->edge) - (rank1->edge < rank2->edge);
+}
+
+/**
+ * rank the least frequent edges first, and the later ones first on a tie.
+ */
+static int compare_ascending (const void *first, const void *second)
+{
+  return compare_descending (second, first);
+}
+
+static void free_pruning (Pruning *pruning)
+{
+  free (pruning->walked);
+  free (pruning->top_edge);
+  free (pruning->kept);
+  free (pruning->remap);
+  free (pruning->ranks);
+  free (pruning->queue);
+}
+
+/**
+ * allocate the working arrays and find the walked nodes.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool init_pruning (Pruning *pruning, const FrozenChain *frozen)
+{
+  pruning->frozen = frozen;
+  // one more element, so an empty chain is not mistaken for an allocation
+  // failure.
+  pruning->walked = calloc (frozen->node_count + 1, sizeof (bool));
+  pruning->top_edge = malloc ((frozen->node_count + 1) * sizeof (uint32_t));
+  pruning->kept = calloc (frozen->edge_count + 1, sizeof (bool));
+  pruning->remap = malloc ((frozen->node_count + 1) * sizeof (uint32_t));
+  pruning->ranks = malloc ((frozen->edge_count + 1) * sizeof (EdgeRank));
+  pruning->queue = malloc ((frozen->node_count + 1) * sizeof (uint32_t));
+  if (pruning->walked == NULL || pruning->top_edge == NULL
+      || pruning->kept == NULL || pruning->remap == NULL
+      || pruning->ranks == NULL || pruning->queue == NULL)
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      pruning->walked[i] = frozen->nodes[i].flags & FROZEN_NODE_CONTINUES;
+    }
+  for (uint32_t i = 0; i < frozen->start_count; i++)
+    {
+      pruning->walked[frozen->start_nodes[i]] = true;
+    }
+  return true;
+}
+
+/**
+ * keep the edges of a walked node that pass min_count and top_k, and its
+ * most frequent edge in any case.
+ */
+static void select_node_edges (Pruning *pruning, uint32_t node_index,
+                               const PruneOptions *options)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  const FrozenNode *node = &frozen->nodes[node_index];
+  EdgeRank *ranks = pruning->ranks;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      ranks[i].frequency = edge_frequency (frozen, node, i);
+      ranks[i].edge = node->first_edge + i;
+    }
+  uint32_t allowed = node->edge_count;
+  if (options->top_k > 0 && node->edge_count > options->top_k)
+    {
+      qsort (ranks, node->edge_count, sizeof (EdgeRank),
+             compare_descending);
+      allowed = options->top_k;
+    }
+
+  uint32_t top = 0;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      if (compare_descending (&ranks[i], &ranks[top]) < 0)
+        {
+          top = i;
+        }
+      pruning->kept[ranks[i].edge] = i < allowed
+                                     && ranks[i].frequency
+                                        >= options->min_count;
+    }
+  pruning->top_edge[node_index] = ranks[top].edge;
+  pruning->kept[ranks[top].edge] = true;
+}
+
+/**
+ * number the nodes a walk reaches over the kept edges, from the start
+ * nodes, in their original order; the other nodes get FROZEN_NO_NODE.
+ */
+static void number_reached_nodes (Pruning *pruning)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  uint32_t *remap = pruning->remap;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      remap[i] = FROZEN_NO_NODE;
+    }
+
+  // remap marks the queued nodes with 0 until they are numbered.
+  uint32_t queue_size = 0;
+  for (uint32_t i = 0; i < frozen->start_count; i++)
+    {
+      uint32_t start = frozen->start_nodes[i];
+      if (remap[start] == FROZEN_NO_NODE)
+        {
+          remap[start] = 0;
+          pruning->queue[queue_size++] = start;
+        }
+    }
+  for (uint32_t head = 0; head < queue_size; head++)
+    {
+      const FrozenNode *node = &frozen->nodes[pruning->queue[head]];
+      for (uint32_t i = 0; i < node->edge_count; i++)
+        {
+          uint32_t edge = node->first_edge + i;
+          uint32_t target = frozen_edge_target (frozen, edge);
+          if (pruning->kept[edge] && remap[target] == FROZEN_NO_NODE)
+            {
+              remap[target] = 0;
+              pruning->queue[queue_size++] = target;
+            }
+        }
+    }
+
+  uint32_t reached = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (remap[i] != FROZEN_NO_NODE)
+        {
+          remap[i] = reached++;
+        }
+    }
+}
+
+/**
+ * lay out the arrays of the pruned chain, by the current remap and kept
+ * edges.
+ * @param shape filled with the counts and sizes, without the arrays
+ */
+static void measure_pruned (const Pruning *pruning, FrozenChain *shape)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  memset (shape, 0, sizeof (FrozenChain));
+  shape->quantized = pruning->quantize;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (pruning->remap[i] == FROZEN_NO_NODE)
+        {
+          continue;
+        }
+      shape->node_count++;
+      const FrozenNode *node = &frozen->nodes[i];
+      for (uint32_t j = 0; j < node->edge_count; j++)
+        {
+          shape->edge_count += pruning->kept[node->first_edge + j];
+        }
+      shape->payload_size = (shape->payload_size
+                             + FROZEN_PAYLOAD_ALIGNMENT - 1)
+                            & ~((size_t) FROZEN_PAYLOAD_ALIGNMENT - 1);
+      shape->payload_size += payload_span (frozen, i);
+    }
+  shape->start_count = frozen->start_count;
+  shape->start_sampler.size = frozen->start_sampler.size;
+  shape->node_capacity = shape->node_count + 1;
+  shape->edge_capacity = shape->edge_count + 1;
+  shape->payload_capacity = shape->payload_size + 1;
+}
+
+/**
+ * drop the least frequent edges of the reached nodes (but their top
+ * edges) until the pruned chain fits the budget, and number the reached
+ * nodes again.
+ * @return true if the pruned chain fits the budget.
+ */
+static bool fit_budget (Pruning *pruning, size_t budget_bytes)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  FrozenChain shape;
+  measure_pruned (pruning, &shape);
+  MemoryUsage usage = frozen_chain_memory_usage (&shape);
+  size_t total = memory_usage_total (&usage);
+  if (total <= budget_bytes)
+    {
+      return true;
+    }
+
+  // every edge dropped saves edge_size bytes; the nodes its drop leaves
+  // unreached save more.
+  size_t edge_size = frozen_edge_size (&shape);
+  size_t excess_edges = (total - budget_bytes + edge_size - 1) / edge_size;
+  size_t candidates = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (pruning->remap[i] == FROZEN_NO_NODE)
+        {
+          continue;
+        }
+      const FrozenNode *node = &frozen->nodes[i];
+      for (uint32_t j = 0; j < node->edge_count; j++)
+        {
+          uint32_t edge = node->first_edge + j;
+          if (pruning->kept[edge] && edge != pruning->top_edge[i])
+            {
+              pruning->ranks[candidates].frequency =
+                  edge_frequency (frozen, node, j);
+              pruning->ranks[candidates].edge = edge;
+              candidates++;
+            }
+        }
+    }
+  if (excess_edges < candidates)
+    {
+      qsort (pruning->ranks, candidates, sizeof (EdgeRank),
+             compare_ascending);
+      candidates = excess_edges;
+    }
+  for (size_t i = 0; i < candidates; i++)
+    {
+      pruning->kept[pruning->ranks[i].edge] = false;
+    }
+
+  number_reached_nodes (pruning);
+  measure_pruned (pruning, &shape);
+  usage = frozen_chain_memory_usage (&shape);
+  return memory_usage_total (&usage) <= budget_bytes;
+}
+
+/**
+ * add the divergence of one node to the report.
+ * @param divergence KL(pruned || original) of the node's successors
+ * @param seen how many times the node was seen in training
+ */
+static void report_divergence (PruneReport *report, double divergence,
+                               uint32_t seen)
+{
+  // rounding may leave an unchanged node slightly below 0.
+  if (divergence < 0)
+    {
+      divergence = 0;
+    }
+  report->compared_nodes++;
+  report->compared_transitions += seen;
+  report->mean_divergence += divergence;
+  report->weighted_divergence += divergence * seen;
+  if (divergence > report->max_divergence)
+    {
+      report->max_divergence = divergence;
+    }
+  int bucket = 0;
+  while (bucket < PRUNE_DIVERGENCE_BUCKETS - 1
+         && divergence > DIVERGENCE_BUCKET_BOUNDS[bucket])
+    {
+      bucket++;
+    }
+  report->divergence_histogram[bucket]++;
+}
+
+/**
+ * set an edge of the pruned chain, in the form of its edges.
+ */
+static void set_pruned_edge (FrozenChain *pruned, uint32_t edge,
+                             uint32_t target, uint32_t cumulative_frequency)
+{
+  if (pruned->quantized)
+    {
+      pruned->edge_targets[edge] = target;
+      pruned->edge_frequencies[edge] = (uint16_t) cumulative_frequency;
+    }
+  else
+    {
+      pruned->edges[edge].target = target;
+      pruned->edges[edge].cumulative_frequency = cumulative_frequency;
+    }
+}
+
+/**
+ * copy the kept edges of a node to the edges of pruned from first_edge
+ * on, with their weights (scaled down to PRUNE_QUANTIZED_TOTAL if pruned
+ * is quantized and they sum up to more), and report its divergence.
+ * @return the amount of edges copied.
+ */
+static uint32_t copy_node_edges (const Pruning *pruning,
+                                 uint32_t node_index, FrozenChain *pruned,
+                                 uint32_t first_edge, PruneReport *report)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  const FrozenNode *node = &frozen->nodes[node_index];
+  uint64_t kept_total = 0;
+  uint32_t kept_count = 0;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      if (pruning->kept[node->first_edge + i])
+        {
+          kept_total += edge_frequency (frozen, node, i);
+          kept_count++;
+        }
+    }
+  if (kept_count == 0)
+    {
+      return 0;
+    }
+
+  // each weight is at least 1, and rounded down from its share of
+  // PRUNE_QUANTIZED_TOTAL - kept_count, so they sum up to at most
+  // PRUNE_QUANTIZED_TOTAL.
+  bool quantize = pruned->quantized && kept_total > PRUNE_QUANTIZED_TOTAL;
+  uint64_t scale = PRUNE_QUANTIZED_TOTAL - kept_count;
+  if (quantize && report != NULL)
+    {
+      report->quantized_nodes++;
+    }
+
+  uint32_t cumulative_frequency = 0;
+  uint32_t copied = 0;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      uint32_t edge = node->first_edge + i;
+      if (!pruning->kept[edge])
+        {
+          continue;
+        }
+      uint64_t weight = edge_frequency (frozen, node, i);
+      if (quantize)
+        {
+          weight = weight * scale / kept_total;
+          weight = (weight > 0) ? weight : 1;
+        }
+      cumulative_frequency += (uint32_t) weight;
+      set_pruned_edge (pruned, first_edge + copied,
+                       pruning->remap[frozen_edge_target (frozen, edge)],
+                       cumulative_frequency);
+      copied++;
+    }
+  if (report == NULL)
+    {
+      return copied;
+    }
+
+  uint32_t total = frozen_edge_cumulative_frequency
+      (frozen, node->first_edge + node->edge_count - 1);
+  // the shares are compared edge by edge, in the original order.
+  double divergence = 0;
+  uint32_t previous = 0;
+  copied = 0;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      if (!pruning->kept[node->first_edge + i])
+        {
+          continue;
+        }
+      uint32_t pruned_cumulative = frozen_edge_cumulative_frequency
+          (pruned, first_edge + copied++);
+      double pruned_share = (double) (pruned_cumulative - previous)
+                            / cumulative_frequency;
+      double share = (double) edge_frequency (frozen, node, i) / total;
+      previous = pruned_cumulative;
+      divergence += pruned_share * log2 (pruned_share / share);
+    }
+  report_divergence (report, divergence, total);
+  return copied;
+}
+
+/**
+ * copy the start nodes, renumbered, and their alias table as it is.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool copy_start_nodes (const Pruning *pruning, FrozenChain *pruned)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  pruned->start_nodes = malloc ((frozen->start_count + 1)
+                                * sizeof (uint32_t));
+  if (pruned->start_nodes == NULL)
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < frozen->start_count; i++)
+    {
+      pruned->start_nodes[i] = pruning->remap[frozen->start_nodes[i]];
+    }
+  pruned->start_count = frozen->start_count;
+
+  uint32_t sampler_size = frozen->start_sampler.size;
+  if (sampler_size == 0)
+    {
+      return true;
+    }
+  pruned->start_sampler.size = sampler_size;
+  pruned->start_sampler.alias = malloc (sampler_size * sizeof (uint32_t));
+  pruned->start_sampler.threshold = malloc (sampler_size
+                                            * sizeof (uint32_t));
+  if (pruned->start_sampler.alias == NULL
+      || pruned->start_sampler.threshold == NULL)
+    {
+      return false;
+    }
+  memcpy (pruned->start_sampler.alias, frozen->start_sampler.alias,
+          sampler_size * sizeof (uint32_t));
+  memcpy (pruned->start_sampler.threshold, frozen->start_sampler.threshold,
+          sampler_size * sizeof (uint32_t));
+  return true;
+}
+
+/**
+ * build the pruned chain out of the current remap and kept edges.
+ * @return the pruned chain, NULL in case of allocation failure.
+ */
+static FrozenChain *build_pruned (const Pruning *pruning,
+                                  PruneReport *report)
+{
+  const FrozenChain *frozen = pruning->frozen;
+  FrozenChain *pruned = calloc (1, sizeof (FrozenChain));
+  if (pruned == NULL)
+    {
+      return NULL;
+    }
+  measure_pruned (pruning, pruned);
+  pruned->state_kind = frozen->state_kind;
+  pruned->nodes = malloc (pruned->node_capacity * sizeof (FrozenNode));
+  if (pruned->quantized)
+    {
+      pruned->edge_targets = malloc (pruned->edge_capacity
+                                     * sizeof (uint32_t));
+      pruned->edge_frequencies = malloc (pruned->edge_capacity
+                                         * sizeof (uint16_t));
+    }
+  else
+    {
+      pruned->edges = malloc (pruned->edge_capacity * sizeof (FrozenEdge));
+    }
+  pruned->payload = malloc (pruned->payload_capacity);
+  bool edges_allocated = pruned->quantized
+                         ? pruned->edge_targets != NULL
+                           && pruned->edge_frequencies != NULL
+                         : pruned->edges != NULL;
+  if (pruned->nodes == NULL || !edges_allocated
+      || pruned->payload == NULL || !copy_start_nodes (pruning, pruned))
+    {
+      frozen_chain_free (pruned);
+      return NULL;
+    }
+
+  uint32_t edge_index = 0;
+  size_t payload_offset = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      uint32_t new_index = pruning->remap[i];
+      if (new_index == FROZEN_NO_NODE)
+        {
+          continue;
+        }
+      FrozenNode *pruned_node = &pruned->nodes[new_index];
+      payload_offset = (payload_offset + FROZEN_PAYLOAD_ALIGNMENT - 1)
+                       & ~((size_t) FROZEN_PAYLOAD_ALIGNMENT - 1);
+      size_t span = payload_span (frozen, i);
+      memcpy (pruned->payload + payload_offset,
+              frozen_node_data (frozen, i), span);
+      pruned_node->payload_offset = (uint32_t) payload_offset;
+      payload_offset += span;
+
+      pruned_node->flags = frozen->nodes[i].flags;
+      pruned_node->first_edge = edge_index;
+      pruned_node->edge_count = copy_node_edges (pruning, i, pruned,
+                                                 edge_index, report);
+      edge_index += pruned_node->edge_count;
+    }
+  return pruned;
+}
+
+FrozenChain *frozen_chain_prune (const FrozenChain *frozen,
+                                 const PruneOptions *options,
+                                 PruneReport *report)
+{
+  if (frozen == NULL || options == NULL)
+    {
+      return NULL;
+    }
+
+  // each quantized weight is at least 1, so a quantized node keeps at most
+  // PRUNE_QUANTIZED_TOTAL successors.
+  PruneOptions node_options = *options;
+  if (options->quantize
+      && (options->top_k == 0 || options->top_k > PRUNE_QUANTIZED_TOTAL))
+    {
+      node_options.top_k = PRUNE_QUANTIZED_TOTAL;
+    }
+  Pruning pruning = {.quantize = options->quantize};
+  if (!init_pruning (&pruning, frozen))
+    {
+      free_pruning (&pruning);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+  size_t dead_edges = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      if (!pruning.walked[i])
+        {
+          dead_edges += frozen->nodes[i].edge_count;
+        }
+      else if (frozen->nodes[i].edge_count > 0)
+        {
+          select_node_edges (&pruning, i, &node_options);
+        }
+    }
+  number_reached_nodes (&pruning);
+  bool budget_met = options->budget_bytes == 0
+                    || fit_budget (&pruning, options->budget_bytes);
+
+  if (report != NULL)
+    {
+      memset (report, 0, sizeof (PruneReport));
+    }
+  FrozenChain *pruned = build_pruned (&pruning, report);
+  free_pruning (&pruning);
+  if (pruned == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+
+  if (report != NULL)
+    {
+      report->before = frozen_chain_memory_usage (frozen);
+      report->after = frozen_chain_memory_usage (pruned);
+      report->dead_edges = dead_edges;
+      report->dropped_edges = report->before.edges - dead_edges
+                              - report->after.edges;
+      report->budget_met = budget_met;
+      if (report->compared_nodes > 0)
+        {
+          report->mean_divergence /= report->compared_nodes;
+          report->weighted_divergence /= report->compared_transitions;
+        }
+    }
+  return pruned;
+}
+
+void prune_report_print_json (const PruneReport *report, FILE *file)
+{
+  size_t before_total = memory_usage_total (&report->before);
+  size_t after_total = memory_usage_total (&report->after);
+  fprintf (file, "{\"states_before\": %zu, \"states_after\": %zu, "
+                 "\"edges_before\": %zu, \"edges_after\": %zu, "
+                 "\"dead_edges\": %zu, \"dropped_edges\": %zu, "
+                 "\"bytes_before\": %zu, \"bytes_after\": %zu, "
+                 "\"reduction\": %.2f, \"budget_met\": %s, "
+                 "\"quantized_nodes\": %zu, ",
+           report->before.states, report->after.states,
+           report->before.edges, report->after.edges, report->dead_edges,
+           report->dropped_edges, before_total, after_total,
+           (after_total > 0) ? (double) before_total / after_total : 0,
+           report->budget_met ? "true" : "false", report->quantized_nodes);
+  fprintf (file, "\"divergence_bits\": {\"nodes\": %zu, "
+                 "\"transitions\": %zu, \"mean\": %.6f, "
+                 "\"weighted_mean\": %.6f, \"max\": %.6f, "
+                 "\"histogram\": [",
+           report->compared_nodes, report->compared_transitions,
+           report->mean_divergence, report->weighted_divergence,
+           report->max_divergence);
+  for (int i = 0; i < PRUNE_DIVERGENCE_BUCKETS; i++)
+    {
+      fprintf (file, (i > 0) ? ", %zu" : "%zu",
+               report->divergence_histogram[i]);
+    }
+  fprintf (file, "]}}\n");
+}
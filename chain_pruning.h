@@ -0,0 +1,92 @@
+#ifndef _CHAIN_PRUNING_H_
+#define _CHAIN_PRUNING_H_
+
+#include <stdio.h>   // for FILE
+#include "frozen_chain.h"
+
+// the weights of a quantized node sum up to at most this, so their
+// cumulative frequencies fit 16 bits.
+#define PRUNE_QUANTIZED_TOTAL UINT16_MAX
+
+// the per node divergences are counted by the upper bounds (in bits) of
+// PRUNE_DIVERGENCE_BUCKETS buckets: unchanged, below 0.01, 0.1 and 1, and
+// the rest.
+#define PRUNE_DIVERGENCE_BUCKETS 5
+
+/**
+ * What frozen_chain_prune drops. An option at 0 is not applied.
+ */
+typedef struct PruneOptions {
+    // edges seen less than this many times are dropped.
+    uint32_t min_count;
+
+    // every node keeps at most this many successors, the most frequent
+    // ones.
+    uint32_t top_k;
+
+    // the pruned chain takes at most this many bytes (as counted by
+    // memory_usage_total): the globally least frequent edges are dropped
+    // until it fits.
+    size_t budget_bytes;
+
+    // store the weights in 16 bits (see FrozenChain's quantized): the ones
+    // of a node are scaled down to PRUNE_QUANTIZED_TOTAL when they sum up
+    // to more, and a node keeps at most PRUNE_QUANTIZED_TOTAL successors.
+    bool quantize;
+} PruneOptions;
+
+/**
+ * How pruning changed a chain. The divergence of a node is
+ * KL(pruned || original) of its successors distribution, in bits, over
+ * the nodes a walk draws a successor from; it's the information lost at
+ * each step through the node.
+ */
+typedef struct PruneReport {
+    MemoryUsage before;
+    MemoryUsage after;
+
+    // the edges out of states that end a sequence (which a walk never
+    // follows), and the edges dropped by the options.
+    size_t dead_edges;
+    size_t dropped_edges;
+
+    // the nodes whose weights were scaled down to be quantized, and false
+    // if the budget could not be met without emptying nodes.
+    size_t quantized_nodes;
+    bool budget_met;
+
+    // the nodes compared, and how many times they were seen in training.
+    size_t compared_nodes;
+    size_t compared_transitions;
+    double mean_divergence;
+    // weighted by how many times each node was seen in training.
+    double weighted_divergence;
+    double max_divergence;
+    size_t divergence_histogram[PRUNE_DIVERGENCE_BUCKETS];
+} PruneReport;
+
+/**
+ * Build a smaller copy of a frozen chain, for serving. The edges that a
+ * walk never follows are dropped, then the edges the options drop, but a
+ * node always keeps its most frequent successor, so no walk is cut short.
+ * The remaining weights of a node keep their proportions (rounded, if
+ * quantized). The nodes no walk reaches anymore are removed, and the rest
+ * are renumbered in their order. A chain pruned with no options generates
+ * the same sequences as the original.
+ * @param frozen the frozen chain to prune
+ * @param options what to drop
+ * @param report filled with how the chain changed, may be NULL
+ * @return the pruned frozen chain, NULL in case of allocation error.
+ */
+FrozenChain *frozen_chain_prune (const FrozenChain *frozen,
+                                 const PruneOptions *options,
+                                 PruneReport *report);
+
+/**
+ * Print a prune report as a JSON object.
+ * @param report the report
+ * @param file the file to print to
+ */
+void prune_report_print_json (const PruneReport *report, FILE *file);
+
+#endif //_CHAIN_PRUNING_H_
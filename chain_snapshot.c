@@ -0,0 +1,606 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include "chain_snapshot.h"
+#include "markov_chain.h"
+
+#define ERR_MSG_SNAPSHOT_WRITE "Error: couldn't write the snapshot file.\n"
+
+#define ERR_MSG_SNAPSHOT_READ "Error: couldn't read the snapshot file.\n"
+
+#define ERR_MSG_SNAPSHOT_INVALID \
+  "Error: the file is not a valid snapshot of this version.\n"
+
+#define ERR_MSG_SNAPSHOT_BYTE_ORDER \
+  "Error: the snapshot was saved on a machine of another byte order.\n"
+
+// the header fields, by their byte offset in the header.
+typedef enum HeaderField {
+    HEADER_VERSION = SNAPSHOT_MAGIC_SIZE,
+    HEADER_NODE_COUNT = HEADER_VERSION + 4,
+    HEADER_EDGE_COUNT = HEADER_NODE_COUNT + 4,
+    HEADER_START_COUNT = HEADER_EDGE_COUNT + 4,
+    HEADER_START_SAMPLER_SIZE = HEADER_START_COUNT + 4,
+    HEADER_STATE_KIND = HEADER_START_SAMPLER_SIZE + 4,
+    HEADER_EDGE_FORMAT = HEADER_STATE_KIND + 4,
+    HEADER_PAYLOAD_BYTE_ORDER = HEADER_EDGE_FORMAT + 4,
+    HEADER_PAYLOAD_SIZE = HEADER_PAYLOAD_BYTE_ORDER + 4,
+    HEADER_SECTION_OFFSETS = HEADER_PAYLOAD_SIZE + 8
+} HeaderField;
+
+// the sections of the file, in order.
+typedef enum Section {
+    SECTION_NODES,
+    SECTION_EDGES,
+    SECTION_EDGE_TARGETS,
+    SECTION_EDGE_FREQUENCIES,
+    SECTION_PAYLOAD,
+    SECTION_START_NODES,
+    SECTION_START_ALIAS,
+    SECTION_START_THRESHOLD,
+    SECTION_COUNT
+} Section;
+
+/**
+ * where the data of each section is in a frozen chain, and its size in
+ * bytes. Every section but the payload and the edge frequencies is made of
+ * uint32_t's. Only one form of the edges has a size.
+ */
+static void get_sections (const FrozenChain *frozen,
+                          void *sections[SECTION_COUNT],
+                          uint64_t sizes[SECTION_COUNT])
+{
+  sections[SECTION_NODES] = frozen->nodes;
+  sections[SECTION_EDGES] = frozen->edges;
+  sections[SECTION_EDGE_TARGETS] = frozen->edge_targets;
+  sections[SECTION_EDGE_FREQUENCIES] = frozen->edge_frequencies;
+  sections[SECTION_PAYLOAD] = frozen->payload;
+  sections[SECTION_START_NODES] = frozen->start_nodes;
+  sections[SECTION_START_ALIAS] = frozen->start_sampler.alias;
+  sections[SECTION_START_THRESHOLD] = frozen->start_sampler.threshold;
+
+  sizes[SECTION_NODES] = (uint64_t) frozen->node_count * sizeof (FrozenNode);
+  uint64_t edge_count = frozen->edge_count;
+  sizes[SECTION_EDGES] = frozen->quantized ? 0
+                                           : edge_count * sizeof (FrozenEdge);
+  sizes[SECTION_EDGE_TARGETS] = frozen->quantized
+                                ? edge_count * sizeof (uint32_t) : 0;
+  sizes[SECTION_EDGE_FREQUENCIES] = frozen->quantized
+                                    ? edge_count * sizeof (uint16_t) : 0;
+  sizes[SECTION_PAYLOAD] = frozen->payload_size;
+  sizes[SECTION_START_NODES] = (uint64_t) frozen->start_count
+                               * sizeof (uint32_t);
+  sizes[SECTION_START_ALIAS] = (uint64_t) frozen->start_sampler.size
+                               * sizeof (uint32_t);
+  sizes[SECTION_START_THRESHOLD] = sizes[SECTION_START_ALIAS];
+}
+
+/**
+ * point the arrays of a frozen chain to its sections.
+ */
+static void set_sections (FrozenChain *frozen,
+                          void *const sections[SECTION_COUNT])
+{
+  frozen->nodes = sections[SECTION_NODES];
+  frozen->edges = sections[SECTION_EDGES];
+  frozen->edge_targets = sections[SECTION_EDGE_TARGETS];
+  frozen->edge_frequencies = sections[SECTION_EDGE_FREQUENCIES];
+  frozen->payload = sections[SECTION_PAYLOAD];
+  frozen->start_nodes = sections[SECTION_START_NODES];
+  frozen->start_sampler.alias = sections[SECTION_START_ALIAS];
+  frozen->start_sampler.threshold = sections[SECTION_START_THRESHOLD];
+}
+
+static bool is_little_endian (void)
+{
+  const uint16_t one = 1;
+  return *(const unsigned char *) &one == 1;
+}
+
+static void write_le32 (unsigned char *dest, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    {
+      dest[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static void write_le64 (unsigned char *dest, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    {
+      dest[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static SnapshotByteOrder host_byte_order (void)
+{
+  return is_little_endian () ? SNAPSHOT_LITTLE_ENDIAN : SNAPSHOT_BIG_ENDIAN;
+}
+
+static void write_le16 (unsigned char *dest, uint16_t value)
+{
+  dest[0] = (unsigned char) value;
+  dest[1] = (unsigned char) (value >> 8);
+}
+
+static uint16_t read_le16 (const unsigned char *src)
+{
+  return (uint16_t) (src[0] | (src[1] << 8));
+}
+
+static uint32_t read_le32 (const unsigned char *src)
+{
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--)
+    {
+      value = (value << 8) | src[i];
+    }
+  return value;
+}
+
+static uint64_t read_le64 (const unsigned char *src)
+{
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--)
+    {
+      value = (value << 8) | src[i];
+    }
+  return value;
+}
+
+static uint64_t align_section (uint64_t offset)
+{
+  return (offset + SNAPSHOT_SECTION_ALIGNMENT - 1)
+         & ~((uint64_t) SNAPSHOT_SECTION_ALIGNMENT - 1);
+}
+
+/**
+ * write count 32 bit words to fp in little endian order.
+ */
+static bool write_words (FILE *fp, const uint32_t *words, size_t count)
+{
+  if (is_little_endian ())
+    {
+      return fwrite (words, sizeof (uint32_t), count, fp) == count;
+    }
+  unsigned char bytes[4];
+  for (size_t i = 0; i < count; i++)
+    {
+      write_le32 (bytes, words[i]);
+      if (fwrite (bytes, 1, sizeof (bytes), fp) != sizeof (bytes))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * write count 16 bit words to fp in little endian order.
+ */
+static bool write_halves (FILE *fp, const uint16_t *halves, size_t count)
+{
+  if (is_little_endian ())
+    {
+      return fwrite (halves, sizeof (uint16_t), count, fp) == count;
+    }
+  unsigned char bytes[2];
+  for (size_t i = 0; i < count; i++)
+    {
+      write_le16 (bytes, halves[i]);
+      if (fwrite (bytes, 1, sizeof (bytes), fp) != sizeof (bytes))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * @return true for the sections a chain may lack: the form of the edges it
+ * doesn't use, and the alias table of a uniform start.
+ */
+static bool is_optional_section (int section)
+{
+  return section == SECTION_EDGES || section == SECTION_EDGE_TARGETS
+         || section == SECTION_EDGE_FREQUENCIES
+         || section >= SECTION_START_ALIAS;
+}
+
+/**
+ * write zeros to fp until its position is position.
+ */
+static bool pad_to (FILE *fp, uint64_t position)
+{
+  long current = ftell (fp);
+  if (current < 0)
+    {
+      return false;
+    }
+  for (uint64_t i = (uint64_t) current; i < position; i++)
+    {
+      if (fputc (0, fp) == EOF)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+bool snapshot_save (const FrozenChain *frozen, const char *path)
+{
+  void *sections[SECTION_COUNT];
+  uint64_t sizes[SECTION_COUNT];
+  uint64_t offsets[SECTION_COUNT];
+  get_sections (frozen, sections, sizes);
+
+  unsigned char header[SNAPSHOT_HEADER_SIZE] = {0};
+  memcpy (header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+  write_le32 (header + HEADER_VERSION, SNAPSHOT_VERSION);
+  write_le32 (header + HEADER_NODE_COUNT, frozen->node_count);
+  write_le32 (header + HEADER_EDGE_COUNT, frozen->edge_count);
+  write_le32 (header + HEADER_START_COUNT, frozen->start_count);
+  write_le32 (header + HEADER_START_SAMPLER_SIZE, frozen->start_sampler.size);
+  write_le32 (header + HEADER_STATE_KIND, frozen->state_kind);
+  write_le32 (header + HEADER_EDGE_FORMAT,
+              frozen->quantized ? SNAPSHOT_EDGES_QUANTIZED
+                                : SNAPSHOT_EDGES_FROZEN);
+  write_le32 (header + HEADER_PAYLOAD_BYTE_ORDER, host_byte_order ());
+  write_le64 (header + HEADER_PAYLOAD_SIZE, frozen->payload_size);
+  uint64_t offset = SNAPSHOT_HEADER_SIZE;
+  for (int i = 0; i < SECTION_COUNT; i++)
+    {
+      offsets[i] = offset;
+      write_le64 (header + HEADER_SECTION_OFFSETS + 8 * i, offset);
+      offset = align_section (offset + sizes[i]);
+    }
+
+  FILE *fp = fopen (path, "wb");
+  if (fp == NULL)
+    {
+      fprintf (stdout, ERR_MSG_SNAPSHOT_WRITE);
+      return false;
+    }
+  bool written = fwrite (header, 1, sizeof (header), fp) == sizeof (header);
+  for (int i = 0; i < SECTION_COUNT && written; i++)
+    {
+      written = pad_to (fp, offsets[i]);
+      if (!written || sizes[i] == 0)
+        {
+          continue;
+        }
+      if (i == SECTION_PAYLOAD)
+        {
+          written = fwrite (sections[i], 1, sizes[i], fp) == sizes[i];
+        }
+      else if (i == SECTION_EDGE_FREQUENCIES)
+        {
+          written = write_halves (fp, sections[i],
+                                  sizes[i] / sizeof (uint16_t));
+        }
+      else
+        {
+          written = write_words (fp, sections[i], sizes[i] / sizeof (uint32_t));
+        }
+    }
+  if (fclose (fp) != 0 || !written)
+    {
+      fprintf (stdout, ERR_MSG_SNAPSHOT_WRITE);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * check the header of a snapshot of file_size bytes, and fill the counts
+ * of frozen and the offsets of the sections from it.
+ * @return true if the header is valid.
+ */
+static bool parse_header (const unsigned char *header, uint64_t file_size,
+                          FrozenChain *frozen,
+                          uint64_t offsets[SECTION_COUNT])
+{
+  if (file_size < SNAPSHOT_HEADER_SIZE
+      || memcmp (header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0
+      || read_le32 (header + HEADER_VERSION) != SNAPSHOT_VERSION)
+    {
+      return false;
+    }
+  frozen->node_count = read_le32 (header + HEADER_NODE_COUNT);
+  frozen->edge_count = read_le32 (header + HEADER_EDGE_COUNT);
+  frozen->start_count = read_le32 (header + HEADER_START_COUNT);
+  frozen->start_sampler.size = read_le32 (header
+                                          + HEADER_START_SAMPLER_SIZE);
+  frozen->state_kind = read_le32 (header + HEADER_STATE_KIND);
+  uint32_t edge_format = read_le32 (header + HEADER_EDGE_FORMAT);
+  if (edge_format != SNAPSHOT_EDGES_FROZEN
+      && edge_format != SNAPSHOT_EDGES_QUANTIZED)
+    {
+      return false;
+    }
+  frozen->quantized = edge_format == SNAPSHOT_EDGES_QUANTIZED;
+  frozen->payload_size = read_le64 (header + HEADER_PAYLOAD_SIZE);
+  if (frozen->start_sampler.size != 0
+      && frozen->start_sampler.size != frozen->start_count)
+    {
+      return false;
+    }
+
+  void *sections[SECTION_COUNT];
+  uint64_t sizes[SECTION_COUNT];
+  get_sections (frozen, sections, sizes);
+  for (int i = 0; i < SECTION_COUNT; i++)
+    {
+      offsets[i] = read_le64 (header + HEADER_SECTION_OFFSETS + 8 * i);
+      if (offsets[i] % SNAPSHOT_SECTION_ALIGNMENT != 0
+          || offsets[i] < SNAPSHOT_HEADER_SIZE || offsets[i] > file_size
+          || sizes[i] > file_size - offsets[i])
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * read the section of count 32 bit little endian words at offset into a
+ * new array (used on big endian machines).
+ */
+static uint32_t *read_words (const unsigned char *file, uint64_t offset,
+                             size_t count)
+{
+  uint32_t *words = malloc ((count + 1) * sizeof (uint32_t));
+  if (words == NULL)
+    {
+      return NULL;
+    }
+  for (size_t i = 0; i < count; i++)
+    {
+      words[i] = read_le32 (file + offset + i * sizeof (uint32_t));
+    }
+  return words;
+}
+
+/**
+ * read the section of count 16 bit little endian words at offset into a
+ * new array (used on big endian machines).
+ */
+static uint16_t *read_halves (const unsigned char *file, uint64_t offset,
+                              size_t count)
+{
+  uint16_t *halves = malloc ((count + 1) * sizeof (uint16_t));
+  if (halves == NULL)
+    {
+      return NULL;
+    }
+  for (size_t i = 0; i < count; i++)
+    {
+      halves[i] = read_le16 (file + offset + i * sizeof (uint16_t));
+    }
+  return halves;
+}
+
+/**
+ * fill the arrays of frozen with converted copies of the sections.
+ */
+static bool copy_sections (FrozenChain *frozen, const unsigned char *file,
+                           const uint64_t offsets[SECTION_COUNT])
+{
+  void *sections[SECTION_COUNT];
+  uint64_t sizes[SECTION_COUNT];
+  get_sections (frozen, sections, sizes);
+
+  bool copied = true;
+  for (int i = 0; i < SECTION_COUNT; i++)
+    {
+      if (i == SECTION_PAYLOAD)
+        {
+          sections[i] = malloc (sizes[i] + 1);
+          if (sections[i] != NULL)
+            {
+              memcpy (sections[i], file + offsets[i], sizes[i]);
+            }
+        }
+      else if (sizes[i] == 0 && is_optional_section (i))
+        {
+          sections[i] = NULL;
+          continue;
+        }
+      else if (i == SECTION_EDGE_FREQUENCIES)
+        {
+          sections[i] = read_halves (file, offsets[i],
+                                     sizes[i] / sizeof (uint16_t));
+        }
+      else
+        {
+          sections[i] = read_words (file, offsets[i],
+                                    sizes[i] / sizeof (uint32_t));
+        }
+      copied = copied && sections[i] != NULL;
+    }
+  set_sections (frozen, sections);
+  return copied;
+}
+
+/**
+ * check that the edges of a node are in range, lead to nodes of the chain,
+ * and have cumulative frequencies that increase from above 0 (every edge
+ * was seen, and a walk draws below the last one).
+ * @return true if the edges are consistent.
+ */
+static bool node_edges_consistent (const FrozenChain *frozen,
+                                   const FrozenNode *node)
+{
+  if ((uint64_t) node->first_edge + node->edge_count > frozen->edge_count)
+    {
+      return false;
+    }
+  uint32_t previous_frequency = 0;
+  for (uint32_t i = 0; i < node->edge_count; i++)
+    {
+      uint32_t edge = node->first_edge + i;
+      uint32_t frequency = frozen_edge_cumulative_frequency (frozen, edge);
+      if (frozen_edge_target (frozen, edge) >= frozen->node_count
+          || frequency <= previous_frequency)
+        {
+          return false;
+        }
+      previous_frequency = frequency;
+    }
+  return true;
+}
+
+/**
+ * check the states of a chain whose payload offsets are consistent, each in
+ * the span of the payload from its offset to the next state's.
+ * @return true if check_func accepts every state.
+ */
+static bool states_consistent (const FrozenChain *frozen,
+                               check_func_t check_func)
+{
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      size_t offset = frozen->nodes[i].payload_offset;
+      size_t end = i + 1 < frozen->node_count
+                   ? frozen->nodes[i + 1].payload_offset
+                   : frozen->payload_size;
+      if (!check_func (frozen->payload + offset, end - offset,
+                       frozen->state_kind))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * check every index and offset of a loaded chain: the edges of the nodes,
+ * their payload offsets (aligned, and in node order, as they are packed),
+ * the states (when check_func is given), the start nodes and the alias
+ * table of the start.
+ * @return true if the chain is consistent.
+ */
+static bool chain_consistent (const FrozenChain *frozen,
+                              check_func_t check_func)
+{
+  uint32_t previous_offset = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const FrozenNode *node = &frozen->nodes[i];
+      if (node->payload_offset < previous_offset
+          || node->payload_offset > frozen->payload_size
+          || node->payload_offset % FROZEN_PAYLOAD_ALIGNMENT != 0
+          || !node_edges_consistent (frozen, node))
+        {
+          return false;
+        }
+      previous_offset = node->payload_offset;
+    }
+  if (check_func != NULL && !states_consistent (frozen, check_func))
+    {
+      return false;
+    }
+  for (uint32_t i = 0; i < frozen->start_count; i++)
+    {
+      if (frozen->start_nodes[i] >= frozen->node_count)
+        {
+          return false;
+        }
+    }
+  const AliasTable *sampler = &frozen->start_sampler;
+  for (uint32_t i = 0; i < sampler->size; i++)
+    {
+      if (sampler->alias[i] >= sampler->size
+          || sampler->threshold[i] > ALIAS_PROBABILITY_SCALE)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+FrozenChain *snapshot_load (const char *path, check_func_t check_func)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stdout, ERR_MSG_SNAPSHOT_READ);
+      return NULL;
+    }
+  struct stat file_stat;
+  if (fstat (fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+      close (fd);
+      fprintf (stdout, ERR_MSG_SNAPSHOT_INVALID);
+      return NULL;
+    }
+  size_t file_size = (size_t) file_stat.st_size;
+  unsigned char *file = mmap (NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (file == MAP_FAILED)
+    {
+      fprintf (stdout, ERR_MSG_SNAPSHOT_READ);
+      return NULL;
+    }
+
+  FrozenChain *frozen = calloc (1, sizeof (FrozenChain));
+  uint64_t offsets[SECTION_COUNT];
+  if (frozen == NULL)
+    {
+      munmap (file, file_size);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+  if (!parse_header (file, file_size, frozen, offsets))
+    {
+      munmap (file, file_size);
+      free (frozen);
+      fprintf (stdout, ERR_MSG_SNAPSHOT_INVALID);
+      return NULL;
+    }
+  if (read_le32 (file + HEADER_PAYLOAD_BYTE_ORDER) != host_byte_order ())
+    {
+      munmap (file, file_size);
+      free (frozen);
+      fprintf (stdout, ERR_MSG_SNAPSHOT_BYTE_ORDER);
+      return NULL;
+    }
+
+  if (!is_little_endian ())
+    {
+      bool copied = copy_sections (frozen, file, offsets);
+      munmap (file, file_size);
+      if (!copied)
+        {
+          frozen_chain_free (frozen);
+          fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+          return NULL;
+        }
+    }
+  else
+    {
+      void *sections[SECTION_COUNT];
+      uint64_t sizes[SECTION_COUNT];
+      get_sections (frozen, sections, sizes);
+      for (int i = 0; i < SECTION_COUNT; i++)
+        {
+          sections[i] = (sizes[i] == 0 && is_optional_section (i))
+                        ? NULL : file + offsets[i];
+        }
+      frozen->mapping = file;
+      frozen->mapping_size = file_size;
+      set_sections (frozen, sections);
+    }
+
+  if (!chain_consistent (frozen, check_func))
+    {
+      frozen_chain_free (frozen);
+      fprintf (stdout, ERR_MSG_SNAPSHOT_INVALID);
+      return NULL;
+    }
+  return frozen;
+}
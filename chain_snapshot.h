@@ -0,0 +1,81 @@
+#ifndef _CHAIN_SNAPSHOT_H_
+#define _CHAIN_SNAPSHOT_H_
+
+#include "frozen_chain.h"
+
+/*
+ * Snapshot file format, version 3. All the integers are little endian but
+ * the ones inside the states, and every section starts at an offset aligned
+ * to SNAPSHOT_SECTION_ALIGNMENT:
+ *
+ *   header   SNAPSHOT_HEADER_SIZE bytes:
+ *              char[8] magic, u32 version, u32 node_count, u32 edge_count,
+ *              u32 start_count, u32 start_sampler_size (0 or start_count),
+ *              u32 state_kind (see MarkovChain), u32 edge_format (one of
+ *              SnapshotEdgeFormat), u32 payload_byte_order (one of
+ *              SnapshotByteOrder), u64 payload_size, then the u64 offsets
+ *              of the sections below in order, then zeros
+ *   nodes            node_count FrozenNode's (4 x u32 each)
+ *   edges            edge_count FrozenEdge's (2 x u32 each), or nothing
+ *                    when the edges are quantized
+ *   edge targets     edge_count u32's when the edges are quantized (see
+ *   edge frequencies edge_count u16's  FrozenChain), nothing otherwise
+ *   payload          payload_size bytes, the packed states, stored as is:
+ *                    in the byte order of the machine that saved them
+ *   start nodes      start_count u32's
+ *   start alias      start_sampler_size u32's
+ *   start threshold  start_sampler_size u32's
+ *
+ * Older versions are not supported.
+ *
+ * All references are indexes or offsets, so a snapshot can be mapped
+ * read-only at any address, and shared by several processes. The loader
+ * checks every one of them, and the states with the check_func of their
+ * kind, which alone knows their layout (see MarkovChain's state_kind). A
+ * state may hold integers (a board cell, the token ids of an n-gram), which
+ * can't be converted without knowing its layout, so a snapshot is only
+ * loaded on a machine of the byte order its states were saved in.
+ */
+
+#define SNAPSHOT_MAGIC "MKVCHAIN"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_HEADER_SIZE 128
+#define SNAPSHOT_SECTION_ALIGNMENT 64
+
+// the byte order of the states of a snapshot.
+typedef enum SnapshotByteOrder {
+    SNAPSHOT_LITTLE_ENDIAN,
+    SNAPSHOT_BIG_ENDIAN
+} SnapshotByteOrder;
+
+// the form of the edges of a snapshot.
+typedef enum SnapshotEdgeFormat {
+    SNAPSHOT_EDGES_FROZEN,
+    SNAPSHOT_EDGES_QUANTIZED
+} SnapshotEdgeFormat;
+
+/**
+ * Write a frozen chain to a snapshot file.
+ * @param frozen the frozen chain to save
+ * @param path path of the file to create (or overwrite)
+ * @return true on success, false otherwise.
+ */
+bool snapshot_save (const FrozenChain *frozen, const char *path);
+
+/**
+ * Load a snapshot file. On little endian machines the file is mapped with
+ * a single mmap and the frozen chain points into the mapping (no
+ * per-node allocation); otherwise it is read and converted. Every index
+ * and offset of the chain is checked once, so walking it never reads out
+ * of its arrays, and so is every state when check_func is given.
+ * @param path path of the snapshot file
+ * @param check_func checks the flat form of each state in the span of the
+ * payload up to the next state, may be NULL
+ * @return the loaded frozen chain (free it with frozen_chain_free), NULL
+ * if the file is missing, not a valid snapshot, or of states saved in
+ * another byte order.
+ */
+FrozenChain *snapshot_load (const char *path, check_func_t check_func);
+
+#endif //_CHAIN_SNAPSHOT_H_
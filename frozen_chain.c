@@ -0,0 +1,691 @@
+#include <string.h>
+#include <sys/mman.h>
+#include "frozen_chain.h"
+#include "markov_chain.h"
+
+#define ERR_MSG_FREEZE_NO_SIZE_FUNC \
+  "Error: the chain can't be frozen without a size_func.\n"
+
+#define ERR_MSG_FREEZE_TOO_BIG \
+  "Error: the chain is too big to be frozen.\n"
+
+#define ERR_MSG_FROZEN_MAPPED \
+  "Error: a chain loaded from a snapshot can't be trained.\n"
+
+#define ERR_MSG_FROZEN_QUANTIZED \
+  "Error: a quantized chain can't be trained.\n"
+
+// walks up to this long are kept on the stack by generate_frozen_tweet.
+#define LOCAL_PATH_LENGTH 256
+
+static size_t align_payload_offset (size_t offset)
+{
+  return (offset + FROZEN_PAYLOAD_ALIGNMENT - 1)
+         & ~((size_t) FROZEN_PAYLOAD_ALIGNMENT - 1);
+}
+
+/**
+ * @return the size of the state in the payload: its flat form's if the
+ * chain has one, the state's own otherwise.
+ */
+static size_t payload_state_size (const MarkovChain *markov_chain,
+                                  const void *data)
+{
+  return (markov_chain->pack_func != NULL)
+         ? markov_chain->flat_size_func (data)
+         : markov_chain->size_func (data);
+}
+
+/**
+ * count the edges and the payload bytes the frozen form of markov_chain
+ * needs.
+ * @return true if everything fits the 32 bit fields of the frozen chain.
+ */
+static bool measure_chain (const MarkovChain *markov_chain,
+                           size_t *edge_count, size_t *payload_size)
+{
+  *edge_count = 0;
+  *payload_size = 0;
+  for (Node *node = markov_chain->database->first; node != NULL;
+       node = node->next)
+    {
+      *payload_size = align_payload_offset (*payload_size);
+      if (*payload_size > UINT32_MAX)
+        {
+          return false;
+        }
+      *payload_size += payload_state_size (markov_chain, node->data->data);
+      *edge_count += node->data->frequencies_list_size;
+    }
+  return *edge_count < UINT32_MAX
+         && (size_t) markov_chain->database->size < UINT32_MAX;
+}
+
+/**
+ * copy the start table of the chain, by node indexes. The start states the
+ * frozen chain already has are kept, since the chain's start table only
+ * grows once it was built.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool copy_start_table (FrozenChain *frozen,
+                              const MarkovChain *markov_chain)
+{
+  uint32_t start_count = (uint32_t) markov_chain->start_nodes_size;
+  uint32_t *start_nodes = realloc (frozen->start_nodes, (start_count + 1)
+                                                        * sizeof (uint32_t));
+  if (start_nodes == NULL)
+    {
+      return false;
+    }
+  frozen->start_nodes = start_nodes;
+  uint32_t first = (frozen->start_count <= start_count)
+                   ? frozen->start_count : 0;
+  for (uint32_t i = first; i < start_count; i++)
+    {
+      frozen->start_nodes[i] = (uint32_t) markov_chain->start_nodes[i]->index;
+    }
+  frozen->start_count = start_count;
+
+  alias_table_free (&frozen->start_sampler);
+  const AliasTable *start_sampler = &markov_chain->start_sampler;
+  if (start_sampler->size == 0)
+    {
+      return true;
+    }
+  frozen->start_sampler.size = start_sampler->size;
+  frozen->start_sampler.alias = malloc (start_sampler->size
+                                        * sizeof (uint32_t));
+  frozen->start_sampler.threshold = malloc (start_sampler->size
+                                            * sizeof (uint32_t));
+  if (frozen->start_sampler.alias == NULL
+      || frozen->start_sampler.threshold == NULL)
+    {
+      return false;
+    }
+  memcpy (frozen->start_sampler.alias, start_sampler->alias,
+          start_sampler->size * sizeof (uint32_t));
+  memcpy (frozen->start_sampler.threshold, start_sampler->threshold,
+          start_sampler->size * sizeof (uint32_t));
+  return true;
+}
+
+/**
+ * copy the state of a node to the payload at the given offset (rounded
+ * up to FROZEN_PAYLOAD_ALIGNMENT), and set its flags. The padding before
+ * the state is zeroed, so the payload (and a snapshot of it) depends on
+ * the states only.
+ * @return the offset right after the state.
+ */
+static size_t pack_state (FrozenChain *frozen,
+                          const MarkovChain *markov_chain,
+                          const MarkovNode *markov_node,
+                          size_t payload_offset)
+{
+  FrozenNode *frozen_node = &frozen->nodes[markov_node->index];
+  size_t state_offset = align_payload_offset (payload_offset);
+  memset (frozen->payload + payload_offset, 0,
+          state_offset - payload_offset);
+  payload_offset = state_offset;
+  size_t data_size = payload_state_size (markov_chain, markov_node->data);
+  if (markov_chain->pack_func != NULL)
+    {
+      markov_chain->pack_func (markov_node->data,
+                               frozen->payload + payload_offset);
+    }
+  else
+    {
+      memcpy (frozen->payload + payload_offset, markov_node->data,
+              data_size);
+    }
+  frozen_node->payload_offset = (uint32_t) payload_offset;
+
+  frozen_node->flags = 0;
+  if (markov_chain->is_last (markov_node->data))
+    {
+      frozen_node->flags |= FROZEN_NODE_CONTINUES;
+    }
+  return payload_offset + data_size;
+}
+
+/**
+ * copy the out-edges of a node to edges[first_edge ..], with their
+ * cumulative frequencies.
+ */
+static void pack_edges (FrozenChain *frozen, const MarkovNode *markov_node,
+                        uint32_t first_edge)
+{
+  FrozenNode *frozen_node = &frozen->nodes[markov_node->index];
+  frozen_node->first_edge = first_edge;
+  frozen_node->edge_count = markov_node->frequencies_list_size;
+  uint32_t sigma_frequencies = 0;
+  for (int i = 0; i < markov_node->frequencies_list_size; i++)
+    {
+      sigma_frequencies += markov_node->frequencies_list[i].frequency;
+      frozen->edges[first_edge + i].target =
+          (uint32_t) markov_node->frequencies_list[i].markov_node->index;
+      frozen->edges[first_edge + i].cumulative_frequency = sigma_frequencies;
+    }
+}
+
+FrozenChain *frozen_chain_build (const MarkovChain *markov_chain)
+{
+  if (markov_chain == NULL)
+    {
+      return NULL;
+    }
+  if (markov_chain->size_func == NULL)
+    {
+      fprintf (stdout, ERR_MSG_FREEZE_NO_SIZE_FUNC);
+      return NULL;
+    }
+
+  size_t edge_count, payload_size;
+  if (!measure_chain (markov_chain, &edge_count, &payload_size))
+    {
+      fprintf (stdout, ERR_MSG_FREEZE_TOO_BIG);
+      return NULL;
+    }
+
+  FrozenChain *frozen = calloc (1, sizeof (FrozenChain));
+  if (frozen == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+  frozen->node_count = (uint32_t) markov_chain->database->size;
+  frozen->edge_count = (uint32_t) edge_count;
+  frozen->payload_size = payload_size;
+  frozen->state_kind = markov_chain->state_kind;
+  // allocate at least one element, so an empty chain is not mistaken for an
+  // allocation failure.
+  frozen->nodes = malloc ((frozen->node_count + 1) * sizeof (FrozenNode));
+  frozen->edges = malloc ((edge_count + 1) * sizeof (FrozenEdge));
+  frozen->payload = malloc (payload_size + 1);
+  frozen->node_capacity = frozen->node_count + 1;
+  frozen->edge_capacity = frozen->edge_count + 1;
+  frozen->payload_capacity = payload_size + 1;
+  if (frozen->nodes == NULL || frozen->edges == NULL
+      || frozen->payload == NULL)
+    {
+      frozen_chain_free (frozen);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+
+  if (!copy_start_table (frozen, markov_chain))
+    {
+      frozen_chain_free (frozen);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+
+  uint32_t edge_index = 0;
+  size_t payload_offset = 0;
+  for (Node *node = markov_chain->database->first; node != NULL;
+       node = node->next)
+    {
+      payload_offset = pack_state (frozen, markov_chain, node->data,
+                                   payload_offset);
+      pack_edges (frozen, node->data, edge_index);
+      edge_index += node->data->frequencies_list_size;
+    }
+  return frozen;
+}
+
+/**
+ * make room for capacity elements of the given size in an array, doubling
+ * its capacity.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool reserve_array (void **array, size_t *array_capacity,
+                           size_t capacity, size_t element_size)
+{
+  if (capacity <= *array_capacity)
+    {
+      return true;
+    }
+  size_t new_capacity = *array_capacity ? *array_capacity : 1;
+  while (new_capacity < capacity)
+    {
+      new_capacity *= 2;
+    }
+  void *new_array = realloc (*array, new_capacity * element_size);
+  if (new_array == NULL)
+    {
+      return false;
+    }
+  *array = new_array;
+  *array_capacity = new_capacity;
+  return true;
+}
+
+/**
+ * give a changed node of the chain its new out-edges. A node that gained
+ * successors is moved to the end of the edges, unless it's already there.
+ * @return true on success, false in case of allocation failure or if the
+ * edges don't fit 32 bit indexes.
+ */
+static bool update_edges (FrozenChain *frozen, const MarkovNode *markov_node)
+{
+  FrozenNode *frozen_node = &frozen->nodes[markov_node->index];
+  uint32_t edge_count = (uint32_t) markov_node->frequencies_list_size;
+  uint32_t first_edge = frozen_node->first_edge;
+  if (edge_count != frozen_node->edge_count)
+    {
+      if (first_edge + frozen_node->edge_count != frozen->edge_count)
+        {
+          frozen->stale_edges += frozen_node->edge_count;
+          first_edge = frozen->edge_count;
+        }
+      size_t end = (size_t) first_edge + edge_count;
+      size_t edge_capacity = frozen->edge_capacity;
+      if (end >= UINT32_MAX
+          || !reserve_array ((void **) &frozen->edges, &edge_capacity, end,
+                             sizeof (FrozenEdge)))
+        {
+          return false;
+        }
+      frozen->edge_capacity = (uint32_t) edge_capacity;
+      frozen->edge_count = (uint32_t) end;
+    }
+  pack_edges (frozen, markov_node, first_edge);
+  return true;
+}
+
+/**
+ * drop the stale edges, keeping the edges of every node in node order.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool compact_edges (FrozenChain *frozen)
+{
+  uint32_t edge_count = frozen->edge_count - frozen->stale_edges;
+  FrozenEdge *edges = malloc ((edge_count + 1) * sizeof (FrozenEdge));
+  if (edges == NULL)
+    {
+      return false;
+    }
+  uint32_t edge_index = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      FrozenNode *frozen_node = &frozen->nodes[i];
+      memcpy (edges + edge_index, frozen->edges + frozen_node->first_edge,
+              frozen_node->edge_count * sizeof (FrozenEdge));
+      frozen_node->first_edge = edge_index;
+      edge_index += frozen_node->edge_count;
+    }
+  free (frozen->edges);
+  frozen->edges = edges;
+  frozen->edge_count = edge_count;
+  frozen->edge_capacity = edge_count + 1;
+  frozen->stale_edges = 0;
+  return true;
+}
+
+/**
+ * make room for the states of the nodes added to the chain since the last
+ * update, and pack them.
+ * @return true on success, false in case of allocation failure or if the
+ * chain doesn't fit 32 bit indexes.
+ */
+static bool append_new_states (FrozenChain *frozen,
+                               const MarkovChain *markov_chain)
+{
+  uint32_t node_count = frozen->node_count;
+  size_t payload_size = frozen->payload_size;
+  for (const MarkovNode *markov_node = markov_chain->changed_first;
+       markov_node != NULL; markov_node = markov_node->next_changed)
+    {
+      if ((uint32_t) markov_node->index >= frozen->node_count)
+        {
+          payload_size = align_payload_offset (payload_size)
+                         + payload_state_size (markov_chain,
+                                               markov_node->data);
+        }
+    }
+  size_t node_capacity = frozen->node_capacity;
+  if ((size_t) markov_chain->database->size >= UINT32_MAX
+      || payload_size > UINT32_MAX
+      || !reserve_array ((void **) &frozen->nodes, &node_capacity,
+                         markov_chain->database->size + 1,
+                         sizeof (FrozenNode))
+      || !reserve_array ((void **) &frozen->payload,
+                         &frozen->payload_capacity, payload_size + 1, 1))
+    {
+      return false;
+    }
+  frozen->node_capacity = (uint32_t) node_capacity;
+
+  for (const MarkovNode *markov_node = markov_chain->changed_first;
+       markov_node != NULL; markov_node = markov_node->next_changed)
+    {
+      if ((uint32_t) markov_node->index >= node_count)
+        {
+          frozen->payload_size = pack_state (frozen, markov_chain,
+                                             markov_node,
+                                             frozen->payload_size);
+          // the edges of a new node start empty, at the end of the edges.
+          frozen->nodes[markov_node->index].first_edge = frozen->edge_count;
+          frozen->nodes[markov_node->index].edge_count = 0;
+        }
+    }
+  frozen->node_count = (uint32_t) markov_chain->database->size;
+  return true;
+}
+
+bool frozen_chain_update (FrozenChain *frozen,
+                          const MarkovChain *markov_chain)
+{
+  if (frozen->mapping != NULL)
+    {
+      fprintf (stdout, ERR_MSG_FROZEN_MAPPED);
+      return false;
+    }
+  if (frozen->quantized)
+    {
+      fprintf (stdout, ERR_MSG_FROZEN_QUANTIZED);
+      return false;
+    }
+  if (markov_chain->compacted
+      || (uint32_t) markov_chain->database->size < frozen->node_count)
+    {
+      // the nodes the frozen chain was built from were released.
+      fprintf (stdout, ERR_MSG_FROZEN_COMPACTED);
+      return false;
+    }
+  if (!append_new_states (frozen, markov_chain))
+    {
+      fprintf (stdout, ERR_MSG_FREEZE_TOO_BIG);
+      return false;
+    }
+  for (const MarkovNode *markov_node = markov_chain->changed_first;
+       markov_node != NULL; markov_node = markov_node->next_changed)
+    {
+      if (!update_edges (frozen, markov_node))
+        {
+          fprintf (stdout, ERR_MSG_FREEZE_TOO_BIG);
+          return false;
+        }
+    }
+  if (frozen->stale_edges > frozen->edge_count / 2
+      && !compact_edges (frozen))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  if (!copy_start_table (frozen, markov_chain))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * shrink a heap array to the given amount of elements (at least one, as
+ * frozen_chain_build allocates).
+ * @return true on success, false in case of allocation failure.
+ */
+static bool shrink_array (void **array, size_t capacity, size_t element_size)
+{
+  void *new_array = realloc (*array, (capacity + 1) * element_size);
+  if (new_array == NULL)
+    {
+      return false;
+    }
+  *array = new_array;
+  return true;
+}
+
+bool frozen_chain_trim (FrozenChain *frozen)
+{
+  if (frozen->mapping != NULL || frozen->quantized)
+    {
+      return true;
+    }
+  if (frozen->stale_edges > 0 && !compact_edges (frozen))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  if (!shrink_array ((void **) &frozen->nodes, frozen->node_count,
+                     sizeof (FrozenNode))
+      || !shrink_array ((void **) &frozen->edges, frozen->edge_count,
+                        sizeof (FrozenEdge))
+      || !shrink_array ((void **) &frozen->payload, frozen->payload_size, 1))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  frozen->node_capacity = frozen->node_count + 1;
+  frozen->edge_capacity = frozen->edge_count + 1;
+  frozen->payload_capacity = frozen->payload_size + 1;
+  return true;
+}
+
+MemoryUsage frozen_chain_memory_usage (const FrozenChain *frozen)
+{
+  MemoryUsage usage = {0};
+  if (frozen == NULL)
+    {
+      return usage;
+    }
+  usage.states = frozen->node_count;
+  usage.edges = frozen->edge_count - frozen->stale_edges;
+  usage.node_bytes = frozen->node_count * sizeof (FrozenNode);
+  usage.edge_bytes = usage.edges * frozen_edge_size (frozen);
+  usage.state_bytes = frozen->payload_size;
+  usage.index_bytes = frozen->start_count * sizeof (uint32_t)
+                      + 2 * frozen->start_sampler.size * sizeof (uint32_t);
+  if (frozen->mapping != NULL)
+    {
+      return usage;
+    }
+  usage.index_bytes += sizeof (FrozenChain);
+  usage.unused_bytes = (frozen->node_capacity - frozen->node_count)
+                       * sizeof (FrozenNode)
+                       + (frozen->edge_capacity - usage.edges)
+                         * frozen_edge_size (frozen)
+                       + (frozen->payload_capacity - frozen->payload_size);
+  // the chain, its nodes, edges (two arrays if quantized), payload and
+  // start nodes, and the alias and threshold arrays of a weighted start.
+  usage.allocations = 5 + (frozen->quantized ? 1 : 0)
+                      + ((frozen->start_sampler.size != 0) ? 2 : 0);
+  return usage;
+}
+
+void frozen_chain_free (FrozenChain *frozen)
+{
+  if (frozen == NULL)
+    {
+      return;
+    }
+  if (frozen->mapping != NULL)
+    {
+      munmap (frozen->mapping, frozen->mapping_size);
+    }
+  else
+    {
+      free (frozen->nodes);
+      free (frozen->edges);
+      free (frozen->edge_targets);
+      free (frozen->edge_frequencies);
+      free (frozen->payload);
+      free (frozen->start_nodes);
+      alias_table_free (&frozen->start_sampler);
+    }
+  free (frozen);
+}
+
+uint32_t frozen_first_random_node (const FrozenChain *frozen,
+                                   RandomStream *stream)
+{
+  if (frozen->start_count == 0)
+    {
+      return FROZEN_NO_NODE;
+    }
+  if (frozen->start_sampler.size != 0)
+    {
+      return frozen->start_nodes[alias_table_sample (&frozen->start_sampler,
+                                                     stream)];
+    }
+  return frozen->start_nodes[random_stream_below (stream,
+                                                  frozen->start_count)];
+}
+
+/**
+ * the binary search of frozen_next_random_node, over the 16 bit cumulative
+ * frequencies of a quantized node.
+ * @return the index of the first of frequencies[0 .. last] bigger than
+ * desired_index.
+ */
+static uint32_t search_cumulative (const uint16_t *frequencies,
+                                   uint32_t last, uint32_t desired_index)
+{
+  uint32_t low = 0;
+  uint32_t high = last;
+  while (low < high)
+    {
+      uint32_t middle = low + (high - low) / 2;
+      if (frequencies[middle] > desired_index)
+        {
+          high = middle;
+        }
+      else
+        {
+          low = middle + 1;
+        }
+    }
+  return low;
+}
+
+uint32_t frozen_next_random_node (const FrozenChain *frozen,
+                                  uint32_t node_index, RandomStream *stream)
+{
+  const FrozenNode *frozen_node = &frozen->nodes[node_index];
+  if (frozen_node->edge_count == 0)
+    {
+      return FROZEN_NO_NODE;
+    }
+
+  uint32_t first_edge = frozen_node->first_edge;
+  uint32_t last = frozen_node->edge_count - 1;
+  if (frozen->quantized)
+    {
+      const uint16_t *frequencies = frozen->edge_frequencies + first_edge;
+      uint32_t desired_index = random_stream_below (stream,
+                                                    frequencies[last]);
+      return frozen->edge_targets[first_edge
+                                  + search_cumulative (frequencies, last,
+                                                       desired_index)];
+    }
+
+  const FrozenEdge *edges = frozen->edges + first_edge;
+  uint32_t desired_index = random_stream_below
+      (stream, edges[last].cumulative_frequency);
+  // binary search for the first edge whose cumulative frequency is bigger
+  // than desired_index.
+  uint32_t low = 0;
+  uint32_t high = last;
+  while (low < high)
+    {
+      uint32_t middle = low + (high - low) / 2;
+      if (edges[middle].cumulative_frequency > desired_index)
+        {
+          high = middle;
+        }
+      else
+        {
+          low = middle + 1;
+        }
+    }
+  return edges[low].target;
+}
+
+int frozen_walk (const FrozenChain *frozen, uint32_t first_node,
+                 int max_length, RandomStream *stream, uint32_t *path)
+{
+  MARKOV_STATS_PHASE (MARKOV_PHASE_SAMPLE);
+  if (first_node == FROZEN_NO_NODE)
+    {
+      first_node = frozen_first_random_node (frozen, stream);
+      if (first_node == FROZEN_NO_NODE)
+        {
+          MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+          return 0;
+        }
+    }
+  uint32_t cur_node = first_node;
+  int length = 0;
+
+  while (length + 1 < max_length)
+    {
+      path[length++] = cur_node;
+      uint32_t next_node = frozen_next_random_node (frozen, cur_node,
+                                                   stream);
+      if (next_node == FROZEN_NO_NODE)
+        {
+          // a state without successors ends the sequence.
+          path[length++] = FROZEN_NO_NODE;
+          MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+          return length;
+        }
+      cur_node = next_node;
+      if (!(frozen->nodes[cur_node].flags & FROZEN_NODE_CONTINUES))
+        {
+          break;
+        }
+    }
+  path[length++] = cur_node;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  return length;
+}
+
+void append_frozen_walk (const MarkovChain *markov_chain,
+                         const FrozenChain *frozen, const uint32_t *path,
+                         int length, OutputBuffer *buffer)
+{
+  MARKOV_STATS_PHASE (MARKOV_PHASE_PRINT);
+  for (int i = 0; i < length - 1; i++)
+    {
+      append_state_to_buffer (markov_chain, frozen_node_data (frozen,
+                                                              path[i]),
+                              buffer);
+      output_buffer_append_char (buffer, ' ');
+    }
+  if (path[length - 1] != FROZEN_NO_NODE)
+    {
+      append_state_to_buffer (markov_chain,
+                              frozen_node_data (frozen, path[length - 1]),
+                              buffer);
+    }
+  output_buffer_append_char (buffer, '\n');
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+}
+
+bool generate_frozen_tweet (const MarkovChain *markov_chain,
+                            const FrozenChain *frozen, uint32_t first_node,
+                            int max_length, RandomStream *stream,
+                            OutputBuffer *buffer)
+{
+  uint32_t local_path[LOCAL_PATH_LENGTH];
+  uint32_t *path = local_path;
+  if (max_length + 1 > LOCAL_PATH_LENGTH)
+    {
+      path = malloc ((max_length + 1) * sizeof (uint32_t));
+      if (path == NULL)
+        {
+          fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+          return false;
+        }
+    }
+  int length = frozen_walk (frozen, first_node, max_length, stream, path);
+  if (length > 0)
+    {
+      append_frozen_walk (markov_chain, frozen, path, length, buffer);
+    }
+  if (path != local_path)
+    {
+      free (path);
+    }
+  return length > 0;
+}
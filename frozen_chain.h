@@ -0,0 +1,259 @@
+#ifndef _FROZEN_CHAIN_H_
+#define _FROZEN_CHAIN_H_
+
+#include <stdint.h>  // for uint32_t
+#include <stdbool.h> // for bool
+#include <stdlib.h>  // for size_t
+#include "alias_table.h"
+#include "random_stream.h"
+#include "output_buffer.h"
+#include "memory_report.h"
+
+#define FROZEN_NO_NODE UINT32_MAX
+
+// FrozenNode flags:
+// set when the chain's is_last returned true for the node's state, meaning
+// a sequence may continue after it.
+#define FROZEN_NODE_CONTINUES 1u
+
+// payloads are packed at offsets aligned to this many bytes.
+#define FROZEN_PAYLOAD_ALIGNMENT 8
+
+struct MarkovChain;
+
+// checks that the flat form of a state lies in the size bytes it was given
+// in the payload, for a chain of the given state_kind (see MarkovChain's
+// check_func).
+typedef bool (*check_func_t) (const void *state, size_t size,
+                              uint32_t state_kind);
+
+/**
+ * A state of a frozen chain. Its out-edges are
+ * edges[first_edge .. first_edge + edge_count - 1].
+ */
+typedef struct FrozenNode {
+    uint32_t payload_offset;
+    uint32_t first_edge;
+    uint32_t edge_count;
+    uint32_t flags;
+} FrozenNode;
+
+/**
+ * An out-edge of a frozen node. cumulative_frequency is the sum of the
+ * frequencies of this edge and all the edges before it of the same node.
+ */
+typedef struct FrozenEdge {
+    uint32_t target;
+    uint32_t cumulative_frequency;
+} FrozenEdge;
+
+/**
+ * Read-only, contiguous (CSR) form of a trained MarkovChain. Node i is the
+ * i-th node of the chain's database, and its state is stored in the
+ * payload blob at nodes[i].payload_offset.
+ */
+typedef struct FrozenChain {
+    FrozenNode *nodes;
+    uint32_t node_count;
+
+    FrozenEdge *edges;
+    uint32_t edge_count;
+
+    // a quantized chain (see frozen_chain_prune) keeps its edges as a
+    // struct of arrays instead, and edges is NULL: the target of every edge,
+    // and its cumulative frequency in 16 bits, so an edge takes 6 bytes
+    // instead of a FrozenEdge's 8. Read the edges with frozen_edge_target
+    // and frozen_edge_cumulative_frequency, in either form.
+    bool quantized;
+    uint32_t *edge_targets;
+    uint16_t *edge_frequencies;
+
+    unsigned char *payload;
+    size_t payload_size;
+
+    // the state_kind of the chain it was built from (see MarkovChain).
+    uint32_t state_kind;
+
+    // the nodes a sequence may start from, and an alias table over them
+    // when the start is weighted (start_sampler.size is 0 otherwise).
+    uint32_t *start_nodes;
+    uint32_t start_count;
+    AliasTable start_sampler;
+
+    // when the chain was loaded from a snapshot file: the file's mapping,
+    // which all the arrays above point into. NULL otherwise.
+    void *mapping;
+    size_t mapping_size;
+
+    // room in the arrays above, for frozen_chain_update, and how many of
+    // the edges belong to no node anymore (the old edges of nodes that
+    // were moved to the end of edges).
+    uint32_t node_capacity;
+    uint32_t edge_capacity;
+    size_t payload_capacity;
+    uint32_t stale_edges;
+} FrozenChain;
+
+/**
+ * Build the frozen form of a chain. The chain must have a size_func, and
+ * its start table is copied as it is (see markov_chain_build_start_table).
+ * @param markov_chain the trained chain
+ * @return the new frozen chain, NULL in case of allocation error or if the
+ * chain has no size_func.
+ */
+FrozenChain *frozen_chain_build (const struct MarkovChain *markov_chain);
+
+/**
+ * Update the frozen form of a chain that was trained further, for the
+ * chain's changed nodes only (see MarkovChain): new states are appended,
+ * the edges of a node that gained successors are moved to the end of
+ * edges, and the other changed nodes are rewritten in place. The edges are
+ * compacted once most of them are stale, so the cost stays proportional to
+ * the changes. The start table is copied again.
+ * @param frozen the frozen form of markov_chain, not loaded from a file,
+ * quantized or compacted (see markov_chain_compact)
+ * @param markov_chain the chain, with its start table up to date
+ * @return true on success, false in case of allocation error or if the
+ * chain grew too big.
+ */
+bool frozen_chain_update (FrozenChain *frozen,
+                          const struct MarkovChain *markov_chain);
+
+/**
+ * Give the arrays of a frozen chain back the room they don't use: the
+ * stale edges are dropped, and the spare capacity frozen_chain_update
+ * keeps is released. A chain loaded from a file or quantized (which have
+ * no spare room) is left as it is.
+ * @param frozen the frozen chain
+ * @return true on success, false in case of allocation error.
+ */
+bool frozen_chain_trim (FrozenChain *frozen);
+
+/**
+ * @param frozen the frozen chain
+ * @return the memory held by the frozen chain (see MemoryUsage). A chain
+ * loaded from a file holds no allocations, only its mapping.
+ */
+MemoryUsage frozen_chain_memory_usage (const FrozenChain *frozen);
+
+/**
+ * Free a frozen chain and all of its arrays.
+ * @param frozen the frozen chain to free, may be NULL
+ */
+void frozen_chain_free (FrozenChain *frozen);
+
+/**
+ * @param frozen the frozen chain
+ * @param node_index index of a node in frozen
+ * @return pointer to the state of the node.
+ */
+static inline const void *frozen_node_data (const FrozenChain *frozen,
+                                            uint32_t node_index)
+{
+  return frozen->payload + frozen->nodes[node_index].payload_offset;
+}
+
+/**
+ * @param frozen the frozen chain
+ * @return the bytes one edge of the chain takes.
+ */
+static inline size_t frozen_edge_size (const FrozenChain *frozen)
+{
+  return frozen->quantized ? sizeof (uint32_t) + sizeof (uint16_t)
+                           : sizeof (FrozenEdge);
+}
+
+/**
+ * @param frozen the frozen chain
+ * @param edge index of an edge in frozen
+ * @return the node the edge leads to.
+ */
+static inline uint32_t frozen_edge_target (const FrozenChain *frozen,
+                                           uint32_t edge)
+{
+  return frozen->quantized ? frozen->edge_targets[edge]
+                           : frozen->edges[edge].target;
+}
+
+/**
+ * @param frozen the frozen chain
+ * @param edge index of an edge in frozen
+ * @return the cumulative frequency of the edge (see FrozenEdge).
+ */
+static inline uint32_t frozen_edge_cumulative_frequency
+    (const FrozenChain *frozen, uint32_t edge)
+{
+  return frozen->quantized ? frozen->edge_frequencies[edge]
+                           : frozen->edges[edge].cumulative_frequency;
+}
+
+/**
+ * Get one random state that a sequence may start from, in O(1).
+ * @param frozen the frozen chain
+ * @param stream the stream to draw from
+ * @return index of the chosen node, FROZEN_NO_NODE if no state may start
+ * a sequence.
+ */
+uint32_t frozen_first_random_node (const FrozenChain *frozen,
+                                   RandomStream *stream);
+
+/**
+ * Choose randomly the next state, depend on its occurrence frequency.
+ * @param frozen the frozen chain
+ * @param node_index the current state
+ * @param stream the stream to draw from
+ * @return index of the chosen node, FROZEN_NO_NODE if the state has no
+ * successors.
+ */
+uint32_t frozen_next_random_node (const FrozenChain *frozen,
+                                  uint32_t node_index, RandomStream *stream);
+
+/**
+ * Walk randomly on a frozen chain, the same way generate_tweet does, without
+ * printing. When the walk stops at a state without successors, it is
+ * followed in path by FROZEN_NO_NODE (which generate_tweet prints as a
+ * space before the line break).
+ * @param frozen the frozen chain to walk on
+ * @param first_node index of the node to start with, FROZEN_NO_NODE to
+ * choose a random one
+ * @param max_length maximum length of the sequence
+ * @param stream the stream to draw from
+ * @param path filled with the nodes of the walk, room for max_length + 1
+ * entries
+ * @return amount of entries written to path, 0 if no state may start a
+ * sequence.
+ */
+int frozen_walk (const FrozenChain *frozen, uint32_t first_node,
+                 int max_length, RandomStream *stream, uint32_t *path);
+
+/**
+ * Render a walk made by frozen_walk, as generate_tweet does.
+ * @param markov_chain the chain the states are appended by (see
+ * append_state_to_buffer)
+ * @param frozen the frozen chain walked on
+ * @param path the walk
+ * @param length amount of entries in path, bigger than 0
+ * @param buffer the buffer to append the walk to
+ */
+void append_frozen_walk (const struct MarkovChain *markov_chain,
+                         const FrozenChain *frozen, const uint32_t *path,
+                         int length, OutputBuffer *buffer);
+
+/**
+ * Generate a random sequence out of a frozen chain and render it, the same
+ * way generate_tweet_to_buffer does.
+ * @param markov_chain the chain the states are appended by
+ * @param frozen the frozen chain to walk on
+ * @param first_node index of the node to start with, FROZEN_NO_NODE to
+ * choose a random one
+ * @param max_length maximum length of the sequence
+ * @param stream the stream to draw from
+ * @param buffer the buffer to append the sequence to
+ * @return false if no state may start a sequence, true otherwise.
+ */
+bool generate_frozen_tweet (const struct MarkovChain *markov_chain,
+                            const FrozenChain *frozen, uint32_t first_node,
+                            int max_length, RandomStream *stream,
+                            OutputBuffer *buffer);
+
+#endif //_FROZEN_CHAIN_H_
@@ -0,0 +1,125 @@
+#include "hash_index.h"
+#include "markov_chain.h"
+
+#define HASH_INDEX_MAX_LOAD_NUMERATOR 3
+#define HASH_INDEX_MAX_LOAD_DENOMINATOR 4
+
+static int hash_index_grow (HashIndex *index);
+
+HashIndex *hash_index_create (void)
+{
+  HashIndex *index = malloc (sizeof (HashIndex));
+  if (index == NULL)
+    {
+      return NULL;
+    }
+  index->slots = calloc (HASH_INDEX_INITIAL_CAPACITY, sizeof (Node *));
+  index->hashes = calloc (HASH_INDEX_INITIAL_CAPACITY,
+                          sizeof (unsigned long));
+  if (index->slots == NULL || index->hashes == NULL)
+    {
+      hash_index_free (index);
+      return NULL;
+    }
+  index->capacity = HASH_INDEX_INITIAL_CAPACITY;
+  index->size = 0;
+  return index;
+}
+
+Node *hash_index_find (const HashIndex *index, unsigned long hash,
+                       const void *key,
+                       int (*comp) (const void *, const void *))
+{
+  HashIndexProbe probe = hash_index_probe (index, hash);
+  Node *node;
+  while ((node = hash_index_next_candidate (index, &probe)) != NULL)
+    {
+      if (comp (node->data->data, key) == 0)
+        {
+          return node;
+        }
+    }
+  return NULL;
+}
+
+/**
+ * place node in the first free slot of its probe sequence, without any
+ * check of the load factor.
+ */
+static void hash_index_place (HashIndex *index, unsigned long hash,
+                              Node *node)
+{
+  size_t mask = index->capacity - 1;
+  size_t slot = hash & mask;
+
+  while (index->slots[slot] != NULL)
+    {
+      slot = (slot + 1) & mask;
+    }
+  index->slots[slot] = node;
+  index->hashes[slot] = hash;
+}
+
+int hash_index_insert (HashIndex *index, unsigned long hash, Node *node)
+{
+  if ((index->size + 1) * HASH_INDEX_MAX_LOAD_DENOMINATOR
+      > index->capacity * HASH_INDEX_MAX_LOAD_NUMERATOR)
+    {
+      if (hash_index_grow (index) != 0)
+        {
+          return 1;
+        }
+    }
+  hash_index_place (index, hash, node);
+  index->size++;
+  return 0;
+}
+
+/**
+ * double the capacity of the index and rehash all the stored Node's.
+ * @return 0 on success, 1 in case of allocation failure (the index is left
+ * untouched).
+ */
+static int hash_index_grow (HashIndex *index)
+{
+  Node **old_slots = index->slots;
+  unsigned long *old_hashes = index->hashes;
+  size_t old_capacity = index->capacity;
+
+  MARKOV_STATS_ALLOCATION (old_capacity * 2 * (sizeof (Node *)
+                                                + sizeof (unsigned long)));
+  Node **new_slots = calloc (old_capacity * 2, sizeof (Node *));
+  unsigned long *new_hashes = calloc (old_capacity * 2,
+                                      sizeof (unsigned long));
+  if (new_slots == NULL || new_hashes == NULL)
+    {
+      free (new_slots);
+      free (new_hashes);
+      return 1;
+    }
+
+  index->slots = new_slots;
+  index->hashes = new_hashes;
+  index->capacity = old_capacity * 2;
+  for (size_t i = 0; i < old_capacity; i++)
+    {
+      if (old_slots[i] != NULL)
+        {
+          hash_index_place (index, old_hashes[i], old_slots[i]);
+        }
+    }
+  free (old_slots);
+  free (old_hashes);
+  return 0;
+}
+
+void hash_index_free (HashIndex *index)
+{
+  if (index == NULL)
+    {
+      return;
+    }
+  free (index->slots);
+  free (index->hashes);
+  free (index);
+}
@@ -0,0 +1,104 @@
+#ifndef _HASH_INDEX_H_
+#define _HASH_INDEX_H_
+
+#include "linked_list.h"
+#include "markov_stats.h"
+#include <stdbool.h> // for bool
+
+#define HASH_INDEX_INITIAL_CAPACITY 64
+
+/**
+ * Open-addressing (linear probing) index over the Node's of a LinkedList.
+ * Every occupied slot holds the Node and the full hash of its state, so a
+ * probe only calls the comparison function on a real hash match.
+ */
+typedef struct HashIndex {
+    Node **slots;
+    unsigned long *hashes;
+    size_t capacity;
+    size_t size;
+} HashIndex;
+
+/**
+ * A lookup in progress: the hash looked for, and the next slot of its
+ * probe sequence (see hash_index_probe).
+ */
+typedef struct HashIndexProbe {
+    unsigned long hash;
+    size_t slot;
+} HashIndexProbe;
+
+/**
+ * Start a lookup of the states with the given hash.
+ * @param index the index to search in
+ * @param hash hash value of the state to look for
+ * @return the probe, at the state's home slot.
+ */
+static inline HashIndexProbe hash_index_probe (const HashIndex *index,
+                                               unsigned long hash)
+{
+  return (HashIndexProbe) {hash, hash & (index->capacity - 1)};
+}
+
+/**
+ * Advance a lookup to the next indexed Node whose state has the hash
+ * looked for, for the caller to compare with its key. Inlined, so a caller
+ * with a comparison known at compile time (see markov_chain_typed.h) can
+ * inline it too; hash_index_find is the same probe with a comp function.
+ * @param index the index the probe was started on
+ * @param probe the lookup, updated
+ * @return the Node, NULL once the probe reached an empty slot.
+ */
+static inline Node *hash_index_next_candidate (const HashIndex *index,
+                                               HashIndexProbe *probe)
+{
+  size_t mask = index->capacity - 1;
+  while (index->slots[probe->slot] != NULL)
+    {
+      size_t slot = probe->slot;
+      probe->slot = (slot + 1) & mask;
+      MARKOV_STATS_ADD (nodes_traversed, 1);
+      if (index->hashes[slot] == probe->hash)
+        {
+          MARKOV_STATS_ADD (comp_calls, 1);
+          return index->slots[slot];
+        }
+    }
+  return NULL;
+}
+
+/**
+ * Allocate an empty index.
+ * @return pointer to the new index, NULL in case of allocation failure.
+ */
+HashIndex *hash_index_create (void);
+
+/**
+ * Look for the Node whose state equals key.
+ * @param index the index to search in
+ * @param hash hash value of key
+ * @param key the state to look for
+ * @param comp comparison function, returns 0 when both states are equal
+ * @return the matching Node, NULL if key is not indexed.
+ */
+Node *hash_index_find (const HashIndex *index, unsigned long hash,
+                       const void *key,
+                       int (*comp) (const void *, const void *));
+
+/**
+ * Insert a Node into the index, growing it when needed. The caller is
+ * responsible for not inserting the same state twice.
+ * @param index the index to insert into
+ * @param hash hash value of node's state
+ * @param node the Node to index
+ * @return 0 on success, 1 in case of allocation failure.
+ */
+int hash_index_insert (HashIndex *index, unsigned long hash, Node *node);
+
+/**
+ * Free the index (the indexed Node's are not touched).
+ * @param index the index to free, may be NULL
+ */
+void hash_index_free (HashIndex *index);
+
+#endif //_HASH_INDEX_H_
@@ -1,7 +1,9 @@
 #include "linked_list.h"
+#include "markov_stats.h"
 
 int add (LinkedList *link_list, void *data)
 {
+  MARKOV_STATS_ALLOCATION (sizeof (Node));
   Node *new_node = malloc (sizeof (Node));
   if (new_node == NULL)
   {
@@ -9,6 +11,13 @@ int add (LinkedList *link_list, void *data)
   }
   *new_node = (Node) {data, NULL};
 
+  link_node (link_list, new_node);
+  return 0;
+}
+
+void link_node (LinkedList *link_list, Node *new_node)
+{
+  new_node->next = NULL;
   if (link_list->first == NULL)
   {
     link_list->first = new_node;
@@ -21,5 +30,4 @@ int add (LinkedList *link_list, void *data)
   }
 
   link_list->size++;
-  return 0;
 }
\ No newline at end of file
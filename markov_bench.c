@@ -0,0 +1,617 @@
+#include "markov_chain.h"
+#include "markov_chain_str.h"
+#include "markov_chain_view.h"
+#include "text_corpus.h"
+#include "zipf_corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>       // for getopt()
+#include <sys/resource.h> // for getrusage()
+
+#define DEFAULT_TOKENS 1000000
+#define DEFAULT_VOCABULARY 100000
+#define DEFAULT_EXPONENT 1.0
+#define DEFAULT_SEED 1
+#define MIN_TOKENS 2
+#define GENERATED_MAX_LENGTH 20
+#define NANOSECONDS_PER_SECOND 1e9
+#define FNV_OFFSET_BASIS 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+
+/**
+ * the flags of the program
+ */
+typedef struct Options {
+    // -n <tokens>: amount of words of the synthetic corpus.
+    uint64_t tokens;
+
+    // -v <vocabulary>: amount of distinct words of the synthetic corpus.
+    uint32_t vocabulary;
+
+    // -s <exponent>: the exponent of its Zipf distribution.
+    double exponent;
+
+    // -r <seed>: the seed of the corpus and of the walks.
+    uint64_t seed;
+
+    // -t <threads>: amount of threads of the end to end training.
+    int training_threads;
+
+    // -c <path>: also train on this corpus file, end to end.
+    const char *corpus_path;
+
+    // -g: write the synthetic corpus to stdout instead of measuring.
+    bool generate_corpus;
+} Options;
+
+/**
+ * the states of a chain of words.
+ */
+typedef enum ChainKind {
+    // strings, through callbacks of the bench's own.
+    CHAIN_GENERIC,
+    // strings, through the callbacks of markov_chain_str.
+    CHAIN_STR,
+    // views into the corpus, see markov_chain_view.h.
+    CHAIN_VIEW
+} ChainKind;
+
+/**
+ * what is measured over the synthetic corpus.
+ */
+typedef struct BenchState {
+    const Options *options;
+
+    // the words of every rank, ZIPF_WORD_MAX_LENGTH chars each.
+    char *words;
+
+    // the rank of every token of the corpus.
+    uint32_t *ranks;
+
+    // the node of every rank, once it was added.
+    Node **nodes;
+} BenchState;
+
+#define ERR_MSG_USAGE_PROBLEM "Usage: ./markov_bench [-n <tokens>] \
+[-v <vocabulary>] [-s <exponent>] [-r <seed>] [-t <training threads>] \
+[-c <corpus path>] [-g]. With -g the synthetic corpus is written to \
+stdout, otherwise one JSON object per benchmark is.\n"
+
+#define ERR_MSG_FILE_PATH "Error: the program have an invalid file path.\n"
+
+static int comp_str (const void *ptr1, const void *ptr2)
+{
+  return strcmp ((const char *) ptr1, (const char *) ptr2);
+}
+
+static size_t size_str (const void *ptr)
+{
+  return strlen ((const char *) ptr) + 1;
+}
+
+static unsigned long hash_str (const void *ptr)
+{
+  // FNV-1a
+  const unsigned char *str = (const unsigned char *) ptr;
+  unsigned long hash = FNV_OFFSET_BASIS;
+  while (*str != '\0')
+    {
+      hash ^= *str++;
+      hash *= FNV_PRIME;
+    }
+  return hash;
+}
+
+static bool is_last_str (const void *ptr)
+{
+  const char *str = (const char *) ptr;
+  return str[strlen (str) - 1] != '.';
+}
+
+static void print_str (const void *ptr)
+{
+  printf ("%s", (const char *) ptr);
+}
+
+static void append_str (const void *ptr, OutputBuffer *buffer)
+{
+  output_buffer_append_str (buffer, (const char *) ptr);
+}
+
+static double now_seconds (void)
+{
+  struct timespec time;
+  clock_gettime (CLOCK_MONOTONIC, &time);
+  return (double) time.tv_sec + time.tv_nsec / NANOSECONDS_PER_SECOND;
+}
+
+static long peak_rss_kb (void)
+{
+  struct rusage usage;
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    {
+      return -1;
+    }
+  return usage.ru_maxrss;
+}
+
+/**
+ * print the result of one benchmark as a JSON object on a line of its own.
+ * @param name name of the benchmark
+ * @param ops amount of operations measured
+ * @param bytes amount of corpus bytes read, 0 if none
+ * @param seconds the time the operations took
+ * @param options the corpus the benchmark ran on
+ */
+static void report (const char *name, uint64_t ops, size_t bytes,
+                    double seconds, const Options *options)
+{
+  double per_second = (seconds > 0) ? ops / seconds : 0;
+  printf ("{\"benchmark\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, "
+          "\"ns_per_op\": %.2f, \"ops_per_second\": %.0f, ", name,
+          (unsigned long long) ops, seconds,
+          (ops > 0) ? seconds * NANOSECONDS_PER_SECOND / ops : 0,
+          per_second);
+  if (bytes > 0)
+    {
+      printf ("\"megabytes_per_second\": %.2f, ",
+              (seconds > 0) ? bytes / seconds / 1e6 : 0);
+    }
+  printf ("\"peak_rss_kb\": %ld, \"tokens\": %llu, \"vocabulary\": %u, "
+          "\"exponent\": %.2f}\n", peak_rss_kb (),
+          (unsigned long long) options->tokens, options->vocabulary,
+          options->exponent);
+  fflush (stdout);
+}
+
+/**
+ * compact a trained chain, and print the memory it took before and after
+ * as a JSON object on a line of its own (see memory_report.h).
+ * @param name name of the benchmark the chain was trained by
+ * @param markov_chain the trained chain
+ * @param options the corpus the chain was trained on
+ * @return true on success, false otherwise.
+ */
+static bool report_memory (const char *name, MarkovChain *markov_chain,
+                           const Options *options)
+{
+  MemoryUsage training = markov_chain_memory_usage (markov_chain);
+  size_t resident_before = memory_resident_bytes ();
+  if (!markov_chain_compact (markov_chain))
+    {
+      return false;
+    }
+  MemoryUsage compact = frozen_chain_memory_usage (markov_chain->frozen);
+  size_t training_total = memory_usage_total (&training);
+  size_t compact_total = memory_usage_total (&compact);
+  printf ("{\"benchmark\": \"%s_memory\", \"states\": %zu, "
+          "\"edges\": %zu, \"training_bytes\": %zu, "
+          "\"compact_bytes\": %zu, \"reduction\": %.2f, "
+          "\"resident_before_kb\": %zu, \"resident_after_kb\": %zu, "
+          "\"tokens\": %llu, \"vocabulary\": %u, \"exponent\": %.2f}\n",
+          name, compact.states, compact.edges, training_total, compact_total,
+          (compact_total > 0) ? (double) training_total / compact_total : 0,
+          resident_before / 1024, memory_resident_bytes () / 1024,
+          (unsigned long long) options->tokens, options->vocabulary,
+          options->exponent);
+  fflush (stdout);
+  return true;
+}
+
+/**
+ * set the callbacks of a chain of words. The chains of markov_chain_str
+ * and markov_chain_view are trained through the inlined lookups; the
+ * generic ones have equal callbacks of their own, so they are trained
+ * through the function pointers.
+ */
+static void init_chain (MarkovChain *markov_chain, LinkedList *database,
+                        ChainKind kind)
+{
+  *database = (LinkedList) {NULL, NULL, 0};
+  *markov_chain = (MarkovChain) {0};
+  markov_chain->database = database;
+  if (kind == CHAIN_VIEW)
+    {
+      markov_chain_view_init (markov_chain);
+    }
+  else
+    {
+      bool typed = kind == CHAIN_STR;
+      markov_chain->comp_func = typed ? markov_chain_str_comp_func
+                                      : comp_str;
+      markov_chain->size_func = size_str;
+      markov_chain->hash_func = typed ? markov_chain_str_hash_func
+                                      : hash_str;
+      markov_chain->is_last = typed ? markov_chain_str_is_last_func
+                                    : is_last_str;
+    }
+  markov_chain->print_func = print_str;
+  markov_chain->append_func = append_str;
+}
+
+/**
+ * add every token of the corpus to the database, one by one.
+ * @param typed true to add through markov_chain_str_add_to_database
+ * @return true on success, false otherwise.
+ */
+static bool bench_add_to_database (MarkovChain *markov_chain,
+                                   BenchState *state, bool typed)
+{
+  const Options *options = state->options;
+  double start = now_seconds ();
+  for (uint64_t i = 0; i < options->tokens; i++)
+    {
+      uint32_t rank = state->ranks[i];
+      char *word = state->words + (size_t) rank * ZIPF_WORD_MAX_LENGTH;
+      Node *node = typed ? markov_chain_str_add_to_database (markov_chain,
+                                                             word)
+                         : add_to_database (markov_chain, word);
+      if (node == NULL)
+        {
+          return false;
+        }
+      state->nodes[rank] = node;
+    }
+  report (typed ? "add_to_database_str" : "add_to_database",
+          options->tokens, 0, now_seconds () - start, options);
+  return true;
+}
+
+/**
+ * look every token of the corpus up in the database.
+ * @param typed true to look up through
+ * markov_chain_str_get_node_from_database
+ * @return true if all of them were found.
+ */
+static bool bench_get_node_from_database (MarkovChain *markov_chain,
+                                          BenchState *state, bool typed)
+{
+  const Options *options = state->options;
+  uint64_t found = 0;
+  double start = now_seconds ();
+  for (uint64_t i = 0; i < options->tokens; i++)
+    {
+      char *word = state->words
+                   + (size_t) state->ranks[i] * ZIPF_WORD_MAX_LENGTH;
+      Node *node = typed
+                   ? markov_chain_str_get_node_from_database (markov_chain,
+                                                              word)
+                   : get_node_from_database (markov_chain, word);
+      found += node != NULL;
+    }
+  report (typed ? "get_node_from_database_str" : "get_node_from_database",
+          options->tokens, 0, now_seconds () - start, options);
+  return found == options->tokens;
+}
+
+/**
+ * count every pair of consecutive tokens of the corpus.
+ * @return true on success, false otherwise.
+ */
+static bool bench_add_node_to_frequencies_list (MarkovChain *markov_chain,
+                                                BenchState *state)
+{
+  const Options *options = state->options;
+  double start = now_seconds ();
+  for (uint64_t i = 1; i < options->tokens; i++)
+    {
+      if (!add_node_to_frequencies_list
+          (state->nodes[state->ranks[i - 1]]->data,
+           state->nodes[state->ranks[i]]->data, markov_chain))
+        {
+          return false;
+        }
+    }
+  report ("add_node_to_frequencies_list", options->tokens - 1, 0,
+          now_seconds () - start, options);
+  return true;
+}
+
+/**
+ * walk the trained chain, one token of the corpus per step.
+ * @return true on success, false otherwise.
+ */
+static bool bench_get_next_random_node (MarkovChain *markov_chain,
+                                        BenchState *state)
+{
+  const Options *options = state->options;
+  if (!markov_chain_finish_training (markov_chain))
+    {
+      return false;
+    }
+  RandomStream stream;
+  random_stream_init (&stream, options->seed, 0);
+  MarkovNode *node = state->nodes[state->ranks[0]]->data;
+  double start = now_seconds ();
+  for (uint64_t i = 0; i < options->tokens; i++)
+    {
+      MarkovNode *next = get_next_random_node_with_stream (node, &stream);
+      node = (next != NULL) ? next : state->nodes[state->ranks[0]]->data;
+    }
+  report ("get_next_random_node", options->tokens, 0,
+          now_seconds () - start, options);
+  return true;
+}
+
+/**
+ * generate sequences from the frozen chain into a buffer, about one word
+ * per token of the corpus.
+ * @return true on success, false otherwise.
+ */
+static bool bench_generate (MarkovChain *markov_chain, const Options *options)
+{
+  if (!markov_chain_freeze (markov_chain))
+    {
+      return false;
+    }
+  uint64_t sequences = options->tokens / GENERATED_MAX_LENGTH + 1;
+  OutputBuffer buffer;
+  output_buffer_init (&buffer, NULL);
+  bool ans = true;
+  double start = now_seconds ();
+  for (uint64_t i = 0; i < sequences && ans; i++)
+    {
+      RandomStream stream;
+      random_stream_init (&stream, options->seed, i);
+      ans = generate_tweet_to_buffer (markov_chain, NULL,
+                                      GENERATED_MAX_LENGTH, &stream,
+                                      &buffer);
+      output_buffer_clear (&buffer);
+    }
+  double seconds = now_seconds () - start;
+  ans = ans && !buffer.failed;
+  output_buffer_free (&buffer);
+  if (ans)
+    {
+      report ("generate", sequences, 0, seconds, options);
+    }
+  return ans;
+}
+
+/**
+ * train a new chain on a text, end to end: the words are read, added and
+ * counted, and the chain is made ready for generation. Then it's compacted,
+ * and the memory it took is reported.
+ * @return true on success, false otherwise.
+ */
+static bool bench_train (const char *name, const char *text, size_t length,
+                         FILE *fp, ChainKind kind, const Options *options)
+{
+  LinkedList database;
+  MarkovChain markov_chain;
+  init_chain (&markov_chain, &database, kind);
+  MarkovChain *markov_chain_pointer = &markov_chain;
+  TextCursor cursor;
+  text_cursor_init (&cursor, TEXT_CORPUS_ALL_WORDS);
+
+  double start = now_seconds ();
+  bool ans = markov_chain_use_arena (&markov_chain);
+  if (ans && fp != NULL)
+    {
+      ans = train_on_file (fp, &markov_chain, &cursor,
+                           options->training_threads) == EXIT_SUCCESS;
+    }
+  else if (ans)
+    {
+      ans = train_on_text_parallel (&markov_chain, text, length, &cursor,
+                                    options->training_threads)
+            == EXIT_SUCCESS;
+    }
+  ans = ans && markov_chain_finish_training (&markov_chain);
+  double seconds = now_seconds () - start;
+  if (ans)
+    {
+      report (name, cursor.word_count, length, seconds, options);
+    }
+  text_cursor_free (&cursor);
+  ans = ans && report_memory (name, &markov_chain, options);
+  free_database (&markov_chain_pointer);
+  return ans;
+}
+
+/**
+ * run the hot path benchmarks over the tokens of the corpus, on one chain.
+ * @return true on success, false otherwise.
+ */
+static bool bench_hot_paths (BenchState *state)
+{
+  LinkedList database;
+  MarkovChain markov_chain;
+  init_chain (&markov_chain, &database, CHAIN_GENERIC);
+  MarkovChain *markov_chain_pointer = &markov_chain;
+  bool ans = markov_chain_use_arena (&markov_chain)
+             && bench_add_to_database (&markov_chain, state, false)
+             && bench_get_node_from_database (&markov_chain, state, false)
+             && bench_add_node_to_frequencies_list (&markov_chain, state)
+             && bench_get_next_random_node (&markov_chain, state)
+             && bench_generate (&markov_chain, state->options);
+  free_database (&markov_chain_pointer);
+  if (!ans)
+    {
+      return false;
+    }
+
+  // the same lookups on a chain of markov_chain_str.
+  init_chain (&markov_chain, &database, CHAIN_STR);
+  ans = markov_chain_use_arena (&markov_chain)
+        && bench_add_to_database (&markov_chain, state, true)
+        && bench_get_node_from_database (&markov_chain, state, true);
+  free_database (&markov_chain_pointer);
+  return ans;
+}
+
+/**
+ * run the hot path benchmarks, then train on the rendered corpus end to
+ * end.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int run_benchmarks (ZipfCorpus *corpus, const Options *options)
+{
+  BenchState state = {options, NULL, NULL, NULL};
+  state.words = malloc ((size_t) options->vocabulary * ZIPF_WORD_MAX_LENGTH);
+  state.ranks = malloc (options->tokens * sizeof (uint32_t));
+  state.nodes = calloc (options->vocabulary, sizeof (Node *));
+  if (state.words == NULL || state.ranks == NULL || state.nodes == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      free (state.words);
+      free (state.ranks);
+      free (state.nodes);
+      return EXIT_FAILURE;
+    }
+  for (uint32_t rank = 0; rank < options->vocabulary; rank++)
+    {
+      zipf_corpus_word (rank, state.words + (size_t) rank
+                                            * ZIPF_WORD_MAX_LENGTH);
+    }
+  for (uint64_t i = 0; i < options->tokens; i++)
+    {
+      state.ranks[i] = zipf_corpus_next (corpus);
+    }
+  bool ans = bench_hot_paths (&state);
+  free (state.words);
+  free (state.ranks);
+  free (state.nodes);
+
+  OutputBuffer text;
+  output_buffer_init (&text, NULL);
+  if (ans)
+    {
+      zipf_corpus_append (corpus, options->tokens, &text);
+      ans = !text.failed
+            && bench_train ("train_text", text.data, text.size, NULL,
+                            CHAIN_GENERIC, options)
+            && bench_train ("train_text_str", text.data, text.size, NULL,
+                            CHAIN_STR, options)
+            && bench_train ("train_text_view", text.data, text.size, NULL,
+                            CHAIN_VIEW, options);
+    }
+  output_buffer_free (&text);
+  return ans ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * train on the corpus file end to end.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int bench_corpus_file (const Options *options)
+{
+  FILE *fp = fopen (options->corpus_path, "r");
+  if (fp == NULL)
+    {
+      fprintf (stdout, ERR_MSG_FILE_PATH);
+      return EXIT_FAILURE;
+    }
+  fseek (fp, 0, SEEK_END);
+  long length = ftell (fp);
+  rewind (fp);
+  bool ans = bench_train ("train_file", NULL, (length > 0) ? length : 0, fp,
+                          CHAIN_VIEW, options);
+  fclose (fp);
+  return ans ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * write the synthetic corpus to stdout.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int write_corpus (ZipfCorpus *corpus, const Options *options)
+{
+  OutputBuffer buffer;
+  output_buffer_init (&buffer, stdout);
+  zipf_corpus_append (corpus, options->tokens, &buffer);
+  bool ans = output_buffer_flush (&buffer) && !buffer.failed;
+  output_buffer_free (&buffer);
+  return ans ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int parse_options (int argc, char *argv[], Options *options)
+{
+  unsigned long long tokens;
+  unsigned long long seed;
+  int option;
+  while ((option = getopt (argc, argv, "n:v:s:r:t:c:g")) != -1)
+    {
+      bool valid = true;
+      switch (option)
+        {
+          case 'n':
+            valid = sscanf (optarg, "%llu", &tokens) == 1
+                    && tokens >= MIN_TOKENS;
+            options->tokens = tokens;
+          break;
+          case 'v':
+            valid = sscanf (optarg, "%u", &options->vocabulary) == 1
+                    && options->vocabulary > 0;
+          break;
+          case 's':
+            valid = sscanf (optarg, "%lf", &options->exponent) == 1
+                    && options->exponent >= 0;
+          break;
+          case 'r':
+            valid = sscanf (optarg, "%llu", &seed) == 1;
+            options->seed = seed;
+          break;
+          case 't':
+            valid = sscanf (optarg, "%d", &options->training_threads) == 1
+                    && options->training_threads > 0;
+          break;
+          case 'c':
+            options->corpus_path = optarg;
+          break;
+          case 'g':
+            options->generate_corpus = true;
+          break;
+          default:
+            valid = false;
+        }
+      if (!valid)
+        {
+          fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+          return EXIT_FAILURE;
+        }
+    }
+  if (optind != argc)
+    {
+      fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+int main (int argc, char *argv[])
+{
+  Options options = {.tokens = DEFAULT_TOKENS,
+                     .vocabulary = DEFAULT_VOCABULARY,
+                     .exponent = DEFAULT_EXPONENT, .seed = DEFAULT_SEED,
+                     .training_threads = 1};
+  if (parse_options (argc, argv, &options) == EXIT_FAILURE)
+    {
+      return EXIT_FAILURE;
+    }
+
+  ZipfCorpus corpus;
+  if (!zipf_corpus_init (&corpus, options.vocabulary, options.exponent,
+                         options.seed))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  int ans;
+  if (options.generate_corpus)
+    {
+      ans = write_corpus (&corpus, &options);
+    }
+  else
+    {
+      ans = run_benchmarks (&corpus, &options);
+      if (ans == EXIT_SUCCESS && options.corpus_path != NULL)
+        {
+          ans = bench_corpus_file (&options);
+        }
+    }
+  zipf_corpus_free (&corpus);
+  return ans;
+}
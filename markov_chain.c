@@ -1,21 +1,61 @@
 #include <string.h>
 #include "markov_chain.h"
+#include "chain_snapshot.h"
 
 // CONSTANTS:
 
 #define SUCSSES_ADD 1
 
-#define MAX_LENGTH_FOR_TWEET 20
+// EdgeIndex slot of no entry.
+#define EMPTY_EDGE_SLOT (-1)
+#define EDGE_INDEX_HASH_MULTIPLIER 2654435769u
 
 #define ERR_MSG_ALLOCATION_FAILURE \
   "Allocation failure: Something went wrong! we couldn't allocate enough "\
   "memory for your program, pleas try again.\n"
 
+#define ERR_MSG_SNAPSHOT_STATE_KIND \
+  "Error: the snapshot holds states of another kind than the chain's.\n"
+
+#define ERR_MSG_KEY_OUT_OF_RANGE \
+  "Error: the key of a state is out of the range of the chain.\n"
+
 // COMPILATION & DECLARATION SECTION:
 
 MarkovNode *create_new_markov_node (void *data_ptr, MarkovChain *markov_chain);
 int get_random_number (int max_number);
 void free_node (Node *cur_del_node, MarkovChain *markov_chain);
+static HashIndex *create_database_index (MarkovChain *markov_chain);
+static MarkovNode *create_arena_markov_node (void *data_ptr,
+                                             MarkovChain *markov_chain);
+static void init_markov_node (MarkovNode *new_markov_node,
+                              const MarkovChain *markov_chain);
+static bool grow_frequencies_list (MarkovNode *markov_node,
+                                   MarkovChain *markov_chain);
+static bool resize_frequencies_list (MarkovNode *markov_node, int capacity,
+                                     MarkovChain *markov_chain);
+static int find_successor (const MarkovNode *markov_node,
+                           const MarkovNode *successor);
+static bool index_new_successor (MarkovNode *markov_node,
+                                 MarkovChain *markov_chain);
+static void note_changed_node (MarkovChain *markov_chain,
+                               MarkovNode *markov_node);
+static void clear_changed_nodes (MarkovChain *markov_chain);
+static void release_training_state (MarkovChain *markov_chain);
+static MarkovNode *scan_next_random_node (const MarkovNode *markov_node,
+                                          RandomStream *stream);
+
+/**
+ * Open addressing (linear probing) table over the frequencies list of a
+ * high-degree node: every used slot holds the position of a successor in
+ * the list, at or after the slot its index hashes to. The table is kept at
+ * most half full.
+ */
+typedef struct EdgeIndex {
+    // the table has 2^capacity_bits slots.
+    unsigned int capacity_bits;
+    int slots[];
+} EdgeIndex;
 
 // ######################################################################### //
 
@@ -27,6 +67,22 @@ Node *add_to_database (MarkovChain *markov_chain, void *data_ptr)
     {
       return node;
     }
+  return add_missing_to_database (markov_chain, data_ptr);
+}
+
+Node *add_missing_to_database (MarkovChain *markov_chain, void *data_ptr)
+{
+  if (markov_chain->compacted)
+    {
+      fprintf (stdout, ERR_MSG_FROZEN_COMPACTED);
+      return NULL;
+    }
+  if (markov_chain->key_func != NULL
+      && markov_chain->key_func (data_ptr) >= markov_chain->key_count)
+    {
+      fprintf (stdout, ERR_MSG_KEY_OUT_OF_RANGE);
+      return NULL;
+    }
 
   MarkovNode *new_markov_node = create_new_markov_node
       (data_ptr, markov_chain);
@@ -34,19 +90,82 @@ Node *add_to_database (MarkovChain *markov_chain, void *data_ptr)
   if (new_markov_node == NULL)
     { return NULL; }
 
-  int res = add (markov_chain->database, new_markov_node);
-  if (res == SUCSSES_ADD)
-    { return NULL; }
+  int res;
+  if (markov_chain->arena != NULL)
+    {
+      Node *new_node = arena_alloc (markov_chain->arena, sizeof (Node));
+      if (new_node == NULL)
+        {
+          fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+          return NULL;
+        }
+      new_node->data = new_markov_node;
+      link_node (markov_chain->database, new_node);
+    }
+  else
+    {
+      res = add (markov_chain->database, new_markov_node);
+      if (res == SUCSSES_ADD)
+        { return NULL; }
+    }
+
+  markov_chain->start_nodes_ready = false;
+  note_changed_node (markov_chain, new_markov_node);
+
+  if (markov_chain->key_func != NULL)
+    {
+      markov_chain->dense_nodes[markov_chain->key_func
+          (new_markov_node->data)] = markov_chain->database->last;
+    }
+  else if (markov_chain->index != NULL)
+    {
+      res = hash_index_insert (markov_chain->index, markov_chain->hash_func
+          (new_markov_node->data), markov_chain->database->last);
+      if (res == SUCSSES_ADD)
+        {
+          fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+          return NULL;
+        }
+    }
 
   return markov_chain->database->last;
 }
 
 Node *get_node_from_database (MarkovChain *markov_chain, void *data_ptr)
 {
+  if (markov_chain->compacted)
+    {
+      // the states were released, only the frozen form is left.
+      return NULL;
+    }
+  if (markov_chain->key_func != NULL)
+    {
+      size_t key = markov_chain->key_func (data_ptr);
+      return (key < markov_chain->key_count)
+             ? markov_chain->dense_nodes[key] : NULL;
+    }
+  if (markov_chain->hash_func != NULL)
+    {
+      if (markov_chain->index == NULL)
+        {
+          // the index is only created once the first lookup happens, so a
+          // chain can be set up field by field like before.
+          markov_chain->index = create_database_index (markov_chain);
+          if (markov_chain->index == NULL)
+            {
+              return NULL;
+            }
+        }
+      return hash_index_find (markov_chain->index, markov_chain->hash_func
+          (data_ptr), data_ptr, markov_chain->comp_func);
+    }
+
   Node *cur_node = markov_chain->database->first;
 
   while (cur_node != NULL)
     {
+      MARKOV_STATS_ADD (nodes_traversed, 1);
+      MARKOV_STATS_ADD (comp_calls, 1);
       if (markov_chain->comp_func (cur_node->data->data, data_ptr) == 0)
         { return cur_node; }
 
@@ -60,38 +179,168 @@ bool
 add_node_to_frequencies_list (MarkovNode *first_node, MarkovNode
 *second_node, MarkovChain *markov_chain)
 {
-  for (int i = 0; i < first_node->frequencies_list_size; i++)
+  return add_weighted_node_to_frequencies_list (first_node, second_node,
+                                                markov_chain, 1);
+}
+
+bool
+add_weighted_node_to_frequencies_list (MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain, int frequency)
+{
+  int position = find_successor (first_node, second_node);
+  if (position != EMPTY_EDGE_SLOT)
     {
-      if (markov_chain->comp_func (first_node->frequencies_list[i].
-          markov_node->data, second_node->data) == 0)
-        {
-          // increment the frequency if the second_node is already in the
-          // frequencies list.
-          first_node->frequencies_list[i].frequency++;
-          return true;
-        }
+      // increment the frequency if the second_node is already in the
+      // frequencies list.
+      first_node->frequencies_list[position].frequency += frequency;
+      first_node->sampler_outdated = true;
+      note_changed_node (markov_chain, first_node);
+      return true;
     }
 
   // increase the size of the frequencies_list.
-  first_node->frequencies_list_size++;
-  MarkovNodeFrequency *mnf_ptr = realloc (first_node->frequencies_list,
-                                          first_node->frequencies_list_size
-                                          * sizeof (MarkovNodeFrequency));
-
-  if (mnf_ptr == NULL)
+  if (!grow_frequencies_list (first_node, markov_chain))
     {
       fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
       return false;
     }
-
-  first_node->frequencies_list = mnf_ptr;
+  first_node->frequencies_list_size++;
 
   // add the second_node to the frequencies_list.
   first_node->frequencies_list[first_node->frequencies_list_size - 1]
       .markov_node = second_node;
   first_node->frequencies_list[first_node->frequencies_list_size - 1]
-      .frequency = 1;
+      .frequency = frequency;
+  first_node->sampler_outdated = true;
+  note_changed_node (markov_chain, first_node);
+
+  if (!index_new_successor (first_node, markov_chain))
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  return true;
+}
+
+static unsigned int edge_slot (const EdgeIndex *edge_index,
+                               const MarkovNode *successor)
+{
+  return ((unsigned int) successor->index * EDGE_INDEX_HASH_MULTIPLIER)
+      >> (32 - edge_index->capacity_bits);
+}
 
+/**
+ * @return the position of successor in the frequencies list of
+ * markov_node, EMPTY_EDGE_SLOT if it is not there.
+ */
+static int find_successor (const MarkovNode *markov_node,
+                           const MarkovNode *successor)
+{
+  const EdgeIndex *edge_index = markov_node->edge_index;
+  if (edge_index == NULL)
+    {
+      for (int i = 0; i < markov_node->frequencies_list_size; i++)
+        {
+          if (markov_node->frequencies_list[i].markov_node == successor)
+            {
+              return i;
+            }
+        }
+      return EMPTY_EDGE_SLOT;
+    }
+
+  unsigned int mask = (1u << edge_index->capacity_bits) - 1;
+  for (unsigned int slot = edge_slot (edge_index, successor);;
+       slot = (slot + 1) & mask)
+    {
+      int position = edge_index->slots[slot];
+      if (position == EMPTY_EDGE_SLOT
+          || markov_node->frequencies_list[position].markov_node == successor)
+        {
+          return position;
+        }
+    }
+}
+
+static void insert_successor (EdgeIndex *edge_index,
+                              const MarkovNode *markov_node, int position)
+{
+  unsigned int mask = (1u << edge_index->capacity_bits) - 1;
+  unsigned int slot = edge_slot (edge_index,
+                                 markov_node->frequencies_list[position]
+                                     .markov_node);
+  while (edge_index->slots[slot] != EMPTY_EDGE_SLOT)
+    {
+      slot = (slot + 1) & mask;
+    }
+  edge_index->slots[slot] = position;
+}
+
+/**
+ * (re)build the edge index of a node with room for four times its
+ * successors. In arena mode the old table is left in the arena.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool build_edge_index (MarkovNode *markov_node,
+                              MarkovChain *markov_chain)
+{
+  unsigned int capacity_bits = 1;
+  while (((size_t) 1 << capacity_bits)
+         < 4 * (size_t) markov_node->frequencies_list_size)
+    {
+      capacity_bits++;
+    }
+  size_t capacity = (size_t) 1 << capacity_bits;
+  size_t table_size = sizeof (EdgeIndex) + capacity * sizeof (int);
+  EdgeIndex *edge_index = (markov_chain->arena != NULL)
+                          ? arena_alloc (markov_chain->arena, table_size)
+                          : malloc (table_size);
+  if (markov_chain->arena == NULL)
+    {
+      MARKOV_STATS_ALLOCATION (table_size);
+    }
+  if (edge_index == NULL)
+    {
+      return false;
+    }
+  edge_index->capacity_bits = capacity_bits;
+  for (size_t i = 0; i < capacity; i++)
+    {
+      edge_index->slots[i] = EMPTY_EDGE_SLOT;
+    }
+  for (int i = 0; i < markov_node->frequencies_list_size; i++)
+    {
+      insert_successor (edge_index, markov_node, i);
+    }
+
+  if (markov_chain->arena == NULL)
+    {
+      free (markov_node->edge_index);
+    }
+  markov_node->edge_index = edge_index;
+  return true;
+}
+
+/**
+ * add the last entry of the frequencies list of markov_node to its edge
+ * index, building or growing the index when needed.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool index_new_successor (MarkovNode *markov_node,
+                                 MarkovChain *markov_chain)
+{
+  int size = markov_node->frequencies_list_size;
+  if (markov_node->edge_index == NULL)
+    {
+      return size < EDGE_INDEX_MIN_DEGREE
+             || build_edge_index (markov_node, markov_chain);
+    }
+  if (2 * (size_t) size > ((size_t) 1 << markov_node->edge_index
+      ->capacity_bits))
+    {
+      return build_edge_index (markov_node, markov_chain);
+    }
+  insert_successor (markov_node->edge_index, markov_node, size - 1);
   return true;
 }
 
@@ -107,126 +356,632 @@ void free_database (MarkovChain **ptr_chain)
       return;
     }
 
-  // defining all the needed Node's.
-  Node *cur_del_node = (*ptr_chain)->database->first;
-  Node *next_node_to_del;
+  release_training_state (*ptr_chain);
+  frozen_chain_free ((*ptr_chain)->frozen);
+  (*ptr_chain)->frozen = NULL;
+}
+
+bool markov_chain_compact (MarkovChain *markov_chain)
+{
+  if (markov_chain == NULL)
+    {
+      return false;
+    }
+
+  if (markov_chain->frozen == NULL)
+    {
+      if (!markov_chain_freeze (markov_chain))
+        {
+          return false;
+        }
+    }
+  else if (markov_chain->changed_first != NULL
+           && !markov_chain_finish_training (markov_chain))
+    {
+      return false;
+    }
+  if (!frozen_chain_trim (markov_chain->frozen))
+    {
+      return false;
+    }
+  release_training_state (markov_chain);
+  markov_chain->compacted = true;
+  return true;
+}
+
+bool markov_chain_prune (MarkovChain *markov_chain,
+                         const PruneOptions *options, PruneReport *report)
+{
+  if (!markov_chain_compact (markov_chain))
+    {
+      return false;
+    }
+  FrozenChain *pruned = frozen_chain_prune (markov_chain->frozen, options,
+                                            report);
+  if (pruned == NULL)
+    {
+      return false;
+    }
+  frozen_chain_free (markov_chain->frozen);
+  markov_chain->frozen = pruned;
+  return true;
+}
 
-  while (cur_del_node != NULL)
+MemoryUsage markov_chain_memory_usage (const MarkovChain *markov_chain)
+{
+  MemoryUsage usage = {0};
+  bool in_arena = markov_chain->arena != NULL;
+  for (const Node *node = markov_chain->database->first; node != NULL;
+       node = node->next)
     {
-      next_node_to_del = cur_del_node->next;
-      free_node (cur_del_node, *ptr_chain);
+      const MarkovNode *markov_node = node->data;
+      usage.states++;
+      usage.edges += markov_node->frequencies_list_size;
+      usage.node_bytes += sizeof (Node) + sizeof (MarkovNode);
+      usage.edge_bytes += markov_node->frequencies_list_capacity
+                          * sizeof (MarkovNodeFrequency);
+      if (in_arena)
+        {
+          // the cumulative frequencies share the list's block.
+          usage.edge_bytes += markov_node->frequencies_list_capacity
+                              * sizeof (unsigned int);
+        }
+      else if (markov_node->cumulative_frequencies != NULL)
+        {
+          usage.edge_bytes += markov_node->frequencies_list_size
+                              * sizeof (unsigned int);
+          usage.allocations++;
+        }
+      if (markov_node->edge_index != NULL)
+        {
+          usage.edge_bytes += sizeof (EdgeIndex)
+                              + ((size_t) 1
+                                 << markov_node->edge_index->capacity_bits)
+                                * sizeof (int);
+          usage.allocations += !in_arena;
+        }
+      if (!markov_chain->borrow_states && markov_chain->size_func != NULL)
+        {
+          usage.state_bytes += markov_chain->size_func (markov_node->data);
+        }
+      if (!in_arena)
+        {
+          // the Node, the MarkovNode, the list and the copied state.
+          usage.allocations += 2 + (markov_node->frequencies_list != NULL)
+                               + !markov_chain->borrow_states;
+        }
+    }
 
-      cur_del_node = next_node_to_del;
+  if (markov_chain->index != NULL)
+    {
+      usage.index_bytes += sizeof (HashIndex) + markov_chain->index->capacity
+                                                * (sizeof (Node *)
+                                                   + sizeof (unsigned long));
+      usage.allocations += 3;
     }
+  if (markov_chain->dense_nodes != NULL)
+    {
+      usage.index_bytes += (markov_chain->key_count + 1) * sizeof (Node *);
+      usage.allocations++;
+    }
+  if (markov_chain->start_nodes != NULL)
+    {
+      usage.index_bytes += markov_chain->start_nodes_capacity
+                           * sizeof (MarkovNode *);
+      usage.allocations++;
+    }
+  if (markov_chain->start_sampler.size != 0)
+    {
+      usage.index_bytes += 2 * markov_chain->start_sampler.size
+                           * sizeof (uint32_t);
+      usage.allocations += 2;
+    }
+  if (in_arena)
+    {
+      size_t slab_count;
+      size_t reserved = arena_reserved_bytes (markov_chain->arena,
+                                              &slab_count);
+      size_t carved = usage.node_bytes + usage.edge_bytes + usage.state_bytes;
+      usage.unused_bytes = (reserved > carved) ? reserved - carved : 0;
+      usage.allocations += 1 + slab_count;
+    }
+  return usage;
 }
 
 MarkovNode *get_first_random_node (MarkovChain *markov_chain)
+{
+  return get_first_random_node_with_stream (markov_chain,
+                                            random_stream_default ());
+}
+
+MarkovNode *get_first_random_node_with_stream (MarkovChain *markov_chain,
+                                               RandomStream *stream)
 {
   if (markov_chain == NULL)
     {
       return NULL;
     }
+  if (!markov_chain->start_nodes_ready
+      && !markov_chain_build_start_table (markov_chain))
+    {
+      return NULL;
+    }
+  if (markov_chain->start_nodes_size == 0)
+    {
+      return NULL;
+    }
+
+  if (markov_chain->start_sampler.size != 0)
+    {
+      return markov_chain->start_nodes[alias_table_sample
+          (&markov_chain->start_sampler, stream)];
+    }
+  return markov_chain->start_nodes[random_stream_below
+      (stream, (uint32_t) markov_chain->start_nodes_size)];
+}
 
-  Node *node;
-  int max_bound;
-  int desired_index;
+/**
+ * @return true if the node may start a sequence of the chain.
+ */
+static bool is_start_node (const MarkovChain *markov_chain,
+                           const MarkovNode *markov_node)
+{
+  if (!markov_chain->is_last (markov_node->data))
+    {
+      return false;
+    }
+  return !markov_chain->weighted_start || markov_node->start_frequency > 0;
+}
+
+/**
+ * build the alias table of a weighted start over the start states.
+ * @return true on success, false in case of allocation error.
+ */
+static bool build_start_sampler (MarkovChain *markov_chain)
+{
+  alias_table_free (&markov_chain->start_sampler);
+  if (!markov_chain->weighted_start || markov_chain->start_nodes_size == 0)
+    {
+      return true;
+    }
+  uint32_t *weights = malloc (markov_chain->start_nodes_size
+                              * sizeof (uint32_t));
+  if (weights == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  for (int i = 0; i < markov_chain->start_nodes_size; i++)
+    {
+      weights[i] = markov_chain->start_nodes[i]->start_frequency;
+    }
+  bool built = alias_table_build (&markov_chain->start_sampler, weights,
+                                  markov_chain->start_nodes_size);
+  free (weights);
+  if (!built)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  return true;
+}
 
-  while (true)
+/**
+ * append the changed nodes that may now start a sequence to the start
+ * table, in the order they changed.
+ * @return true on success, false in case of allocation error.
+ */
+static bool update_start_nodes (MarkovChain *markov_chain)
+{
+  for (MarkovNode *markov_node = markov_chain->changed_first;
+       markov_node != NULL; markov_node = markov_node->next_changed)
     {
-      node = markov_chain->database->first;
-      max_bound = markov_chain->database->size;
-      desired_index = get_random_number (max_bound);
+      if (markov_node->in_start_table
+          || !is_start_node (markov_chain, markov_node))
+        {
+          continue;
+        }
+      if (markov_chain->start_nodes_size
+          == markov_chain->start_nodes_capacity)
+        {
+          int capacity = markov_chain->start_nodes_capacity * 2;
+          MarkovNode **start_nodes = realloc (markov_chain->start_nodes,
+                                              capacity
+                                              * sizeof (MarkovNode *));
+          if (start_nodes == NULL)
+            {
+              fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+              return false;
+            }
+          markov_chain->start_nodes = start_nodes;
+          markov_chain->start_nodes_capacity = capacity;
+        }
+      markov_chain->start_nodes[markov_chain->start_nodes_size++] =
+          markov_node;
+      markov_node->in_start_table = true;
+    }
+  return true;
+}
 
-      for (int i = 0; i < desired_index; i++)
+bool markov_chain_build_start_table (MarkovChain *markov_chain)
+{
+  if (markov_chain->start_nodes != NULL)
+    {
+      // the table only grows, so it's enough to look at the changed nodes.
+      // The alias table is rebuilt when a start frequency changed.
+      bool weights_changed = !markov_chain->start_nodes_ready;
+      if (!update_start_nodes (markov_chain)
+          || (weights_changed && !build_start_sampler (markov_chain)))
         {
-          node = node->next;
+          return false;
         }
+      markov_chain->start_nodes_ready = true;
+      return true;
+    }
+
+  markov_chain->start_nodes_size = 0;
+  markov_chain->start_nodes_capacity = markov_chain->database->size + 1;
+  markov_chain->start_nodes = malloc (markov_chain->start_nodes_capacity
+                                      * sizeof (MarkovNode *));
+  if (markov_chain->start_nodes == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
 
-      if (markov_chain->is_last (node->data->data))
+  for (Node *node = markov_chain->database->first; node != NULL;
+       node = node->next)
+    {
+      node->data->in_start_table = is_start_node (markov_chain, node->data);
+      if (node->data->in_start_table)
         {
-          break;
+          markov_chain->start_nodes[markov_chain->start_nodes_size++] =
+              node->data;
         }
     }
 
-  return node->data;
+  if (!build_start_sampler (markov_chain))
+    {
+      return false;
+    }
+  markov_chain->start_nodes_ready = true;
+  return true;
+}
+
+void mark_sentence_start (MarkovChain *markov_chain, MarkovNode *markov_node)
+{
+  markov_node->start_frequency++;
+  markov_chain->start_nodes_ready = false;
+  note_changed_node (markov_chain, markov_node);
 }
 
 MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr)
+{
+  return get_next_random_node_with_stream (state_struct_ptr,
+                                           random_stream_default ());
+}
+
+MarkovNode *get_next_random_node_with_stream (MarkovNode *state_struct_ptr,
+                                              RandomStream *stream)
+{
+  if (state_struct_ptr->frequencies_list_size == 0)
+    {
+      return NULL;
+    }
+  if (state_struct_ptr->sampler_outdated)
+    {
+      return scan_next_random_node (state_struct_ptr, stream);
+    }
+
+  const unsigned int *cumulative = state_struct_ptr->cumulative_frequencies;
+  unsigned int sigma_frequencies = cumulative[state_struct_ptr
+      ->frequencies_list_size - 1];
+  unsigned int desired_index = random_stream_below (stream,
+                                                    sigma_frequencies);
+
+  // binary search for the first entry whose cumulative frequency is
+  // bigger than desired_index.
+  int low = 0;
+  int high = state_struct_ptr->frequencies_list_size - 1;
+  while (low < high)
+    {
+      int middle = low + (high - low) / 2;
+      if (cumulative[middle] > desired_index)
+        {
+          high = middle;
+        }
+      else
+        {
+          low = middle + 1;
+        }
+    }
+  return state_struct_ptr->frequencies_list[low].markov_node;
+}
+
+/**
+ * choose the next state of a node whose sampler is outdated, with a linear
+ * scan over its frequencies (no allocation, the node is not changed).
+ */
+static MarkovNode *scan_next_random_node (const MarkovNode *markov_node,
+                                          RandomStream *stream)
 {
   int sigma_frequencies = 0;
-  // creat sigma_frequencies.
-  for (int j = 0; j < state_struct_ptr->frequencies_list_size; j++)
+  for (int i = 0; i < markov_node->frequencies_list_size; i++)
     {
-      sigma_frequencies += state_struct_ptr->frequencies_list[j].frequency;
+      sigma_frequencies += markov_node->frequencies_list[i].frequency;
     }
 
-  // save a pointer to an array of pointers to MarkovNode.
-  MarkovNode **rank = calloc (sigma_frequencies, sizeof (void *));
-  if (rank == NULL)
+  int desired_index = (int) random_stream_below
+      (stream, (uint32_t) sigma_frequencies);
+  int i = 0;
+  while (desired_index >= markov_node->frequencies_list[i].frequency)
     {
-      return NULL;
+      desired_index -= markov_node->frequencies_list[i].frequency;
+      i++;
+    }
+  return markov_node->frequencies_list[i].markov_node;
+}
+
+bool build_node_sampler (MarkovNode *markov_node, MarkovChain *markov_chain)
+{
+  if (markov_node->frequencies_list_size == 0)
+    {
+      markov_node->sampler_outdated = false;
+      return true;
     }
 
-  MarkovNode *temp_node = state_struct_ptr;
-  int counter = 0;
-  for (int i = 0; i < temp_node->frequencies_list_size; i++)
+  unsigned int *cumulative = markov_node->cumulative_frequencies;
+  if (markov_chain->arena == NULL)
     {
-      for (int k = 0; k < temp_node->frequencies_list[i].frequency; k++)
+      // in arena mode the list already has room for its cumulative
+      // frequencies, see grow_frequencies_list.
+      MARKOV_STATS_ALLOCATION (markov_node->frequencies_list_size
+                               * sizeof (unsigned int));
+      cumulative = realloc (cumulative, markov_node->frequencies_list_size
+                                        * sizeof (unsigned int));
+      if (cumulative == NULL)
         {
-          rank[k + counter] = temp_node->frequencies_list[i].markov_node;
+          fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+          return false;
         }
-      counter += temp_node->frequencies_list[i].frequency;
     }
 
-  // get random number.
-  int desired_index = get_random_number (sigma_frequencies);
-  MarkovNode *node = rank[desired_index];
-  free (rank);
-  return node;
+  unsigned int sigma_frequencies = 0;
+  for (int i = 0; i < markov_node->frequencies_list_size; i++)
+    {
+      sigma_frequencies += markov_node->frequencies_list[i].frequency;
+      cumulative[i] = sigma_frequencies;
+    }
+  markov_node->cumulative_frequencies = cumulative;
+  markov_node->sampler_outdated = false;
+  return true;
+}
+
+bool markov_chain_finish_training (MarkovChain *markov_chain)
+{
+  if (markov_chain == NULL)
+    {
+      return false;
+    }
+
+  for (MarkovNode *markov_node = markov_chain->changed_first;
+       markov_node != NULL; markov_node = markov_node->next_changed)
+    {
+      if (markov_node->sampler_outdated
+          && !build_node_sampler (markov_node, markov_chain))
+        {
+          return false;
+        }
+    }
+  if (!markov_chain_build_start_table (markov_chain))
+    {
+      return false;
+    }
+  if (markov_chain->frozen != NULL
+      && !frozen_chain_update (markov_chain->frozen, markov_chain))
+    {
+      return false;
+    }
+  clear_changed_nodes (markov_chain);
+  return true;
+}
+
+bool markov_chain_merge_states (MarkovChain *markov_chain,
+                                const MarkovChain *other,
+                                Node **merged_nodes)
+{
+  for (Node *node = other->database->first; node != NULL; node = node->next)
+    {
+      Node *merged = add_to_database (markov_chain, node->data->data);
+      if (merged == NULL)
+        {
+          return false;
+        }
+      merged_nodes[node->data->index] = merged;
+      if (node->data->start_frequency > 0)
+        {
+          merged->data->start_frequency += node->data->start_frequency;
+          markov_chain->start_nodes_ready = false;
+          note_changed_node (markov_chain, merged->data);
+        }
+    }
+  return true;
+}
+
+bool markov_chain_merge_frequencies (MarkovChain *markov_chain,
+                                     const MarkovChain *other,
+                                     Node **merged_nodes)
+{
+  for (Node *node = other->database->first; node != NULL; node = node->next)
+    {
+      MarkovNode *from_node = merged_nodes[node->data->index]->data;
+      for (int i = 0; i < node->data->frequencies_list_size; i++)
+        {
+          const MarkovNodeFrequency *edge = &node->data->frequencies_list[i];
+          MarkovNode *to_node = merged_nodes[edge->markov_node->index]->data;
+          if (!add_weighted_node_to_frequencies_list (from_node, to_node,
+                                                      markov_chain,
+                                                      edge->frequency))
+            {
+              return false;
+            }
+        }
+    }
+  return true;
+}
+
+bool markov_chain_freeze (MarkovChain *markov_chain)
+{
+  if (markov_chain == NULL)
+    {
+      return false;
+    }
+  if (markov_chain->compacted)
+    {
+      fprintf (stdout, ERR_MSG_FROZEN_COMPACTED);
+      return false;
+    }
+
+  if (!markov_chain->start_nodes_ready
+      && !markov_chain_build_start_table (markov_chain))
+    {
+      return false;
+    }
+  FrozenChain *frozen = frozen_chain_build (markov_chain);
+  if (frozen == NULL)
+    {
+      return false;
+    }
+  frozen_chain_free (markov_chain->frozen);
+  markov_chain->frozen = frozen;
+  return true;
+}
+
+bool markov_chain_save (MarkovChain *markov_chain, const char *path)
+{
+  if (markov_chain == NULL)
+    {
+      return false;
+    }
+  if (markov_chain->frozen == NULL && !markov_chain_freeze (markov_chain))
+    {
+      return false;
+    }
+  return snapshot_save (markov_chain->frozen, path);
 }
 
-void generate_tweet (MarkovChain *markov_chain, MarkovNode *
+bool markov_chain_load (MarkovChain *markov_chain, const char *path)
+{
+  if (markov_chain == NULL)
+    {
+      return false;
+    }
+  FrozenChain *frozen = snapshot_load (path, markov_chain->check_func);
+  if (frozen == NULL)
+    {
+      return false;
+    }
+  if (frozen->state_kind != markov_chain->state_kind)
+    {
+      frozen_chain_free (frozen);
+      fprintf (stdout, ERR_MSG_SNAPSHOT_STATE_KIND);
+      return false;
+    }
+  frozen_chain_free (markov_chain->frozen);
+  markov_chain->frozen = frozen;
+  return true;
+}
+
+bool generate_tweet (MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length)
 {
+  return generate_tweet_with_stream (markov_chain, first_node, max_length,
+                                     random_stream_default ());
+}
+
+bool generate_tweet_with_stream (MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomStream *stream)
+{
+  OutputBuffer buffer;
+  output_buffer_init (&buffer, stdout);
+  bool ans = generate_tweet_to_buffer (markov_chain, first_node, max_length,
+                                       stream, &buffer);
+  output_buffer_flush (&buffer);
+  output_buffer_free (&buffer);
+  return ans;
+}
+
+void append_state_to_buffer (const MarkovChain *markov_chain,
+                             const void *data, OutputBuffer *buffer)
+{
+  if (markov_chain->append_func != NULL)
+    {
+      markov_chain->append_func (data, buffer);
+      return;
+    }
+  output_buffer_flush (buffer);
+  markov_chain->print_func (data);
+}
+
+bool generate_tweet_to_buffer (MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomStream *stream, OutputBuffer *buffer)
+{
+  if (markov_chain != NULL && markov_chain->frozen != NULL)
+    {
+      return generate_frozen_tweet (markov_chain, markov_chain->frozen,
+                                    first_node != NULL
+                                    ? (uint32_t) first_node->index
+                                    : FROZEN_NO_NODE, max_length, stream,
+                                    buffer);
+    }
   if (first_node == NULL)
     {
       if (markov_chain == NULL)
         {
-          return;
+          return false;
+        }
+      MARKOV_STATS_PHASE (MARKOV_PHASE_SAMPLE);
+      first_node = get_first_random_node_with_stream (markov_chain,
+                                                      stream);
+      MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+      if (first_node == NULL)
+        {
+          return false;
         }
-      first_node = get_first_random_node (markov_chain);
     }
   MarkovNode *twit_node = first_node;
   int cur_length = 1;
 
-  // printing the twit word by word.
+  // rendering the twit word by word.
   while ((cur_length < max_length))
     {
-      markov_chain->print_func (twit_node->data);
-      printf (" ");
+      MARKOV_STATS_PHASE (MARKOV_PHASE_PRINT);
+      append_state_to_buffer (markov_chain, twit_node->data, buffer);
+      output_buffer_append_char (buffer, ' ');
 
-      if ((twit_node = get_next_random_node (twit_node)) == NULL)
+      MARKOV_STATS_PHASE (MARKOV_PHASE_SAMPLE);
+      MarkovNode *next_node = get_next_random_node_with_stream (twit_node,
+                                                                stream);
+      if (next_node == NULL)
         {
-          return; // check in forom.
+          // a state without successors ends the twit.
+          output_buffer_append_char (buffer, '\n');
+          MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+          return true;
         }
+      twit_node = next_node;
       cur_length++;
       if (!markov_chain->is_last (twit_node->data))
         {
           break;
         }
     }
-  // printing the twit-last word.
-  if (markov_chain->is_last (twit_node->data))
-    {
-      if (cur_length < MAX_LENGTH_FOR_TWEET)
-        {
-          markov_chain->print_func (twit_node->data);
-          printf ("\n");
-          return;
-        }
-    }
-  markov_chain->print_func (twit_node->data);
-  printf ("\n");
+  // rendering the twit-last word.
+  MARKOV_STATS_PHASE (MARKOV_PHASE_PRINT);
+  append_state_to_buffer (markov_chain, twit_node->data, buffer);
+  output_buffer_append_char (buffer, '\n');
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  return true;
 }
 
 
@@ -234,7 +989,13 @@ first_node, int max_length)
 
 int get_random_number (int max_number)
 {
-  return rand () % (max_number);
+  return (int) random_stream_below (random_stream_default (),
+                                    (uint32_t) max_number);
+}
+
+void set_random_seed (unsigned int seed)
+{
+  random_stream_seed_default (seed);
 }
 
 MarkovNode *create_new_markov_node (void *data_ptr, MarkovChain *markov_chain)
@@ -247,6 +1008,11 @@ MarkovNode *create_new_markov_node (void *data_ptr, MarkovChain *markov_chain)
     {
       return NULL;
     }
+  if (markov_chain->arena != NULL)
+    {
+      return create_arena_markov_node (data_ptr, markov_chain);
+    }
+  MARKOV_STATS_ALLOCATION (sizeof (MarkovNode));
   MarkovNode *new_markov_node = malloc (sizeof (MarkovNode));
   if (new_markov_node == NULL)
     {
@@ -254,16 +1020,228 @@ MarkovNode *create_new_markov_node (void *data_ptr, MarkovChain *markov_chain)
       return NULL;
     }
 
-  new_markov_node->data = markov_chain->copy_func (data_ptr);
+  if (!markov_chain->borrow_states)
+    {
+      MARKOV_STATS_ALLOCATION (markov_chain->size_func != NULL
+                               ? markov_chain->size_func (data_ptr) : 0);
+    }
+  new_markov_node->data = markov_chain->borrow_states
+                          ? data_ptr : markov_chain->copy_func (data_ptr);
   if (new_markov_node->data == NULL)
     {
       free (new_markov_node);
       fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
       return NULL;
     }
+  init_markov_node (new_markov_node, markov_chain);
+  return new_markov_node;
+}
+
+/**
+ * this function creates a Markov Node, and the copy of its state, in the
+ * arena of the chain.
+ */
+static MarkovNode *create_arena_markov_node (void *data_ptr,
+                                             MarkovChain *markov_chain)
+{
+  MarkovNode *new_markov_node = arena_alloc (markov_chain->arena,
+                                             sizeof (MarkovNode));
+  void *data = data_ptr;
+  if (!markov_chain->borrow_states)
+    {
+      size_t data_size = markov_chain->size_func (data_ptr);
+      data = arena_alloc (markov_chain->arena, data_size);
+      if (data != NULL)
+        {
+          memcpy (data, data_ptr, data_size);
+        }
+    }
+  if (new_markov_node == NULL || data == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return NULL;
+    }
+  new_markov_node->data = data;
+  init_markov_node (new_markov_node, markov_chain);
+  return new_markov_node;
+}
+
+/**
+ * set all the fields of a new Markov Node, except for its data.
+ */
+static void init_markov_node (MarkovNode *new_markov_node,
+                              const MarkovChain *markov_chain)
+{
   new_markov_node->frequencies_list_size = 0;
+  new_markov_node->frequencies_list_capacity = 0;
+  new_markov_node->edge_index = NULL;
+  new_markov_node->index = markov_chain->database->size;
+  new_markov_node->start_frequency = 0;
   new_markov_node->frequencies_list = NULL;
-  return new_markov_node;
+  new_markov_node->cumulative_frequencies = NULL;
+  new_markov_node->sampler_outdated = true;
+  new_markov_node->changed = false;
+  new_markov_node->next_changed = NULL;
+  new_markov_node->in_start_table = false;
+}
+
+/**
+ * add a node to the chain's list of changed nodes, if it's not there yet.
+ */
+static void note_changed_node (MarkovChain *markov_chain,
+                               MarkovNode *markov_node)
+{
+  if (markov_node->changed)
+    {
+      return;
+    }
+  markov_node->changed = true;
+  if (markov_chain->changed_last == NULL)
+    {
+      markov_chain->changed_first = markov_node;
+    }
+  else
+    {
+      markov_chain->changed_last->next_changed = markov_node;
+    }
+  markov_chain->changed_last = markov_node;
+}
+
+/**
+ * empty the chain's list of changed nodes.
+ */
+static void clear_changed_nodes (MarkovChain *markov_chain)
+{
+  MarkovNode *markov_node = markov_chain->changed_first;
+  while (markov_node != NULL)
+    {
+      MarkovNode *next = markov_node->next_changed;
+      markov_node->changed = false;
+      markov_node->next_changed = NULL;
+      markov_node = next;
+    }
+  markov_chain->changed_first = NULL;
+  markov_chain->changed_last = NULL;
+}
+
+/**
+ * this function makes room for one more entry in the frequencies list of
+ * markov_node (the list size is not changed). The capacity is doubled when
+ * the list is full, so adding n successors moves O(n) entries in total.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool grow_frequencies_list (MarkovNode *markov_node,
+                                   MarkovChain *markov_chain)
+{
+  int size = markov_node->frequencies_list_size;
+  if (size < markov_node->frequencies_list_capacity)
+    {
+      return true;
+    }
+  return resize_frequencies_list (markov_node, (size == 0) ? 1 : size * 2,
+                                  markov_chain);
+}
+
+bool reserve_frequencies_list (MarkovNode *markov_node, int capacity,
+                               MarkovChain *markov_chain)
+{
+  if (capacity <= markov_node->frequencies_list_capacity)
+    {
+      return true;
+    }
+  if (!resize_frequencies_list (markov_node, capacity, markov_chain))
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * move the frequencies list of markov_node to a block with room for
+ * capacity entries, at least its size.
+ * @return true on success, false in case of allocation failure.
+ */
+static bool resize_frequencies_list (MarkovNode *markov_node, int capacity,
+                                     MarkovChain *markov_chain)
+{
+  int size = markov_node->frequencies_list_size;
+  MARKOV_STATS_ADD (frequencies_reallocs, 1);
+  MARKOV_STATS_ADD (frequencies_realloc_bytes,
+                    capacity * sizeof (MarkovNodeFrequency));
+  if (markov_chain->arena == NULL)
+    {
+      MARKOV_STATS_ALLOCATION (capacity * sizeof (MarkovNodeFrequency));
+      MarkovNodeFrequency *mnf_ptr = realloc (markov_node->frequencies_list,
+                                              capacity
+                                              * sizeof (MarkovNodeFrequency));
+      if (mnf_ptr == NULL)
+        {
+          return false;
+        }
+      markov_node->frequencies_list = mnf_ptr;
+      markov_node->frequencies_list_capacity = capacity;
+      return true;
+    }
+
+  // in the arena the cumulative frequencies live in the same block, right
+  // after the list.
+  MarkovNodeFrequency *mnf_ptr = arena_alloc
+      (markov_chain->arena, capacity * (sizeof (MarkovNodeFrequency)
+                                        + sizeof (unsigned int)));
+  if (mnf_ptr == NULL)
+    {
+      return false;
+    }
+  if (size != 0)
+    {
+      memcpy (mnf_ptr, markov_node->frequencies_list,
+              size * sizeof (MarkovNodeFrequency));
+    }
+  markov_node->frequencies_list = mnf_ptr;
+  markov_node->frequencies_list_capacity = capacity;
+  markov_node->cumulative_frequencies = (unsigned int *) (mnf_ptr + capacity);
+  markov_node->sampler_outdated = true;
+  note_changed_node (markov_chain, markov_node);
+  return true;
+}
+
+bool markov_chain_use_arena (MarkovChain *markov_chain)
+{
+  if (markov_chain == NULL || markov_chain->size_func == NULL
+      || markov_chain->database->size != 0 || markov_chain->arena != NULL)
+    {
+      return false;
+    }
+  markov_chain->arena = arena_create (ARENA_DEFAULT_SLAB_SIZE);
+  if (markov_chain->arena == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  return true;
+}
+
+bool markov_chain_use_dense_keys (MarkovChain *markov_chain,
+                                  key_func_t key_func, size_t key_count,
+                                  bool borrow_states)
+{
+  if (markov_chain == NULL || key_func == NULL
+      || markov_chain->database->size != 0
+      || markov_chain->dense_nodes != NULL)
+    {
+      return false;
+    }
+  markov_chain->dense_nodes = calloc (key_count + 1, sizeof (Node *));
+  if (markov_chain->dense_nodes == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return false;
+    }
+  markov_chain->key_func = key_func;
+  markov_chain->key_count = key_count;
+  markov_chain->borrow_states = borrow_states;
+  return true;
 }
 
 /**
@@ -277,9 +1255,16 @@ void free_node (Node *cur_del_node, MarkovChain *markov_chain)
   // freeing the frequencies_list.
   free (cur_del_node->data->frequencies_list);
   cur_del_node->data->frequencies_list = NULL;
+  free (cur_del_node->data->cumulative_frequencies);
+  cur_del_node->data->cumulative_frequencies = NULL;
+  free (cur_del_node->data->edge_index);
+  cur_del_node->data->edge_index = NULL;
 
   // freeing the string.
-  markov_chain->free_data (cur_del_node->data->data);
+  if (!markov_chain->borrow_states)
+    {
+      markov_chain->free_data (cur_del_node->data->data);
+    }
   cur_del_node->data->data = NULL;
 
   // freeing the data.
@@ -288,4 +1273,77 @@ void free_node (Node *cur_del_node, MarkovChain *markov_chain)
 
   // freeing the main node that is holding all the data.
   free (cur_del_node);
-}
\ No newline at end of file
+}
+
+/**
+ * this function frees everything the chain holds for training: the nodes
+ * with their states and lists, the lookup tables and the start table. The
+ * frozen form is kept, and the database is left empty.
+ */
+static void release_training_state (MarkovChain *markov_chain)
+{
+  if (markov_chain->arena != NULL)
+    {
+      // everything the nodes own was carved from the arena's slabs.
+      arena_free (markov_chain->arena);
+      markov_chain->arena = NULL;
+    }
+  else
+    {
+      // defining all the needed Node's.
+      Node *cur_del_node = markov_chain->database->first;
+      Node *next_node_to_del;
+
+      while (cur_del_node != NULL)
+        {
+          next_node_to_del = cur_del_node->next;
+          free_node (cur_del_node, markov_chain);
+
+          cur_del_node = next_node_to_del;
+        }
+    }
+  markov_chain->database->first = NULL;
+  markov_chain->database->last = NULL;
+  markov_chain->database->size = 0;
+
+  hash_index_free (markov_chain->index);
+  markov_chain->index = NULL;
+  free (markov_chain->dense_nodes);
+  markov_chain->dense_nodes = NULL;
+  free (markov_chain->start_nodes);
+  markov_chain->start_nodes = NULL;
+  markov_chain->start_nodes_size = 0;
+  markov_chain->start_nodes_capacity = 0;
+  markov_chain->start_nodes_ready = false;
+  markov_chain->changed_first = NULL;
+  markov_chain->changed_last = NULL;
+  alias_table_free (&markov_chain->start_sampler);
+}
+
+/**
+ * this function creates the hash index of the chain and indexes the states
+ * that are already in the database.
+ * @return the new index, NULL in case of allocation failure.
+ */
+static HashIndex *create_database_index (MarkovChain *markov_chain)
+{
+  HashIndex *index = hash_index_create ();
+  if (index == NULL)
+    {
+      fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+      return NULL;
+    }
+
+  for (Node *node = markov_chain->database->first; node != NULL;
+       node = node->next)
+    {
+      if (hash_index_insert (index, markov_chain->hash_func
+          (node->data->data), node) != 0)
+        {
+          hash_index_free (index);
+          fprintf (stdout, ERR_MSG_ALLOCATION_FAILURE);
+          return NULL;
+        }
+    }
+  return index;
+}
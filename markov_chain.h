@@ -2,6 +2,14 @@
 #define _MARKOV_CHAIN_H
 
 #include "linked_list.h"
+#include "hash_index.h"
+#include "frozen_chain.h"
+#include "chain_pruning.h"
+#include "arena.h"
+#include "alias_table.h"
+#include "random_stream.h"
+#include "output_buffer.h"
+#include "markov_stats.h"
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For exit(), malloc()
 #include <stdbool.h> // for bool
@@ -9,6 +17,9 @@
 #define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate" \
 " new memory\n"
 
+#define ERR_MSG_FROZEN_COMPACTED \
+  "Error: a compacted chain can't be trained.\n"
+
 
 /***************************/
 /*   insert typedefs here  */
@@ -19,6 +30,11 @@ typedef int (*comp_func_t) (const void *, const void *);
 typedef void (*free_data_t) (void *);
 typedef void *(*copy_func_t) (const void *);
 typedef bool(*is_last_t) (const void *);
+typedef unsigned long (*hash_func_t) (const void *);
+typedef size_t (*size_func_t) (const void *);
+typedef void (*append_func_t) (const void *, OutputBuffer *);
+typedef size_t (*key_func_t) (const void *);
+typedef void (*pack_func_t) (const void *, void *);
 /***************************/
 
 
@@ -28,6 +44,11 @@ typedef bool(*is_last_t) (const void *);
 /***************************/
 
 struct MarkovNodeFrequency;
+struct EdgeIndex;
+
+// nodes with at least this many successors look them up in an edge index
+// instead of scanning their frequencies list.
+#define EDGE_INDEX_MIN_DEGREE 16
 
 typedef struct MarkovNode {
 
@@ -36,6 +57,36 @@ typedef struct MarkovNode {
     struct MarkovNodeFrequency *frequencies_list;
 
     int frequencies_list_size;
+
+    // amount of entries frequencies_list has room for, doubled when full.
+    int frequencies_list_capacity;
+
+    // for nodes with EDGE_INDEX_MIN_DEGREE successors or more: open
+    // addressing table from a successor to its entry in frequencies_list.
+    // NULL for the rest, which scan the list.
+    struct EdgeIndex *edge_index;
+
+    // position of the node in the chain's database.
+    int index;
+
+    // how many times the state started a sentence in the training data.
+    unsigned int start_frequency;
+
+    // running sums of the frequencies in frequencies_list, used to sample
+    // the next state with a binary search.
+    unsigned int *cumulative_frequencies;
+
+    // true when frequencies_list changed since cumulative_frequencies was
+    // last built.
+    bool sampler_outdated;
+
+    // true while the node is in the chain's list of changed nodes, which
+    // continues at next_changed.
+    bool changed;
+    struct MarkovNode *next_changed;
+
+    // true when the node is in the chain's start_nodes.
+    bool in_start_table;
 }
     MarkovNode;
 
@@ -47,7 +98,7 @@ typedef struct MarkovNodeFrequency {
 }
     MarkovNodeFrequency;
 
-/* DO NOT ADD or CHANGE variable names in this struct */
+/* DO NOT CHANGE the original variable names in this struct */
 typedef struct MarkovChain {
 
     LinkedList *database;
@@ -84,23 +135,193 @@ typedef struct MarkovChain {
     // - false otherwise.
 
     is_last_t is_last;
+
+    // optional: a pointer to a function that gets a pointer of generic data
+    // type and returns its hash value. Equal states (by comp_func) must
+    // have equal hashes. When NULL, states are looked up by walking the
+    // database list.
+
+    hash_func_t hash_func;
+
+    // hash index over the database, maintained by add_to_database when
+    // hash_func is set. Should be initialized to NULL.
+
+    HashIndex *index;
+
+    // optional: a pointer to a function that gets a pointer of generic data
+    // type and returns the size in bytes of its flat representation. The
+    // state must not hold pointers, since it is copied byte by byte when
+    // the chain is frozen.
+
+    size_func_t size_func;
+
+    // read-only CSR form of the chain, created by markov_chain_freeze.
+    // When set, generation runs on it. Should be initialized to NULL.
+
+    FrozenChain *frozen;
+
+    // optional bump allocator, created by markov_chain_use_arena. When
+    // set, nodes, list cells, copied states and frequencies lists are
+    // carved from it, and free_database releases it slab by slab.
+    // Should be initialized to NULL.
+
+    Arena *arena;
+
+    // when true, sequences start from states that started a sentence in
+    // the training data, with probability proportional to their
+    // start_frequency. Otherwise every state that is not last may start a
+    // sequence, uniformly.
+
+    bool weighted_start;
+
+    // the states a sequence may start from, and when the start is weighted
+    // an alias table over them. Built by markov_chain_build_start_table,
+    // start_nodes_ready is cleared when states are added. Should be
+    // initialized to NULL / 0 / false.
+
+    MarkovNode **start_nodes;
+    int start_nodes_size;
+    int start_nodes_capacity;
+    AliasTable start_sampler;
+    bool start_nodes_ready;
+
+    // optional: a pointer to a function that gets a pointer of generic data
+    // type and appends what print_func prints to an output buffer, so
+    // sequences can be rendered without stdio. Must not use shared state,
+    // since sequences may be rendered by several threads.
+
+    append_func_t append_func;
+
+    // optional dense key mode, set by markov_chain_use_dense_keys: key_func
+    // maps every state to its key, 0 .. key_count - 1 (equal states to
+    // the same key), and the node of a state is dense_nodes[key], so no
+    // comp_func or hash_func is used. When borrow_states is set the nodes
+    // point to the caller's states instead of copies, and the states must
+    // outlive the chain. Should be initialized to NULL / 0 / false.
+
+    key_func_t key_func;
+    Node **dense_nodes;
+    size_t key_count;
+    bool borrow_states;
+
+    // the nodes that were added, or whose successors or start frequency
+    // changed, since the last markov_chain_finish_training, in the order
+    // they first changed. The samplers, the start table and the frozen form
+    // are updated for these nodes only. Should be initialized to NULL.
+
+    MarkovNode *changed_first;
+    MarkovNode *changed_last;
+
+    // optional, for states that point to memory of their own, like token
+    // views (see markov_chain_view.h): flat_size_func gives the size of the
+    // flat form of a state and pack_func writes it there, and the frozen
+    // form holds the flat forms instead of copies of the states. print_func
+    // and append_func then get flat forms, so such a chain generates from
+    // its frozen form only. Should be initialized to NULL.
+
+    size_func_t flat_size_func;
+    pack_func_t pack_func;
+
+    // set by markov_chain_compact, once the training state was released:
+    // the chain then finds no states, and refuses to add or freeze any.
+    // Should be initialized to false.
+
+    bool compacted;
+
+    // optional, what the states are, as the application numbers them (for
+    // example their type and order). It is kept in the frozen form and in
+    // snapshots, and markov_chain_load refuses a snapshot of another kind.
+    // Should be initialized to 0.
+
+    uint32_t state_kind;
+
+    // optional, for states with a flat form (see pack_func): a pointer to
+    // a function that checks a flat form loaded from a snapshot, so that
+    // print_func and append_func never read past it. Should be initialized
+    // to NULL.
+
+    check_func_t check_func;
 }
     MarkovChain;
 
 /**
- * Get one random state from the given markov_chain's database.
+ * Get one random state that a sequence may start from (see
+ * weighted_start), in O(1). The start table is rebuilt first if states were
+ * added since it was last built.
  * @param markov_chain
- * @return
+ * @return the chosen MarkovNode, NULL if no state may start a sequence or
+ * in case of allocation error.
  */
 MarkovNode *get_first_random_node (MarkovChain *markov_chain);
 
+/**
+ * Same as get_first_random_node, drawing from the given stream.
+ * @param markov_chain
+ * @param stream the stream to draw from
+ * @return the chosen MarkovNode, NULL if no state may start a sequence or
+ * in case of allocation error.
+ */
+MarkovNode *get_first_random_node_with_stream (MarkovChain *markov_chain,
+                                               RandomStream *stream);
+
+/**
+ * Build the table of the states a sequence may start from, used by
+ * get_first_random_node and copied by markov_chain_freeze. Once built, the
+ * table is updated in place: the changed nodes that may now start a
+ * sequence are appended to it, and the alias table of a weighted start is
+ * rebuilt over the start states if their frequencies changed.
+ * @param markov_chain the trained chain
+ * @return true on success, false in case of allocation error.
+ */
+bool markov_chain_build_start_table (MarkovChain *markov_chain);
+
+/**
+ * Count one more occurrence of a state at the start of a sentence.
+ * @param markov_chain the chain the node belongs to
+ * @param markov_node the node that started a sentence
+ */
+void mark_sentence_start (MarkovChain *markov_chain, MarkovNode *markov_node);
+
 /**
  * Choose randomly the next state, depend on it's occurrence frequency.
+ * If the node's sampler is outdated, the frequencies are scanned instead.
+ * The node is never changed.
  * @param state_struct_ptr MarkovNode to choose from
- * @return MarkovNode of the chosen state
+ * @return MarkovNode of the chosen state, NULL if the state has no
+ * successors.
  */
 MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr);
 
+/**
+ * Same as get_next_random_node, drawing from the given stream.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param stream the stream to draw from
+ * @return MarkovNode of the chosen state, NULL if the state has no
+ * successors.
+ */
+MarkovNode *get_next_random_node_with_stream (MarkovNode *state_struct_ptr,
+                                              RandomStream *stream);
+
+/**
+ * (Re)build the cumulative frequencies used by get_next_random_node.
+ * @param markov_node the node to build the sampler of
+ * @param markov_chain the chain the node belongs to
+ * @return true on success, false in case of allocation error.
+ */
+bool build_node_sampler (MarkovNode *markov_node, MarkovChain *markov_chain);
+
+/**
+ * Prepare a trained chain for generation: build the sampler of every node
+ * that changed since the last call, and the start table, so generating
+ * does not allocate. A chain that was frozen may be trained further, and
+ * this call then updates its frozen form in place too, for the changed
+ * nodes only; so after training on more text, the cost is proportional
+ * to the new text and not to the whole corpus.
+ * @param markov_chain the trained chain
+ * @return true on success, false in case of allocation error.
+ */
+bool markov_chain_finish_training (MarkovChain *markov_chain);
+
 /**
  * Receive markov_chain, generate and print random sentence out of it. The
  * sentence most have at least 2 words in it.
@@ -108,10 +329,148 @@ MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr);
  * @param first_node markov_node to start with, if NULL- choose a random
  * markov_node
  * @param  max_length maximum length of chain to generate
+ * @return false if first_node is NULL and no state may start a sequence,
+ * true otherwise.
  */
-void generate_tweet (MarkovChain *markov_chain, MarkovNode *
+bool generate_tweet (MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length);
 
+/**
+ * Same as generate_tweet, drawing from the given stream. Sequences drawn
+ * from streams of their own (see random_stream_init) don't depend on each
+ * other, so they may be generated in any order, or concurrently once the
+ * chain is frozen.
+ * @param markov_chain
+ * @param first_node markov_node to start with, if NULL- choose a random
+ * markov_node
+ * @param max_length maximum length of chain to generate
+ * @param stream the stream to draw from
+ * @return false if first_node is NULL and no state may start a sequence,
+ * true otherwise.
+ */
+bool generate_tweet_with_stream (MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomStream *stream);
+
+/**
+ * Same as generate_tweet_with_stream, rendering the sentence into an
+ * output buffer instead of printing it.
+ * @param markov_chain
+ * @param first_node markov_node to start with, if NULL- choose a random
+ * markov_node
+ * @param max_length maximum length of chain to generate
+ * @param stream the stream to draw from
+ * @param buffer the buffer to append the sentence to
+ * @return false if first_node is NULL and no state may start a sequence,
+ * true otherwise.
+ */
+bool generate_tweet_to_buffer (MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomStream *stream, OutputBuffer *buffer);
+
+/**
+ * Append one state of the chain to an output buffer, with append_func. A
+ * chain without append_func prints the state with print_func instead,
+ * after flushing the buffer, which then must have stdout as its sink.
+ * @param markov_chain the chain the state belongs to
+ * @param data the state
+ * @param buffer the buffer
+ */
+void append_state_to_buffer (const MarkovChain *markov_chain,
+                             const void *data, OutputBuffer *buffer);
+
+/**
+ * Seed the stream used by the functions that don't take one (the
+ * replacement of srand).
+ * @param seed the seed
+ */
+void set_random_seed (unsigned int seed);
+
+/**
+ * Switch an empty chain to arena allocation (see arena.h). Requires
+ * size_func, since states are copied byte by byte into the arena, and
+ * free_data is then never called.
+ * @param markov_chain the chain, before anything was added to it
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_use_arena (MarkovChain *markov_chain);
+
+/**
+ * Switch an empty chain to dense key mode (see key_func), for states that
+ * map to a dense range of integers, like the cells of a board. Looking up
+ * and adding a state are then an array access.
+ * @param markov_chain the chain, before anything was added to it
+ * @param key_func maps a state to its key
+ * @param key_count amount of keys
+ * @param borrow_states true to keep pointers to the states given to
+ * add_to_database instead of copies
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_use_dense_keys (MarkovChain *markov_chain,
+                                  key_func_t key_func, size_t key_count,
+                                  bool borrow_states);
+
+/**
+ * Compile a trained chain into its read-only CSR form (see frozen_chain.h),
+ * used from now on by generate_tweet. Training the chain any further
+ * requires a call to markov_chain_finish_training before generating
+ * again. Requires size_func.
+ * @param markov_chain the trained chain
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_freeze (MarkovChain *markov_chain);
+
+/**
+ * Save the frozen form of a chain to a snapshot file (see
+ * chain_snapshot.h), freezing the chain first if needed.
+ * @param markov_chain the trained chain
+ * @param path path of the file to write
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_save (MarkovChain *markov_chain, const char *path);
+
+/**
+ * Load a snapshot file as the frozen form of a chain, so it can generate
+ * without training. The chain only needs its print_func (and an empty
+ * database), the state_kind the snapshot was saved with, and the
+ * check_func of its states if they have one; the file is mapped read-only
+ * and shared with every process that loads it.
+ * @param markov_chain the chain to load into
+ * @param path path of the snapshot file
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_load (MarkovChain *markov_chain, const char *path);
+
+/**
+ * Keep only the compact form of a trained chain: freeze it (or bring its
+ * frozen form up to date), trim the frozen arrays, and release everything
+ * else it holds for training, which takes several times the memory (see
+ * markov_chain_memory_usage). The chain then generates as before, and
+ * keeps its callbacks, but can't be trained any further, like a loaded
+ * one: it finds no states, and add_to_database and markov_chain_freeze
+ * fail with ERR_MSG_FROZEN_COMPACTED.
+ * @param markov_chain the trained chain
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_compact (MarkovChain *markov_chain);
+
+/**
+ * Compact a trained (or loaded) chain, then replace its frozen form with
+ * a pruned one (see frozen_chain_prune), smaller for serving.
+ * @param markov_chain the chain
+ * @param options what to drop
+ * @param report filled with how the chain changed, may be NULL
+ * @return true on success, false otherwise.
+ */
+bool markov_chain_prune (MarkovChain *markov_chain,
+                         const PruneOptions *options, PruneReport *report);
+
+/**
+ * @param markov_chain the chain
+ * @return the memory the chain holds for training: its nodes, lists,
+ * copied states (counted with size_func, 0 bytes without one) and lookup
+ * tables, not including its frozen form (see frozen_chain_memory_usage).
+ */
+MemoryUsage markov_chain_memory_usage (const MarkovChain *markov_chain);
+
 /**
  * Free markov_chain and all of it's content from memory
  * @param markov_chain markov_chain to free
@@ -120,7 +479,8 @@ void free_database (MarkovChain **markov_chain);
 
 /**
  * Add the second markov_node to the counter list of the first markov_node.
- * If already in list, update it's counter value.
+ * If already in list, update it's counter value. Both nodes must be in the
+ * database of markov_chain, since the list is searched by node identity.
  * @param first_node
  * @param second_node
  * @param markov_chain
@@ -130,6 +490,63 @@ void free_database (MarkovChain **markov_chain);
 bool add_node_to_frequencies_list (MarkovNode *first_node, MarkovNode
 *second_node, MarkovChain *markov_chain);
 
+/**
+ * Make room in the frequencies list of a node for capacity successors, so
+ * adding them doesn't grow the list again. Useful when the amount of
+ * successors is known in advance, e.g. on a board.
+ * @param markov_node a node in the database of markov_chain
+ * @param capacity amount of successors to make room for
+ * @param markov_chain
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool reserve_frequencies_list (MarkovNode *markov_node, int capacity,
+                               MarkovChain *markov_chain);
+
+/**
+ * Add the second markov_node to the counter list of the first markov_node
+ * with the given frequency. If already in list, add frequency to its
+ * counter value. Both nodes must be in the database of markov_chain.
+ * @param first_node
+ * @param second_node
+ * @param markov_chain
+ * @param frequency how many times second_node followed first_node
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_weighted_node_to_frequencies_list (MarkovNode *first_node,
+                                            MarkovNode *second_node,
+                                            MarkovChain *markov_chain,
+                                            int frequency);
+
+/**
+ * First step of merging another chain (with the same callbacks) into
+ * markov_chain: add the states of other that are missing, in the order of
+ * other's database.
+ * @param markov_chain the chain to merge into
+ * @param other the chain to merge, not changed
+ * @param merged_nodes output, of other's database size: the node of
+ * markov_chain matching each node of other, by its index
+ * @return true on success, false in case of allocation error.
+ */
+bool markov_chain_merge_states (MarkovChain *markov_chain,
+                                const MarkovChain *other,
+                                Node **merged_nodes);
+
+/**
+ * Second step of merging another chain into markov_chain: add the
+ * frequencies of other's transitions. Merging chains trained on
+ * consecutive parts of a corpus, in order, gives the same chain as training
+ * on the whole corpus (except for transitions between the parts).
+ * @param markov_chain the chain to merge into
+ * @param other the chain to merge, not changed
+ * @param merged_nodes the output of markov_chain_merge_states
+ * @return true on success, false in case of allocation error.
+ */
+bool markov_chain_merge_frequencies (MarkovChain *markov_chain,
+                                     const MarkovChain *other,
+                                     Node **merged_nodes);
+
 /**
 * Check if data_ptr is in database. If so, return the markov_node wrapping
  * it in
@@ -146,10 +563,21 @@ Node *get_node_from_database (MarkovChain *markov_chain, void *data_ptr);
  * node, add to end of markov_chain's database and return it.
  * @param markov_chain the chain to look in its database
  * @param data_ptr the state to look for
- * @return node wrapping given data_ptr in given chain's database
+ * @return node wrapping given data_ptr in given chain's database, NULL in
+ * case of allocation error or if the chain was compacted.
  */
 Node *add_to_database (MarkovChain *markov_chain, void *data_ptr);
 
+/**
+* Create a node for a state that is known not to be in markov_chain (it was
+ * just looked up), and add it to the end of markov_chain's database.
+ * @param markov_chain the chain to add to
+ * @param data_ptr the state to add
+ * @return node wrapping given data_ptr in given chain's database, NULL in
+ * case of allocation error or if the chain was compacted.
+ */
+Node *add_missing_to_database (MarkovChain *markov_chain, void *data_ptr);
+
 /** //
  * This function is to create a new Markov Node if needed.
  * @param markov_chain the chain to look in its database
@@ -160,8 +588,9 @@ MarkovNode *create_new_markov_node (void *data_ptr, MarkovChain *markov_chain);
 
 /**
 * This function gets a random number for a ceiling to return a num from 0
- * to that ceiling range.
- * @param max_number the ceiling number.
+ * to that ceiling range, uniformly, from the stream seeded by
+ * set_random_seed.
+ * @param max_number the ceiling number, bigger than 0.
  * @return a number between 0 to max_number.
  */
 int get_random_number (int max_number);
@@ -0,0 +1,10 @@
+#include "markov_chain_str.h"
+
+MARKOV_CHAIN_DEFINE (markov_chain_str, char, markov_str_hash,
+                     markov_str_compare, markov_str_is_last)
+
+bool markov_str_check (const void *state, size_t size, uint32_t state_kind)
+{
+  (void) state_kind;
+  return memchr (state, '\0', size) != NULL;
+}
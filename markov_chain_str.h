@@ -0,0 +1,59 @@
+#ifndef _MARKOV_CHAIN_STR_H_
+#define _MARKOV_CHAIN_STR_H_
+
+#include <string.h> // for strcmp(), strlen(), memchr()
+#include "markov_chain_typed.h"
+
+#define MARKOV_STR_FNV_OFFSET_BASIS 14695981039346656037UL
+#define MARKOV_STR_FNV_PRIME 1099511628211UL
+
+// a word ending with this char ends a sentence.
+#define MARKOV_STR_SENTENCE_END '.'
+
+/**
+ * @param str a word
+ * @return the FNV-1a hash of the word.
+ */
+static inline unsigned long markov_str_hash (const char *str)
+{
+  const unsigned char *chars = (const unsigned char *) str;
+  unsigned long hash = MARKOV_STR_FNV_OFFSET_BASIS;
+  while (*chars != '\0')
+    {
+      hash ^= *chars++;
+      hash *= MARKOV_STR_FNV_PRIME;
+    }
+  return hash;
+}
+
+static inline int markov_str_compare (const char *str1, const char *str2)
+{
+  return strcmp (str1, str2);
+}
+
+/**
+ * @param str a word, not empty
+ * @return true if a sentence continues after the word.
+ */
+static inline bool markov_str_is_last (const char *str)
+{
+  return str[strlen (str) - 1] != MARKOV_STR_SENTENCE_END;
+}
+
+/**
+ * The check_func of states whose flat form is a word (see MarkovChain).
+ * @param state the flat form of a state
+ * @param size the bytes the state may take
+ * @param state_kind the kind of the chain's states, any
+ * @return true if the word ends within size bytes.
+ */
+bool markov_str_check (const void *state, size_t size, uint32_t state_kind);
+
+// chains of words, as trained by text_corpus.h: a chain whose hash_func,
+// comp_func and is_last are markov_chain_str_hash_func,
+// markov_chain_str_comp_func and markov_chain_str_is_last_func is trained
+// through the inlined markov_chain_str_add_to_database.
+MARKOV_CHAIN_DECLARE (markov_chain_str, char, markov_str_hash,
+                      markov_str_compare, markov_str_is_last)
+
+#endif //_MARKOV_CHAIN_STR_H_
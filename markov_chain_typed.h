@@ -0,0 +1,98 @@
+#ifndef _MARKOV_CHAIN_TYPED_H_
+#define _MARKOV_CHAIN_TYPED_H_
+
+#include "markov_chain.h"
+
+/**
+ * Type specialized chains. A MarkovChain reaches its states through
+ * function pointers, so the lookups of the training hot path can't inline
+ * the hash or the comparison of the states. For a state type that is used
+ * a lot, these macros stamp out a typed front end of the chain, where they
+ * are resolved at compile time:
+ *
+ * MARKOV_CHAIN_DECLARE (name, type, hash_fn, compare_fn, is_last_fn), in a
+ * header, declares the generic callbacks name##_hash_func,
+ * name##_comp_func and name##_is_last_func, to be set in the chain, and
+ * defines the inline functions:
+ * - name##_matches: true if a chain was set up with these callbacks.
+ * - name##_get_node_from_database / name##_add_to_database: like
+ *   get_node_from_database / add_to_database, for a chain that matches.
+ * - name##_is_last: is_last, inlined.
+ *
+ * MARKOV_CHAIN_DEFINE (name, type, hash_fn, compare_fn, is_last_fn), in one
+ * source file, defines the callbacks.
+ *
+ * hash_fn, compare_fn and is_last_fn take const type * and should be
+ * static inline: hash_fn returns an unsigned long, compare_fn returns 0 for
+ * equal states (as comp_func), and is_last_fn is as the chain's is_last.
+ * Any other type keeps the generic function pointer API.
+ */
+#define MARKOV_CHAIN_DECLARE(name, type, hash_fn, compare_fn,               \
+                             is_last_fn)                                    \
+unsigned long name##_hash_func (const void *state);                         \
+int name##_comp_func (const void *first, const void *second);               \
+bool name##_is_last_func (const void *state);                               \
+                                                                            \
+static inline bool name##_matches (const MarkovChain *markov_chain)         \
+{                                                                           \
+  return markov_chain->hash_func == name##_hash_func                        \
+         && markov_chain->comp_func == name##_comp_func                     \
+         && markov_chain->is_last == name##_is_last_func                    \
+         && markov_chain->key_func == NULL;                                 \
+}                                                                           \
+                                                                            \
+static inline Node *name##_get_node_from_database                           \
+    (MarkovChain *markov_chain, const type *state)                          \
+{                                                                           \
+  const HashIndex *index = markov_chain->index;                             \
+  if (index == NULL)                                                        \
+    {                                                                       \
+      /* the first lookup creates the index. */                             \
+      return get_node_from_database (markov_chain, (void *) state);         \
+    }                                                                       \
+  HashIndexProbe probe = hash_index_probe (index, hash_fn (state));         \
+  Node *node;                                                               \
+  while ((node = hash_index_next_candidate (index, &probe)) != NULL)        \
+    {                                                                       \
+      if (compare_fn ((const type *) node->data->data, state) == 0)         \
+        {                                                                   \
+          return node;                                                      \
+        }                                                                   \
+    }                                                                       \
+  return NULL;                                                              \
+}                                                                           \
+                                                                            \
+static inline Node *name##_add_to_database (MarkovChain *markov_chain,      \
+                                            const type *state)              \
+{                                                                           \
+  Node *node = name##_get_node_from_database (markov_chain, state);         \
+  if (node != NULL)                                                         \
+    {                                                                       \
+      return node;                                                          \
+    }                                                                       \
+  return add_missing_to_database (markov_chain, (void *) state);            \
+}                                                                           \
+                                                                            \
+static inline bool name##_is_last (const type *state)                       \
+{                                                                           \
+  return is_last_fn (state);                                                \
+}
+
+#define MARKOV_CHAIN_DEFINE(name, type, hash_fn, compare_fn,                \
+                            is_last_fn)                                     \
+unsigned long name##_hash_func (const void *state)                          \
+{                                                                           \
+  return hash_fn ((const type *) state);                                    \
+}                                                                           \
+                                                                            \
+int name##_comp_func (const void *first, const void *second)                \
+{                                                                           \
+  return compare_fn ((const type *) first, (const type *) second);          \
+}                                                                           \
+                                                                            \
+bool name##_is_last_func (const void *state)                                \
+{                                                                           \
+  return is_last_fn ((const type *) state);                                 \
+}
+
+#endif //_MARKOV_CHAIN_TYPED_H_
@@ -0,0 +1,45 @@
+#include "markov_chain_view.h"
+
+MARKOV_CHAIN_DEFINE (markov_chain_view, TokenView, markov_view_hash,
+                     markov_view_compare, markov_view_is_last)
+
+static void *copy_view (const void *state)
+{
+  TokenView *view = malloc (sizeof (TokenView));
+  if (view != NULL)
+    {
+      *view = *(const TokenView *) state;
+    }
+  return view;
+}
+
+static size_t size_view (const void *state)
+{
+  (void) state;
+  return sizeof (TokenView);
+}
+
+static size_t flat_size_view (const void *state)
+{
+  return ((const TokenView *) state)->length + 1;
+}
+
+static void pack_view (const void *state, void *destination)
+{
+  const TokenView *view = (const TokenView *) state;
+  memcpy (destination, view->text, view->length);
+  ((char *) destination)[view->length] = '\0';
+}
+
+void markov_chain_view_init (MarkovChain *markov_chain)
+{
+  markov_chain->comp_func = markov_chain_view_comp_func;
+  markov_chain->hash_func = markov_chain_view_hash_func;
+  markov_chain->is_last = markov_chain_view_is_last_func;
+  markov_chain->copy_func = copy_view;
+  markov_chain->free_data = free;
+  markov_chain->size_func = size_view;
+  markov_chain->flat_size_func = flat_size_view;
+  markov_chain->pack_func = pack_view;
+  markov_chain->check_func = markov_str_check;
+}
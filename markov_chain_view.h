@@ -0,0 +1,77 @@
+#ifndef _MARKOV_CHAIN_VIEW_H_
+#define _MARKOV_CHAIN_VIEW_H_
+
+#include <stdint.h> // for uint32_t
+#include <string.h> // for memcmp()
+#include "markov_chain_typed.h"
+#include "markov_chain_str.h"
+
+/**
+ * A word of a corpus, in place: the length bytes at text, not NUL
+ * terminated. The corpus must outlive every chain of the views (see
+ * text_corpus.h, which keeps it in the chain's arena).
+ */
+typedef struct TokenView {
+    const char *text;
+    uint32_t length;
+} TokenView;
+
+/**
+ * @param view a word
+ * @return the FNV-1a hash of the word.
+ */
+static inline unsigned long markov_view_hash (const TokenView *view)
+{
+  const unsigned char *chars = (const unsigned char *) view->text;
+  unsigned long hash = MARKOV_STR_FNV_OFFSET_BASIS;
+  for (uint32_t i = 0; i < view->length; i++)
+    {
+      hash ^= chars[i];
+      hash *= MARKOV_STR_FNV_PRIME;
+    }
+  return hash;
+}
+
+/**
+ * @return the order of strcmp between the words.
+ */
+static inline int markov_view_compare (const TokenView *view1,
+                                       const TokenView *view2)
+{
+  uint32_t length = (view1->length < view2->length)
+                    ? view1->length : view2->length;
+  int order = memcmp (view1->text, view2->text, length);
+  if (order != 0)
+    {
+      return order;
+    }
+  return (view1->length > view2->length) - (view1->length < view2->length);
+}
+
+/**
+ * @param view a word, not empty
+ * @return true if a sentence continues after the word.
+ */
+static inline bool markov_view_is_last (const TokenView *view)
+{
+  return view->text[view->length - 1] != MARKOV_STR_SENTENCE_END;
+}
+
+// chains of words that point into the corpus instead of holding copies of
+// them, trained by text_corpus.h through the inlined
+// markov_chain_view_add_to_database. Such a chain is set up with
+// markov_chain_view_init, and its frozen form holds the words as NUL
+// terminated strings, the same as a chain of markov_chain_str.
+MARKOV_CHAIN_DECLARE (markov_chain_view, TokenView, markov_view_hash,
+                      markov_view_compare, markov_view_is_last)
+
+/**
+ * Set the state callbacks of a chain of token views: the hash, comparison,
+ * is_last, copy, size, flat form and check of the views. print_func and
+ * append_func are left to the caller, and get the words as strings (see
+ * MarkovChain's pack_func).
+ * @param markov_chain the chain, before anything was added to it
+ */
+void markov_chain_view_init (MarkovChain *markov_chain);
+
+#endif //_MARKOV_CHAIN_VIEW_H_
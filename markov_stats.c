@@ -0,0 +1,106 @@
+#include <time.h>
+#include "markov_stats.h"
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+
+static const char *const PHASE_NAMES[MARKOV_PHASE_COUNT] = {
+    "other", "read", "tokenize", "insert", "link", "sample", "print"
+};
+
+#ifdef MARKOV_STATS
+
+MarkovStats markov_stats_counters = {.enabled = true};
+
+// the phase of the calling thread, and when it entered it.
+static _Thread_local MarkovPhase current_phase = MARKOV_PHASE_NONE;
+static _Thread_local uint64_t phase_start_ns = 0;
+
+static uint64_t now_ns (void)
+{
+  struct timespec time;
+  clock_gettime (CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * NANOSECONDS_PER_SECOND + time.tv_nsec;
+}
+
+void markov_stats_switch_phase (MarkovPhase phase)
+{
+  uint64_t now = now_ns ();
+  if (phase_start_ns != 0)
+    {
+      MARKOV_STATS_ADD(phase_ns[current_phase], now - phase_start_ns);
+    }
+  current_phase = phase;
+  phase_start_ns = now;
+}
+
+void markov_stats_count_allocation (uint64_t bytes)
+{
+  MARKOV_STATS_ADD(allocations[current_phase], 1);
+  MARKOV_STATS_ADD(allocated_bytes[current_phase], bytes);
+}
+
+static uint64_t load_counter (const uint64_t *counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+MarkovStats markov_chain_stats (void)
+{
+  const MarkovStats *counters = &markov_stats_counters;
+  MarkovStats stats = {.enabled = true};
+  stats.comp_calls = load_counter (&counters->comp_calls);
+  stats.nodes_traversed = load_counter (&counters->nodes_traversed);
+  stats.frequencies_reallocs = load_counter (&counters->frequencies_reallocs);
+  stats.frequencies_realloc_bytes = load_counter
+      (&counters->frequencies_realloc_bytes);
+  for (int phase = 0; phase < MARKOV_PHASE_COUNT; phase++)
+    {
+      stats.allocations[phase] = load_counter (&counters->allocations[phase]);
+      stats.allocated_bytes[phase] = load_counter
+          (&counters->allocated_bytes[phase]);
+      stats.phase_ns[phase] = load_counter (&counters->phase_ns[phase]);
+    }
+  return stats;
+}
+
+#else
+
+MarkovStats markov_chain_stats (void)
+{
+  MarkovStats stats = {0};
+  return stats;
+}
+
+#endif //MARKOV_STATS
+
+/**
+ * print one counter per phase as a JSON object.
+ */
+static void print_phase_counters (const uint64_t *counters, FILE *file)
+{
+  fprintf (file, "{");
+  for (int phase = 0; phase < MARKOV_PHASE_COUNT; phase++)
+    {
+      fprintf (file, "%s\"%s\": %llu", (phase == 0) ? "" : ", ",
+               PHASE_NAMES[phase], (unsigned long long) counters[phase]);
+    }
+  fprintf (file, "}");
+}
+
+void markov_stats_print_json (const MarkovStats *stats, FILE *file)
+{
+  fprintf (file, "{\"enabled\": %s, \"comp_calls\": %llu, "
+                 "\"nodes_traversed\": %llu, \"frequencies_reallocs\": %llu, "
+                 "\"frequencies_realloc_bytes\": %llu, \"allocations\": ",
+           stats->enabled ? "true" : "false",
+           (unsigned long long) stats->comp_calls,
+           (unsigned long long) stats->nodes_traversed,
+           (unsigned long long) stats->frequencies_reallocs,
+           (unsigned long long) stats->frequencies_realloc_bytes);
+  print_phase_counters (stats->allocations, file);
+  fprintf (file, ", \"allocated_bytes\": ");
+  print_phase_counters (stats->allocated_bytes, file);
+  fprintf (file, ", \"phase_ns\": ");
+  print_phase_counters (stats->phase_ns, file);
+  fprintf (file, "}\n");
+}
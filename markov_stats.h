@@ -0,0 +1,106 @@
+#ifndef _MARKOV_STATS_H_
+#define _MARKOV_STATS_H_
+
+#include <stdint.h>  // for uint64_t
+#include <stdbool.h> // for bool
+#include <stdio.h>   // for FILE
+
+/**
+ * Optional instrumentation of the hot paths, compiled in only when
+ * MARKOV_STATS is defined (make STATS=1). Otherwise the MARKOV_STATS_*
+ * macros expand to nothing, and markov_chain_stats returns zeros.
+ *
+ * Counters are process wide and shared by all the threads. Every thread
+ * is in one phase at a time, and the time between two phase switches is
+ * charged to the phase that was left; so the time of a phase is the sum
+ * over the threads, and nested work (e.g. inserting while tokenizing) is
+ * not counted twice.
+ */
+
+typedef enum MarkovPhase {
+    // anything else, like setting up or freezing the chain.
+    MARKOV_PHASE_NONE = 0,
+    // reading or mapping the corpus.
+    MARKOV_PHASE_READ,
+    // splitting the corpus into words.
+    MARKOV_PHASE_TOKENIZE,
+    // looking up and adding states (add_to_database).
+    MARKOV_PHASE_INSERT,
+    // counting transitions and sentence starts.
+    MARKOV_PHASE_LINK,
+    // drawing the next states of generated sequences.
+    MARKOV_PHASE_SAMPLE,
+    // rendering and writing generated sequences.
+    MARKOV_PHASE_PRINT,
+    MARKOV_PHASE_COUNT
+} MarkovPhase;
+
+typedef struct MarkovStats {
+    // false when the program was built without MARKOV_STATS.
+    bool enabled;
+
+    // calls of comp_func while looking states up.
+    uint64_t comp_calls;
+
+    // database list nodes (and hash index entries) visited while looking
+    // states up in get_node_from_database.
+    uint64_t nodes_traversed;
+
+    // frequencies lists moved to a bigger block, and the bytes moved to.
+    uint64_t frequencies_reallocs;
+    uint64_t frequencies_realloc_bytes;
+
+    // allocations (malloc, realloc and arena slabs), their bytes and the
+    // nanoseconds spent, per phase.
+    uint64_t allocations[MARKOV_PHASE_COUNT];
+    uint64_t allocated_bytes[MARKOV_PHASE_COUNT];
+    uint64_t phase_ns[MARKOV_PHASE_COUNT];
+} MarkovStats;
+
+#ifdef MARKOV_STATS
+
+extern MarkovStats markov_stats_counters;
+
+#define MARKOV_STATS_ADD(counter, amount) \
+  __atomic_fetch_add (&markov_stats_counters.counter, (amount), \
+                      __ATOMIC_RELAXED)
+
+#define MARKOV_STATS_PHASE(phase) markov_stats_switch_phase (phase)
+
+#define MARKOV_STATS_ALLOCATION(bytes) markov_stats_count_allocation (bytes)
+
+/**
+ * Charge the time since the last switch of the calling thread to its
+ * current phase, and enter the given phase.
+ * @param phase the phase the thread enters
+ */
+void markov_stats_switch_phase (MarkovPhase phase);
+
+/**
+ * Count one allocation in the current phase of the calling thread.
+ * @param bytes size of the allocation
+ */
+void markov_stats_count_allocation (uint64_t bytes);
+
+#else
+
+#define MARKOV_STATS_ADD(counter, amount) ((void) 0)
+#define MARKOV_STATS_PHASE(phase) ((void) 0)
+#define MARKOV_STATS_ALLOCATION(bytes) ((void) 0)
+
+#endif //MARKOV_STATS
+
+/**
+ * @return the counters so far (all zero when the instrumentation is not
+ * compiled in).
+ */
+MarkovStats markov_chain_stats (void);
+
+/**
+ * Print counters as one JSON object, on a line of its own.
+ * @param stats the counters
+ * @param file the file to print to
+ */
+void markov_stats_print_json (const MarkovStats *stats, FILE *file);
+
+#endif //_MARKOV_STATS_H_
@@ -0,0 +1,59 @@
+#include <unistd.h>
+#include "memory_report.h"
+
+#define PROC_STATM_PATH "/proc/self/statm"
+
+size_t memory_usage_total (const MemoryUsage *usage)
+{
+  return usage->node_bytes + usage->edge_bytes + usage->state_bytes
+         + usage->index_bytes + usage->unused_bytes
+         + usage->allocations * MEMORY_BLOCK_OVERHEAD;
+}
+
+size_t memory_resident_bytes (void)
+{
+  FILE *fp = fopen (PROC_STATM_PATH, "r");
+  if (fp == NULL)
+    {
+      return 0;
+    }
+  // the second field is the resident set size, in pages.
+  unsigned long pages;
+  int read = fscanf (fp, "%*s %lu", &pages);
+  fclose (fp);
+  long page_size = sysconf (_SC_PAGESIZE);
+  if (read != 1 || page_size <= 0)
+    {
+      return 0;
+    }
+  return (size_t) pages * (size_t) page_size;
+}
+
+/**
+ * print one memory usage as a JSON object.
+ */
+static void print_usage (const MemoryUsage *usage, FILE *file)
+{
+  fprintf (file, "{\"states\": %zu, \"edges\": %zu, \"node_bytes\": %zu, "
+                 "\"edge_bytes\": %zu, \"state_bytes\": %zu, "
+                 "\"index_bytes\": %zu, \"unused_bytes\": %zu, "
+                 "\"allocations\": %zu, \"total_bytes\": %zu}",
+           usage->states, usage->edges, usage->node_bytes,
+           usage->edge_bytes, usage->state_bytes, usage->index_bytes,
+           usage->unused_bytes, usage->allocations,
+           memory_usage_total (usage));
+}
+
+void memory_report_print_json (const MemoryUsage *training,
+                               const MemoryUsage *compact, FILE *file)
+{
+  size_t training_total = memory_usage_total (training);
+  size_t compact_total = memory_usage_total (compact);
+  fprintf (file, "{\"training\": ");
+  print_usage (training, file);
+  fprintf (file, ", \"compact\": ");
+  print_usage (compact, file);
+  fprintf (file, ", \"reduction\": %.2f, \"resident_bytes\": %zu}\n",
+           (compact_total > 0) ? (double) training_total / compact_total : 0,
+           memory_resident_bytes ());
+}
@@ -0,0 +1,60 @@
+#ifndef _MEMORY_REPORT_H_
+#define _MEMORY_REPORT_H_
+
+#include <stdio.h>  // for FILE
+#include <stdlib.h> // for size_t
+
+// about what malloc adds to every block: its header, and the rounding of
+// the block's size.
+#define MEMORY_BLOCK_OVERHEAD (2 * sizeof (size_t))
+
+/**
+ * The memory one form of a chain holds (the training form, see
+ * markov_chain_memory_usage, or the compact one, see
+ * frozen_chain_memory_usage), by what its used for. The bytes are the
+ * sizes of the structures; allocations counts the heap blocks they are
+ * spread over, so the allocator's own overhead can be estimated.
+ */
+typedef struct MemoryUsage {
+    size_t states;
+    size_t edges;
+
+    // the nodes, the successors with the samplers built over them, the
+    // states themselves, and the lookup tables (hash index, dense keys and
+    // start table).
+    size_t node_bytes;
+    size_t edge_bytes;
+    size_t state_bytes;
+    size_t index_bytes;
+
+    // held but not used: the free room of arena slabs, the lists the arena
+    // left behind when they grew, and the free room of the compact arrays.
+    size_t unused_bytes;
+
+    size_t allocations;
+} MemoryUsage;
+
+/**
+ * @param usage the memory usage
+ * @return all the bytes of usage, with MEMORY_BLOCK_OVERHEAD per
+ * allocation.
+ */
+size_t memory_usage_total (const MemoryUsage *usage);
+
+/**
+ * @return the resident set size of the process in bytes, 0 if it's
+ * unknown.
+ */
+size_t memory_resident_bytes (void);
+
+/**
+ * Print a JSON object comparing the training form of a chain with its
+ * compact form, and the current resident set size.
+ * @param training the memory usage of the training form
+ * @param compact the memory usage of the compact form
+ * @param file the file to print to
+ */
+void memory_report_print_json (const MemoryUsage *training,
+                               const MemoryUsage *compact, FILE *file);
+
+#endif //_MEMORY_REPORT_H_
@@ -0,0 +1,282 @@
+#include <string.h>
+#include "ngram.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define TOKEN_MIX_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+// words are copied into arena slabs of this size.
+#define TOKEN_ARENA_SLAB_SIZE (1UL << 20)
+
+static uint64_t hash_word (const char *word, size_t length)
+{
+  // FNV-1a
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < length; i++)
+    {
+      hash ^= (unsigned char) word[i];
+      hash *= FNV_PRIME;
+    }
+  return hash;
+}
+
+TokenTable *token_table_create (Arena *arena)
+{
+  TokenTable *table = calloc (1, sizeof (TokenTable));
+  if (table == NULL)
+    {
+      return NULL;
+    }
+  table->capacity = TOKEN_TABLE_INITIAL_CAPACITY;
+  table->slots = calloc (table->capacity, sizeof (uint32_t));
+  table->slot_hashes = malloc (table->capacity * sizeof (uint64_t));
+  table->owns_arena = (arena == NULL);
+  table->arena = table->owns_arena ? arena_create (TOKEN_ARENA_SLAB_SIZE)
+                                   : arena;
+  if (table->slots == NULL || table->slot_hashes == NULL
+      || table->arena == NULL)
+    {
+      token_table_free (table);
+      return NULL;
+    }
+  return table;
+}
+
+/**
+ * double the amount of slots of the table, and re-insert the ids.
+ * @return true on success, false in case of allocation error.
+ */
+static bool grow_slots (TokenTable *table)
+{
+  size_t capacity = table->capacity * 2;
+  uint32_t *slots = calloc (capacity, sizeof (uint32_t));
+  uint64_t *slot_hashes = malloc (capacity * sizeof (uint64_t));
+  if (slots == NULL || slot_hashes == NULL)
+    {
+      free (slots);
+      free (slot_hashes);
+      return false;
+    }
+  for (size_t i = 0; i < table->capacity; i++)
+    {
+      if (table->slots[i] == 0)
+        {
+          continue;
+        }
+      size_t slot = table->slot_hashes[i] & (capacity - 1);
+      while (slots[slot] != 0)
+        {
+          slot = (slot + 1) & (capacity - 1);
+        }
+      slots[slot] = table->slots[i];
+      slot_hashes[slot] = table->slot_hashes[i];
+    }
+  free (table->slots);
+  free (table->slot_hashes);
+  table->slots = slots;
+  table->slot_hashes = slot_hashes;
+  table->capacity = capacity;
+  return true;
+}
+
+/**
+ * append a word to the words of the table, as the next id.
+ * @return true on success, false in case of allocation error.
+ */
+static bool add_word (TokenTable *table, const char *word, size_t length)
+{
+  if (table->size == table->words_capacity)
+    {
+      size_t capacity = table->words_capacity ? table->words_capacity * 2
+                                              : TOKEN_TABLE_INITIAL_CAPACITY;
+      const char **words = realloc (table->words,
+                                    capacity * sizeof (const char *));
+      if (words == NULL)
+        {
+          return false;
+        }
+      table->words = words;
+      uint32_t *lengths = realloc (table->lengths,
+                                   capacity * sizeof (uint32_t));
+      if (lengths == NULL)
+        {
+          return false;
+        }
+      table->lengths = lengths;
+      table->words_capacity = capacity;
+    }
+  char *copy = arena_alloc (table->arena, length + 1);
+  if (copy == NULL)
+    {
+      return false;
+    }
+  memcpy (copy, word, length);
+  copy[length] = '\0';
+  table->words[table->size] = copy;
+  table->lengths[table->size] = (uint32_t) length;
+  table->size++;
+  return true;
+}
+
+bool token_table_intern (TokenTable *table, const char *word, size_t length,
+                         uint32_t *token)
+{
+  uint64_t hash = hash_word (word, length);
+  size_t slot = hash & (table->capacity - 1);
+  while (table->slots[slot] != 0)
+    {
+      uint32_t id = table->slots[slot] - 1;
+      if (table->slot_hashes[slot] == hash && table->lengths[id] == length
+          && memcmp (table->words[id], word, length) == 0)
+        {
+          *token = id;
+          return true;
+        }
+      slot = (slot + 1) & (table->capacity - 1);
+    }
+
+  if (length > UINT32_MAX || table->size == NGRAM_NO_TOKEN - 1
+      || !add_word (table, word, length))
+    {
+      return false;
+    }
+  *token = table->size - 1;
+  table->slots[slot] = table->size;
+  table->slot_hashes[slot] = hash;
+  // the table is kept at most half full.
+  if (table->size * 2 > table->capacity)
+    {
+      return grow_slots (table);
+    }
+  return true;
+}
+
+void token_table_free (TokenTable *table)
+{
+  if (table == NULL)
+    {
+      return;
+    }
+  free (table->slots);
+  free (table->slot_hashes);
+  free (table->words);
+  free (table->lengths);
+  if (table->owns_arena)
+    {
+      arena_free (table->arena);
+    }
+  free (table);
+}
+
+int ngram_state_compare (const void *first, const void *second)
+{
+  const NgramState *first_state = (const NgramState *) first;
+  const NgramState *second_state = (const NgramState *) second;
+  if (first_state->order != second_state->order)
+    {
+      return (first_state->order < second_state->order) ? -1 : 1;
+    }
+  return memcmp (first_state->tokens, second_state->tokens,
+                 first_state->order * sizeof (uint32_t));
+}
+
+unsigned long ngram_state_hash (const void *state)
+{
+  const NgramState *ngram_state = (const NgramState *) state;
+  uint64_t hash = ngram_state->order;
+  for (uint32_t i = 0; i < ngram_state->order; i++)
+    {
+      hash = (hash ^ ngram_state->tokens[i]) * TOKEN_MIX_MULTIPLIER;
+      hash ^= hash >> 29;
+    }
+  return (unsigned long) hash;
+}
+
+size_t ngram_state_size (const void *state)
+{
+  return ngram_state_bytes (((const NgramState *) state)->order);
+}
+
+void *ngram_state_copy (const void *state)
+{
+  size_t size = ngram_state_size (state);
+  void *copy = malloc (size);
+  if (copy != NULL)
+    {
+      memcpy (copy, state, size);
+    }
+  return copy;
+}
+
+void ngram_state_free (void *state)
+{
+  free (state);
+}
+
+size_t ngram_state_flat_size (const void *state)
+{
+  const NgramState *ngram_state = (const NgramState *) state;
+  return sizeof (NgramFlatState) + ngram_state->order * sizeof (uint32_t)
+         + strlen (ngram_state->word) + 1;
+}
+
+void ngram_state_pack (const void *state, void *destination)
+{
+  const NgramState *ngram_state = (const NgramState *) state;
+  NgramFlatState *flat = (NgramFlatState *) destination;
+  flat->order = ngram_state->order;
+  memcpy (flat->tokens, ngram_state->tokens,
+          ngram_state->order * sizeof (uint32_t));
+  strcpy ((char *) ngram_flat_state_word (flat), ngram_state->word);
+}
+
+bool ngram_flat_state_check (const void *state, size_t size,
+                             uint32_t state_kind)
+{
+  const NgramFlatState *flat = (const NgramFlatState *) state;
+  size_t word_offset = sizeof (NgramFlatState)
+                       + (size_t) state_kind * sizeof (uint32_t);
+  if (size < word_offset || flat->order != state_kind)
+    {
+      return false;
+    }
+  return memchr (ngram_flat_state_word (flat), '\0', size - word_offset)
+         != NULL;
+}
+
+bool ngram_context_init (NgramContext *context, uint32_t order)
+{
+  context->state = malloc (ngram_state_bytes (order));
+  if (context->state == NULL)
+    {
+      return false;
+    }
+  context->state->order = order;
+  ngram_context_reset (context);
+  return true;
+}
+
+void ngram_context_reset (NgramContext *context)
+{
+  for (uint32_t i = 0; i < context->state->order; i++)
+    {
+      context->state->tokens[i] = NGRAM_NO_TOKEN;
+    }
+  context->state->word = "";
+}
+
+void ngram_context_push (NgramContext *context, const TokenTable *table,
+                         uint32_t token)
+{
+  uint32_t order = context->state->order;
+  uint32_t *tokens = context->state->tokens;
+  memmove (tokens, tokens + 1, (order - 1) * sizeof (uint32_t));
+  tokens[order - 1] = token;
+  context->state->word = table->words[token];
+}
+
+void ngram_context_free (NgramContext *context)
+{
+  free (context->state);
+  context->state = NULL;
+}
@@ -0,0 +1,155 @@
+#ifndef _NGRAM_H_
+#define _NGRAM_H_
+
+#include <stdint.h>  // for uint32_t
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for offsetof
+#include <stdlib.h>  // for size_t
+#include "arena.h"
+
+#define NGRAM_MAX_ORDER 8
+
+// token of the words before the first word of a line, in a context.
+#define NGRAM_NO_TOKEN UINT32_MAX
+
+#define TOKEN_TABLE_INITIAL_CAPACITY 1024
+
+/**
+ * Interned words: every distinct word gets an id, 0, 1, 2 and so on, in the
+ * order they are first seen. An open addressing (linear probing) table maps
+ * a word to its id, and the words are copied once into an arena, which may
+ * outlive the table (see token_table_create).
+ */
+typedef struct TokenTable {
+    // slot i holds the id of a word + 1, or 0 when empty.
+    uint32_t *slots;
+    uint64_t *slot_hashes;
+    size_t capacity;
+
+    // the word and its length of every id.
+    const char **words;
+    uint32_t *lengths;
+    uint32_t size;
+    size_t words_capacity;
+
+    Arena *arena;
+    bool owns_arena;
+} TokenTable;
+
+/**
+ * A state of an order k chain: the last k words, as token ids (oldest
+ * first), so every state of a chain has the same size and states are
+ * looked up by the ids alone. The text stays in the token table: word
+ * points at the interned text of the last word.
+ */
+typedef struct NgramState {
+    const char *word;
+    uint32_t order;
+    uint32_t tokens[];
+} NgramState;
+
+/**
+ * The frozen form of an NgramState (see MarkovChain's pack_func): the ids,
+ * followed by the NUL terminated text of the last word, so a frozen chain
+ * and its snapshots render the states without the token table.
+ */
+typedef struct NgramFlatState {
+    uint32_t order;
+    uint32_t tokens[];
+} NgramFlatState;
+
+/**
+ * The context of the words read so far, built in place for looking it up
+ * in the chain.
+ */
+typedef struct NgramContext {
+    NgramState *state;
+} NgramContext;
+
+/**
+ * Create an empty token table.
+ * @param arena the arena to copy the words into, which must outlive the
+ * states that point at them, or NULL for an arena of the table's own
+ * @return the new table, NULL in case of allocation error.
+ */
+TokenTable *token_table_create (Arena *arena);
+
+/**
+ * Get the id of a word, giving it a new one if it was not seen before.
+ * @param table the table
+ * @param word the word, not NUL terminated
+ * @param length length of the word
+ * @param token set to the id of the word
+ * @return true on success, false in case of allocation error.
+ */
+bool token_table_intern (TokenTable *table, const char *word, size_t length,
+                         uint32_t *token);
+
+/**
+ * Free a token table, and its words unless they are in an arena given to
+ * token_table_create.
+ * @param table the table to free, may be NULL
+ */
+void token_table_free (TokenTable *table);
+
+/**
+ * @param order amount of words in a state
+ * @return the size of every NgramState of the given order.
+ */
+static inline size_t ngram_state_bytes (uint32_t order)
+{
+  return offsetof (NgramState, tokens) + order * sizeof (uint32_t);
+}
+
+/**
+ * @param state the frozen form of an n-gram state
+ * @return the text of its last word.
+ */
+static inline const char *ngram_flat_state_word (const NgramFlatState *state)
+{
+  return (const char *) (state->tokens + state->order);
+}
+
+// MarkovChain callbacks of n-gram states (see MarkovChain), and of their
+// frozen form (flat_size_func, pack_func and check_func, which takes the
+// order as the state kind).
+int ngram_state_compare (const void *first, const void *second);
+unsigned long ngram_state_hash (const void *state);
+size_t ngram_state_size (const void *state);
+void *ngram_state_copy (const void *state);
+void ngram_state_free (void *state);
+size_t ngram_state_flat_size (const void *state);
+void ngram_state_pack (const void *state, void *destination);
+bool ngram_flat_state_check (const void *state, size_t size,
+                             uint32_t state_kind);
+
+/**
+ * Initialize an empty context of the given order.
+ * @param context the context to initialize
+ * @param order amount of words in a context, 1 .. NGRAM_MAX_ORDER
+ * @return true on success, false in case of allocation error.
+ */
+bool ngram_context_init (NgramContext *context, uint32_t order);
+
+/**
+ * Forget the words of the context, as at the start of a line.
+ * @param context the context
+ */
+void ngram_context_reset (NgramContext *context);
+
+/**
+ * Add a word to the context, dropping its oldest word.
+ * @param context the context
+ * @param table the table the word was interned in
+ * @param token id of the word
+ */
+void ngram_context_push (NgramContext *context, const TokenTable *table,
+                         uint32_t token);
+
+/**
+ * Free the memory held by a context.
+ * @param context the context to free
+ */
+void ngram_context_free (NgramContext *context);
+
+#endif //_NGRAM_H_
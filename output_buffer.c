@@ -0,0 +1,107 @@
+#include <string.h>
+#include "output_buffer.h"
+#include "markov_stats.h"
+
+#define INITIAL_CAPACITY 256
+// enough for the digits and sign of any long.
+#define MAX_INT_DIGITS 24
+
+void output_buffer_init (OutputBuffer *buffer, FILE *sink)
+{
+  buffer->data = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+  buffer->sink = sink;
+  buffer->failed = false;
+}
+
+static bool reserve (OutputBuffer *buffer, size_t length)
+{
+  if (buffer->size + length <= buffer->capacity)
+    {
+      return true;
+    }
+  size_t new_capacity = buffer->capacity == 0 ? INITIAL_CAPACITY
+                                              : buffer->capacity;
+  while (new_capacity < buffer->size + length)
+    {
+      new_capacity *= 2;
+    }
+  MARKOV_STATS_ALLOCATION (new_capacity);
+  char *new_data = realloc (buffer->data, new_capacity);
+  if (new_data == NULL)
+    {
+      buffer->failed = true;
+      return false;
+    }
+  buffer->data = new_data;
+  buffer->capacity = new_capacity;
+  return true;
+}
+
+void output_buffer_append (OutputBuffer *buffer, const char *bytes,
+                           size_t length)
+{
+  if (!reserve (buffer, length))
+    {
+      return;
+    }
+  memcpy (buffer->data + buffer->size, bytes, length);
+  buffer->size += length;
+  if (buffer->sink != NULL && buffer->size >= OUTPUT_BUFFER_FLUSH_SIZE)
+    {
+      output_buffer_flush (buffer);
+    }
+}
+
+void output_buffer_append_str (OutputBuffer *buffer, const char *str)
+{
+  output_buffer_append (buffer, str, strlen (str));
+}
+
+void output_buffer_append_int (OutputBuffer *buffer, long number)
+{
+  char digits[MAX_INT_DIGITS];
+  int start = MAX_INT_DIGITS;
+  // negating the unsigned value works for LONG_MIN too.
+  unsigned long value = number < 0 ? 0UL - (unsigned long) number
+                                   : (unsigned long) number;
+  do
+    {
+      digits[--start] = (char) ('0' + value % 10);
+      value /= 10;
+    }
+  while (value != 0);
+  if (number < 0)
+    {
+      digits[--start] = '-';
+    }
+  output_buffer_append (buffer, digits + start, MAX_INT_DIGITS - start);
+}
+
+bool output_buffer_flush (OutputBuffer *buffer)
+{
+  if (buffer->sink != NULL && buffer->size > 0)
+    {
+      if (fwrite (buffer->data, 1, buffer->size, buffer->sink)
+          != buffer->size)
+        {
+          buffer->failed = true;
+        }
+      buffer->size = 0;
+    }
+  return !buffer->failed;
+}
+
+void output_buffer_clear (OutputBuffer *buffer)
+{
+  buffer->size = 0;
+}
+
+void output_buffer_free (OutputBuffer *buffer)
+{
+  free (buffer->data);
+  buffer->data = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
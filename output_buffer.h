@@ -0,0 +1,97 @@
+#ifndef _OUTPUT_BUFFER_H_
+#define _OUTPUT_BUFFER_H_
+
+#include <stdio.h>   // for FILE
+#include <stdlib.h>  // for size_t
+#include <stdbool.h> // for bool
+
+// a buffer with a sink is written to it once it holds this many bytes.
+#define OUTPUT_BUFFER_FLUSH_SIZE (1UL << 16)
+
+/**
+ * Growable byte buffer that generated sequences are rendered into. A
+ * buffer with a sink is written to it in large blocks (see
+ * output_buffer_flush), a buffer without one only grows. Errors are
+ * sticky, as with ferror: appending never fails, and failed tells if any
+ * byte was lost.
+ */
+typedef struct OutputBuffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+
+    // where the bytes are written to, NULL to keep them in data.
+    FILE *sink;
+
+    // set when an allocation or a write failed.
+    bool failed;
+} OutputBuffer;
+
+/**
+ * Initialize an empty buffer (nothing is allocated before the first
+ * append).
+ * @param buffer the buffer to initialize
+ * @param sink the file bytes are written to, NULL to keep them
+ */
+void output_buffer_init (OutputBuffer *buffer, FILE *sink);
+
+/**
+ * Append bytes to the buffer, writing it to its sink if it got big.
+ * @param buffer the buffer
+ * @param bytes the bytes to append
+ * @param length amount of bytes
+ */
+void output_buffer_append (OutputBuffer *buffer, const char *bytes,
+                           size_t length);
+
+/**
+ * Append a NUL terminated string, without the NUL.
+ * @param buffer the buffer
+ * @param str the string to append
+ */
+void output_buffer_append_str (OutputBuffer *buffer, const char *str);
+
+/**
+ * Append a single character.
+ * @param buffer the buffer
+ * @param c the character to append
+ */
+static inline void output_buffer_append_char (OutputBuffer *buffer, char c)
+{
+  if (buffer->size < buffer->capacity && buffer->size + 1
+                                         < OUTPUT_BUFFER_FLUSH_SIZE)
+    {
+      buffer->data[buffer->size++] = c;
+      return;
+    }
+  output_buffer_append (buffer, &c, 1);
+}
+
+/**
+ * Append the decimal form of a number (as printf's "%d").
+ * @param buffer the buffer
+ * @param number the number to append
+ */
+void output_buffer_append_int (OutputBuffer *buffer, long number);
+
+/**
+ * Write the content of the buffer to its sink and empty it. Does nothing
+ * for a buffer without a sink.
+ * @param buffer the buffer
+ * @return false if the buffer failed (now or before), true otherwise.
+ */
+bool output_buffer_flush (OutputBuffer *buffer);
+
+/**
+ * Empty a buffer without a sink, keeping its memory for reuse.
+ * @param buffer the buffer
+ */
+void output_buffer_clear (OutputBuffer *buffer);
+
+/**
+ * Free the memory of a buffer (unflushed bytes are lost).
+ * @param buffer the buffer to free
+ */
+void output_buffer_free (OutputBuffer *buffer);
+
+#endif //_OUTPUT_BUFFER_H_
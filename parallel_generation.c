@@ -0,0 +1,362 @@
+#include <pthread.h>
+#include "parallel_generation.h"
+
+// sequences rendered by the pool before the calling thread writes them.
+#define SEQUENCES_PER_BATCH 4096
+// sequences a worker claims at once, rendered into one chunk buffer.
+#define SEQUENCES_PER_CHUNK 64
+#define CHUNKS_PER_BATCH (SEQUENCES_PER_BATCH / SEQUENCES_PER_CHUNK)
+#define MAX_GENERATION_THREADS 256
+// walks up to this long are kept on the stack while rendered.
+#define LOCAL_PATH_LENGTH 256
+
+#define ERR_MSG_OUTPUT_FAILURE \
+  "Error: failed to render or write the generated sequences.\n"
+
+/**
+ * A batch of sequences, rendered chunk by chunk. Chunk i holds the
+ * sequences first_sequence + i * SEQUENCES_PER_CHUNK onwards.
+ */
+typedef struct GenerationBatch {
+    OutputBuffer chunks[CHUNKS_PER_BATCH];
+    unsigned int first_sequence;
+    unsigned int size;
+} GenerationBatch;
+
+/**
+ * The state shared by the calling thread and the workers. Fields of the
+ * current batch are written only while no worker is rendering.
+ */
+typedef struct GenerationPool {
+    const MarkovChain *markov_chain;
+    uint32_t first_node;
+    int max_length;
+    uint64_t seed;
+    header_func_t append_header;
+
+    pthread_mutex_t lock;
+    pthread_cond_t batch_ready;
+    pthread_cond_t batch_done;
+    // incremented for every batch handed to the workers.
+    unsigned long generation;
+    int running_workers;
+    int worker_count;
+    bool done;
+
+    GenerationBatch *batch;
+    unsigned int next_chunk;
+} GenerationPool;
+
+static int generate_in_order (MarkovChain *markov_chain,
+                              MarkovNode *first_node, int max_length,
+                              unsigned int amount, uint64_t seed,
+                              header_func_t append_header)
+{
+  OutputBuffer buffer;
+  output_buffer_init (&buffer, stdout);
+  for (unsigned int i = 0; i < amount && !buffer.failed; i++)
+    {
+      RandomStream stream;
+      random_stream_init (&stream, seed, i);
+      append_header (i + 1, &buffer);
+      generate_tweet_to_buffer (markov_chain, first_node, max_length,
+                                &stream, &buffer);
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_PRINT);
+  bool written = output_buffer_flush (&buffer);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  output_buffer_free (&buffer);
+  if (!written)
+    {
+      fprintf (stdout, ERR_MSG_OUTPUT_FAILURE);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * render the sequences of one chunk of the current batch.
+ */
+static void render_chunk (const GenerationPool *pool, GenerationBatch *batch,
+                          unsigned int chunk)
+{
+  const FrozenChain *frozen = pool->markov_chain->frozen;
+  OutputBuffer *buffer = &batch->chunks[chunk];
+  output_buffer_clear (buffer);
+
+  uint32_t local_path[LOCAL_PATH_LENGTH];
+  uint32_t *path = local_path;
+  if (pool->max_length + 1 > LOCAL_PATH_LENGTH)
+    {
+      path = malloc ((pool->max_length + 1) * sizeof (uint32_t));
+      if (path == NULL)
+        {
+          buffer->failed = true;
+          return;
+        }
+    }
+
+  unsigned int start = chunk * SEQUENCES_PER_CHUNK;
+  unsigned int end = start + SEQUENCES_PER_CHUNK;
+  if (end > batch->size)
+    {
+      end = batch->size;
+    }
+  for (unsigned int i = start; i < end; i++)
+    {
+      unsigned int sequence = batch->first_sequence + i;
+      RandomStream stream;
+      random_stream_init (&stream, pool->seed, sequence);
+      pool->append_header (sequence + 1, buffer);
+      int length = frozen_walk (frozen, pool->first_node, pool->max_length,
+                                &stream, path);
+      if (length > 0)
+        {
+          append_frozen_walk (pool->markov_chain, frozen, path, length,
+                              buffer);
+        }
+    }
+  if (path != local_path)
+    {
+      free (path);
+    }
+}
+
+/**
+ * render the unclaimed chunks of the current batch, one at a time.
+ */
+static void render_batch (GenerationPool *pool)
+{
+  GenerationBatch *batch = pool->batch;
+  unsigned int chunk_count = (batch->size + SEQUENCES_PER_CHUNK - 1)
+                             / SEQUENCES_PER_CHUNK;
+  for (;;)
+    {
+      unsigned int chunk = __atomic_fetch_add (&pool->next_chunk, 1,
+                                               __ATOMIC_RELAXED);
+      if (chunk >= chunk_count)
+        {
+          return;
+        }
+      render_chunk (pool, batch, chunk);
+    }
+}
+
+static void *generation_worker (void *arg)
+{
+  GenerationPool *pool = (GenerationPool *) arg;
+  unsigned long seen_generation = 0;
+  for (;;)
+    {
+      pthread_mutex_lock (&pool->lock);
+      while (!pool->done && pool->generation == seen_generation)
+        {
+          pthread_cond_wait (&pool->batch_ready, &pool->lock);
+        }
+      if (pool->done)
+        {
+          pthread_mutex_unlock (&pool->lock);
+          return NULL;
+        }
+      seen_generation = pool->generation;
+      pthread_mutex_unlock (&pool->lock);
+
+      render_batch (pool);
+
+      pthread_mutex_lock (&pool->lock);
+      if (--pool->running_workers == 0)
+        {
+          pthread_cond_signal (&pool->batch_done);
+        }
+      pthread_mutex_unlock (&pool->lock);
+    }
+}
+
+/**
+ * hand a batch to the workers, which start rendering it at once.
+ */
+static void start_batch (GenerationPool *pool, GenerationBatch *batch)
+{
+  pthread_mutex_lock (&pool->lock);
+  pool->batch = batch;
+  pool->next_chunk = 0;
+  pool->running_workers = pool->worker_count;
+  pool->generation++;
+  pthread_cond_broadcast (&pool->batch_ready);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+static void wait_for_batch (GenerationPool *pool)
+{
+  pthread_mutex_lock (&pool->lock);
+  while (pool->running_workers > 0)
+    {
+      pthread_cond_wait (&pool->batch_done, &pool->lock);
+    }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/**
+ * write the chunks of a rendered batch to stdout, in order.
+ * @return true on success, false if a chunk failed or couldn't be written.
+ */
+static bool write_batch (const GenerationBatch *batch)
+{
+  unsigned int chunk_count = (batch->size + SEQUENCES_PER_CHUNK - 1)
+                             / SEQUENCES_PER_CHUNK;
+  bool written = true;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_PRINT);
+  for (unsigned int i = 0; i < chunk_count && written; i++)
+    {
+      const OutputBuffer *chunk = &batch->chunks[i];
+      written = !chunk->failed
+                && fwrite (chunk->data, 1, chunk->size, stdout)
+                   == chunk->size;
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  return written;
+}
+
+/**
+ * render the sequences batch by batch, writing every batch while the
+ * workers render the next one.
+ * @return true on success, false in case of allocation or write error.
+ */
+static bool run_batches (GenerationPool *pool, GenerationBatch *batches,
+                         unsigned int amount)
+{
+  GenerationBatch *rendered = NULL;
+  bool written = true;
+  for (unsigned int first = 0, k = 0; first < amount && written;
+       first += SEQUENCES_PER_BATCH, k++)
+    {
+      GenerationBatch *batch = &batches[k % 2];
+      batch->first_sequence = first;
+      batch->size = (amount - first < SEQUENCES_PER_BATCH)
+                    ? amount - first : SEQUENCES_PER_BATCH;
+      start_batch (pool, batch);
+      if (rendered != NULL)
+        {
+          written = write_batch (rendered);
+        }
+      wait_for_batch (pool);
+      rendered = batch;
+    }
+  if (rendered != NULL && written)
+    {
+      written = write_batch (rendered);
+    }
+  return written;
+}
+
+static void free_batches (GenerationBatch *batches)
+{
+  for (int i = 0; i < 2; i++)
+    {
+      for (int j = 0; j < CHUNKS_PER_BATCH; j++)
+        {
+          output_buffer_free (&batches[i].chunks[j]);
+        }
+    }
+  free (batches);
+}
+
+/**
+ * @return two batches of empty chunk buffers, NULL in case of allocation
+ * error.
+ */
+static GenerationBatch *create_batches (void)
+{
+  GenerationBatch *batches = malloc (2 * sizeof (GenerationBatch));
+  if (batches == NULL)
+    {
+      return NULL;
+    }
+  for (int i = 0; i < 2; i++)
+    {
+      for (int j = 0; j < CHUNKS_PER_BATCH; j++)
+        {
+          output_buffer_init (&batches[i].chunks[j], NULL);
+        }
+    }
+  return batches;
+}
+
+int generate_sequences (MarkovChain *markov_chain, MarkovNode *first_node,
+                        int max_length, unsigned int amount, uint64_t seed,
+                        int threads, header_func_t append_header)
+{
+  if (threads > MAX_GENERATION_THREADS)
+    {
+      threads = MAX_GENERATION_THREADS;
+    }
+  if (threads <= 1 || markov_chain->frozen == NULL
+      || markov_chain->append_func == NULL || max_length < 1)
+    {
+      return generate_in_order (markov_chain, first_node, max_length, amount,
+                                seed, append_header);
+    }
+
+  GenerationPool pool = {
+      .markov_chain = markov_chain,
+      .first_node = (first_node != NULL) ? (uint32_t) first_node->index
+                                         : FROZEN_NO_NODE,
+      .max_length = max_length,
+      .seed = seed,
+      .append_header = append_header,
+  };
+  GenerationBatch *batches = create_batches ();
+  pthread_t *thread_ids = malloc (threads * sizeof (pthread_t));
+  if (batches == NULL || thread_ids == NULL)
+    {
+      free (batches);
+      free (thread_ids);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  pthread_mutex_init (&pool.lock, NULL);
+  pthread_cond_init (&pool.batch_ready, NULL);
+  pthread_cond_init (&pool.batch_done, NULL);
+
+  for (int i = 0; i < threads; i++)
+    {
+      if (pthread_create (&thread_ids[i], NULL, generation_worker, &pool)
+          != 0)
+        {
+          break;
+        }
+      pool.worker_count++;
+    }
+
+  int ans;
+  if (pool.worker_count == 0)
+    {
+      ans = generate_in_order (markov_chain, first_node, max_length, amount,
+                               seed, append_header);
+    }
+  else
+    {
+      ans = run_batches (&pool, batches, amount) ? EXIT_SUCCESS
+                                                 : EXIT_FAILURE;
+      if (ans == EXIT_FAILURE)
+        {
+          fprintf (stdout, ERR_MSG_OUTPUT_FAILURE);
+        }
+    }
+
+  pthread_mutex_lock (&pool.lock);
+  pool.done = true;
+  pthread_cond_broadcast (&pool.batch_ready);
+  pthread_mutex_unlock (&pool.lock);
+  for (int i = 0; i < pool.worker_count; i++)
+    {
+      pthread_join (thread_ids[i], NULL);
+    }
+
+  pthread_cond_destroy (&pool.batch_done);
+  pthread_cond_destroy (&pool.batch_ready);
+  pthread_mutex_destroy (&pool.lock);
+  free (thread_ids);
+  free_batches (batches);
+  return ans;
+}
@@ -0,0 +1,39 @@
+#ifndef _PARALLEL_GENERATION_H_
+#define _PARALLEL_GENERATION_H_
+
+#include "markov_chain.h"
+
+/**
+ * Appends the header of a generated sequence, rendered before the sequence
+ * itself.
+ * @param sequence_number number of the sequence, starting from 1
+ * @param buffer the buffer to append the header to
+ */
+typedef void (*header_func_t) (unsigned int sequence_number,
+                               OutputBuffer *buffer);
+
+/**
+ * Generate amount sequences out of a chain and write them to stdout in
+ * large blocks. Sequence i is drawn from the stream (seed, i) (see
+ * random_stream_init), so it doesn't depend on the other sequences. With
+ * more than one thread the sequences are walked and rendered by a pool of
+ * threads on the frozen chain (shared read-only, with no locking) into
+ * buffers of their own, which the calling thread writes in order, so the
+ * output is the same for every amount of threads.
+ * @param markov_chain the chain, frozen and with an append_func if threads
+ * is bigger than 1 (it is generated by the calling thread only otherwise)
+ * @param first_node markov_node every sequence starts with, if NULL-
+ * choose a random one per sequence
+ * @param max_length maximum length of a sequence
+ * @param amount amount of sequences to generate
+ * @param seed the seed of the run
+ * @param threads amount of threads walking the chain
+ * @param append_header appends the header of every sequence
+ * @return EXIT_SUCCESS or EXIT_FAILURE in case of allocation or write
+ * error.
+ */
+int generate_sequences (MarkovChain *markov_chain, MarkovNode *first_node,
+                        int max_length, unsigned int amount, uint64_t seed,
+                        int threads, header_func_t append_header);
+
+#endif //_PARALLEL_GENERATION_H_
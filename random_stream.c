@@ -0,0 +1,43 @@
+#include "random_stream.h"
+
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+#define DEFAULT_SEED 1
+
+static RandomStream default_stream;
+static int default_stream_seeded = 0;
+
+/**
+ * splitmix64 finalizer, spreads every bit of value over the whole result.
+ */
+static uint64_t mix_bits (uint64_t value)
+{
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+void random_stream_init (RandomStream *stream, uint64_t seed,
+                         uint64_t stream_id)
+{
+  uint64_t key = mix_bits (seed + GOLDEN_GAMMA * (stream_id + 1));
+  stream->increment = (mix_bits (key + GOLDEN_GAMMA) << 1u) | 1u;
+  stream->state = 0;
+  random_stream_next (stream);
+  stream->state += key;
+  random_stream_next (stream);
+}
+
+RandomStream *random_stream_default (void)
+{
+  if (!default_stream_seeded)
+    {
+      random_stream_seed_default (DEFAULT_SEED);
+    }
+  return &default_stream;
+}
+
+void random_stream_seed_default (uint64_t seed)
+{
+  random_stream_init (&default_stream, seed, 0);
+  default_stream_seeded = 1;
+}
@@ -0,0 +1,76 @@
+#ifndef _RANDOM_STREAM_H_
+#define _RANDOM_STREAM_H_
+
+#include <stdint.h> // for uint64_t
+
+/**
+ * PCG32 pseudo random generator (PCG-XSH-RR, 64 bit state). Every stream
+ * has its own state, so streams can be used concurrently, and the same
+ * (seed, stream id) pair gives the same numbers on every platform.
+ */
+typedef struct RandomStream {
+    uint64_t state;
+    uint64_t increment;
+} RandomStream;
+
+/**
+ * Initialize a stream. Different stream ids of the same seed give
+ * independent streams, e.g. one per generated sequence.
+ * @param stream the stream to initialize
+ * @param seed the seed of the run
+ * @param stream_id id of the stream within the run
+ */
+void random_stream_init (RandomStream *stream, uint64_t seed,
+                         uint64_t stream_id);
+
+/**
+ * @param stream the stream to draw from
+ * @return the next uniformly distributed 32 bit number.
+ */
+static inline uint32_t random_stream_next (RandomStream *stream)
+{
+  uint64_t old_state = stream->state;
+  stream->state = old_state * 6364136223846793005ULL + stream->increment;
+  uint32_t xor_shifted = (uint32_t) (((old_state >> 18u) ^ old_state)
+                                     >> 27u);
+  uint32_t rotation = (uint32_t) (old_state >> 59u);
+  return (xor_shifted >> rotation) | (xor_shifted << ((-rotation) & 31u));
+}
+
+/**
+ * Draw a number uniformly from 0 to bound - 1, with no modulo bias
+ * (Lemire's multiply and reject method, which rarely divides).
+ * @param stream the stream to draw from
+ * @param bound the ceiling, bigger than 0
+ * @return a number between 0 to bound - 1.
+ */
+static inline uint32_t random_stream_below (RandomStream *stream,
+                                            uint32_t bound)
+{
+  uint64_t product = (uint64_t) random_stream_next (stream) * bound;
+  uint32_t low = (uint32_t) product;
+  if (low < bound)
+    {
+      uint32_t threshold = -bound % bound;
+      while (low < threshold)
+        {
+          product = (uint64_t) random_stream_next (stream) * bound;
+          low = (uint32_t) product;
+        }
+    }
+  return (uint32_t) (product >> 32);
+}
+
+/**
+ * @return the stream used by the functions that don't take a stream
+ * (get_random_number and the ones built on it). Not thread safe.
+ */
+RandomStream *random_stream_default (void);
+
+/**
+ * Re-seed the default stream.
+ * @param seed the new seed
+ */
+void random_stream_seed_default (uint64_t seed);
+
+#endif //_RANDOM_STREAM_H_
@@ -1,5 +1,11 @@
+#define _GNU_SOURCE // for getline()
 #include <string.h> // For strlen(), strcmp(), strcpy()
+#include <getopt.h> // for getopt_long()
+#include <inttypes.h> // for PRIu64
 #include "markov_chain.h"
+#include "parallel_generation.h"
+#include "absorbing_chain.h"
+#include "walk_simulation.h"
 
 #define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
 
@@ -17,15 +23,81 @@ typedef enum Program {
 #define DICE_MAX 6
 #define NUM_OF_TRANSITIONS 20
 
+// the biggest roll of a board file, and the biggest sum of the weights of
+// its rolls.
+#define MAX_BOARD_ROLL (1 << 16)
+#define MAX_BOARD_ROLL_WEIGHT (1 << 30)
+
 #define ACCEPTED_ARG_COUNT 3
+#define EXACT_ARG_COUNT 1
+
+// the finish curve of --exact is printed up to this many rolls, or until
+// the game is finished with probability 1 - EXACT_CURVE_TAIL.
+#define EXACT_HORIZON 1000
+#define EXACT_CURVE_TAIL 1e-9
+
+// games of --simulate are stopped after this many rolls, unless
+// --max-rolls is given.
+#define DEFAULT_SIMULATION_ROLLS 10000
+
+#define GOLDEN_RATIO_HASH 11400714819323198485UL
+
+// long options without a short letter.
+#define STATS_OPTION 256
+#define STATS_FORMAT_JSON "json"
 
 
 // ERROR MESSAGE'S SECTION:
 #define ERR_MSG_USAGE_PROBLEM "Usage: Please fill the following command's" \
-" ./snakes_and_ladders <seed> <number of paths>"
+" ./snakes_and_ladders [-j <generation threads>] <seed> <number of paths>" \
+", or ./snakes_and_ladders --exact, or ./snakes_and_ladders --simulate" \
+" [-j <threads>] [--max-rolls <rolls>] [--unbatched] <seed>" \
+" <number of games>. Every mode takes [--board <board file>] and" \
+" [--stats=json]."
+
+#define ERR_MSG_BOARD_FILE "Error: can't read the board file.\n"
+#define ERR_MSG_BOARD_LINE "Error: invalid board file, line %d.\n"
+#define ERR_MSG_BOARD_NO_SIZE "Error: invalid board file, no size.\n"
+#define ERR_MSG_BOARD_CYCLE "Error: invalid board file, ladders and " \
+"snakes lead from cell %d back to itself.\n"
+
+#define ERR_MSG_NOT_CONVERGED "Warning: the solution didn't converge, the " \
+"statistics are not exact.\n"
+
+/**
+ * the optional flags of the program, given before the positional arguments
+ */
+typedef struct Options {
+    // -j, --jobs <n>: amount of threads generating the walks.
+    int generation_threads;
+
+    // -e, --exact: print the exact statistics of a game instead of random
+    // walks (the positional arguments are then not given).
+    bool exact;
+
+    // -m, --simulate: play the games without printing them, and print only
+    // their statistics.
+    bool simulate;
+
+    // -c, --max-rolls <n>: a simulated game is stopped after n rolls.
+    int max_rolls;
+
+    // -u, --unbatched: simulate the games one at a time, instead of many
+    // at a time by the batched walker (see walk_simulation_run).
+    bool unbatched;
+
+    // -b, --board <path>: play on the board of the file (see load_board)
+    // instead of the built in one. NULL if not given.
+    const char *board_path;
+
+    // --stats=json: print the hot path counters (see markov_stats.h) to
+    // stderr at the end.
+    bool print_stats;
+} Options;
 
 // COMPILATION & DECLARATION SECTION:
-int snakes_and_ladders_logic (int seed, int paths_amount);
+int snakes_and_ladders_logic (int seed, int paths_amount,
+                              const Options *options);
 
 /**
  * represents the transitions by ladders and snakes in the game
@@ -68,40 +140,61 @@ typedef struct Cell {
     //both ladder_to and snake_to should be -1 if the Cell doesn't have them
 } Cell;
 
+/**
+ * A board: its cells, in one array, and how likely every roll is.
+ */
+typedef struct Board {
+    Cell *cells;
+    int size;
+
+    // roll_weights[r] is the weight of rolling r, for r = 1 .. max_roll.
+    int *roll_weights;
+    int max_roll;
+} Board;
+
+// the number of the last cell of the board played on, where the game ends.
+static int last_cell_number = BOARD_SIZE;
+
 static bool is_last_struct_cell (const void *ptr)
 {
   Cell *p_cell = (Cell *) ptr;
 
-  return (p_cell->number != BOARD_SIZE);
+  return (p_cell->number != last_cell_number);
 }
 
-static void print_struct_cell (const void *ptr)
+static void append_struct_cell (const void *ptr, OutputBuffer *buffer)
 {
   Cell *p_cell = (Cell *) ptr;
 
-  if (p_cell->ladder_to == -1 && p_cell->snake_to == -1)
+  output_buffer_append_char (buffer, '[');
+  output_buffer_append_int (buffer, p_cell->number);
+  output_buffer_append_char (buffer, ']');
+  if (p_cell->ladder_to != -1)
     {
-      printf ("[%d]", p_cell->number);
+      output_buffer_append_str (buffer, "-ladder to ");
+      output_buffer_append_int (buffer, p_cell->ladder_to);
     }
-  else
+  else if (p_cell->snake_to != -1)
     {
-      printf ("[%d]", p_cell->number);
-      if (p_cell->ladder_to != -1)
-        {
-          printf ("-ladder to %d", p_cell->ladder_to);
-        }
-      else if (p_cell->snake_to != -1)
-        {
-          printf ("-snake to %d", p_cell->snake_to);
-        }
+      output_buffer_append_str (buffer, "-snake to ");
+      output_buffer_append_int (buffer, p_cell->snake_to);
     }
 
   if (is_last_struct_cell (ptr))
     {
-      printf (" ->");
+      output_buffer_append_str (buffer, " ->");
     }
 }
 
+static void print_struct_cell (const void *ptr)
+{
+  OutputBuffer buffer;
+  output_buffer_init (&buffer, stdout);
+  append_struct_cell (ptr, &buffer);
+  output_buffer_flush (&buffer);
+  output_buffer_free (&buffer);
+}
+
 static int comp_struct_cell (const void *ptr1, const void *ptr2)
 {
   Cell *comp1 = (Cell *) ptr1;
@@ -111,6 +204,24 @@ static int comp_struct_cell (const void *ptr1, const void *ptr2)
   return ans;
 }
 
+static unsigned long hash_struct_cell (const void *ptr)
+{
+  const Cell *p_cell = (const Cell *) ptr;
+  return (unsigned long) p_cell->number * GOLDEN_RATIO_HASH;
+}
+
+static size_t key_struct_cell (const void *ptr)
+{
+  const Cell *p_cell = (const Cell *) ptr;
+  return (size_t) (p_cell->number - 1);
+}
+
+static size_t size_struct_cell (const void *ptr)
+{
+  (void) ptr;
+  return sizeof (Cell);
+}
+
 static void free_struct_cell (void *ptr)
 {
   Cell *p_cell = (Cell *) ptr;
@@ -141,95 +252,415 @@ static int handle_error (char *error_msg, MarkovChain **database)
   return EXIT_FAILURE;
 }
 
-static int create_board (Cell *cells[BOARD_SIZE])
+static void free_board (Board *board)
+{
+  free (board->cells);
+  free (board->roll_weights);
+  board->cells = NULL;
+  board->roll_weights = NULL;
+}
+
+/**
+ * allocate the cells of a board, with no ladders or snakes.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int alloc_cells (Board *board, int size)
+{
+  board->size = size;
+  board->cells = malloc (size * sizeof (Cell));
+  if (board->cells == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+  for (int i = 0; i < size; i++)
+    {
+      board->cells[i] = (Cell) {i + 1, EMPTY, EMPTY};
+    }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * put a ladder (if from < to) or a snake on the board.
+ * @return false if from and to are not two different cells of the board,
+ * or if from is the last cell or already has a ladder or a snake.
+ */
+static bool add_transition (Board *board, int from, int to)
 {
-  for (int i = 0; i < BOARD_SIZE; i++)
+  if (from < 1 || from >= board->size || to < 1 || to > board->size
+      || from == to)
     {
-      cells[i] = malloc (sizeof (Cell));
-      if (cells[i] == NULL)
+      return false;
+    }
+  Cell *cell = &board->cells[from - 1];
+  if (cell->ladder_to != EMPTY || cell->snake_to != EMPTY)
+    {
+      return false;
+    }
+  if (from < to)
+    {
+      cell->ladder_to = to;
+    }
+  else
+    {
+      cell->snake_to = to;
+    }
+  return true;
+}
+
+/**
+ * set the rolls of a board to the sums of count dice with faces faces
+ * each.
+ * @return EXIT_SUCCESS or EXIT_FAILURE (with the error printed) if the
+ * dice are invalid or in case of allocation error.
+ */
+static int set_dice (Board *board, int count, int faces, int line_number)
+{
+  long total_weight = 1;
+  for (int i = 0; i < count && total_weight <= MAX_BOARD_ROLL_WEIGHT; i++)
+    {
+      total_weight *= faces;
+    }
+  if (count < 1 || faces < 1 || (long) count * faces > MAX_BOARD_ROLL
+      || total_weight > MAX_BOARD_ROLL_WEIGHT)
+    {
+      printf (ERR_MSG_BOARD_LINE, line_number);
+      return EXIT_FAILURE;
+    }
+
+  // the weights of the sums of the first i dice, one die at a time.
+  int max_roll = count * faces;
+  int *weights = calloc (max_roll + 1, sizeof (int));
+  int *next_weights = calloc (max_roll + 1, sizeof (int));
+  if (weights == NULL || next_weights == NULL)
+    {
+      free (weights);
+      free (next_weights);
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+  weights[0] = 1;
+  for (int i = 1; i <= count; i++)
+    {
+      memset (next_weights, 0, (max_roll + 1) * sizeof (int));
+      for (int sum = i - 1; sum <= (i - 1) * faces; sum++)
         {
-          for (int j = 0; j < i; j++)
+          for (int face = 1; face <= faces; face++)
             {
-              free (cells[j]);
-
+              next_weights[sum + face] += weights[sum];
             }
-          handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+        }
+      int *swap = weights;
+      weights = next_weights;
+      next_weights = swap;
+    }
+  free (next_weights);
+  free (board->roll_weights);
+  board->roll_weights = weights;
+  board->max_roll = max_roll;
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @return true if text has nothing but white space.
+ */
+static bool only_spaces (const char *text)
+{
+  return text[strspn (text, " \t\r\n")] == '\0';
+}
+
+/**
+ * set the rolls of a board to the weights listed in text, of the rolls 1,
+ * 2, and so on.
+ * @return EXIT_SUCCESS or EXIT_FAILURE (with the error printed) if the
+ * weights are invalid or in case of allocation error.
+ */
+static int set_roll_weights (Board *board, const char *text,
+                             int line_number)
+{
+  int *weights = calloc (MAX_BOARD_ROLL + 1, sizeof (int));
+  if (weights == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+  int max_roll = 0;
+  long total_weight = 0;
+  int weight, length;
+  while (sscanf (text, "%d%n", &weight, &length) == 1)
+    {
+      if (weight < 0 || max_roll == MAX_BOARD_ROLL)
+        {
+          max_roll = 0;
+          break;
+        }
+      weights[++max_roll] = weight;
+      total_weight += weight;
+      text += length;
+    }
+  if (max_roll == 0 || total_weight == 0
+      || total_weight > MAX_BOARD_ROLL_WEIGHT || !only_spaces (text))
+    {
+      free (weights);
+      printf (ERR_MSG_BOARD_LINE, line_number);
+      return EXIT_FAILURE;
+    }
+  free (board->roll_weights);
+  board->roll_weights = weights;
+  board->max_roll = max_roll;
+  return EXIT_SUCCESS;
+}
+
+/**
+ * parse one line of a board file (see load_board), with its comment
+ * removed.
+ * @return EXIT_SUCCESS or EXIT_FAILURE (with the error printed).
+ */
+static int parse_board_line (Board *board, char *line, int line_number)
+{
+  char keyword[sizeof ("size")];
+  int first, second, length;
+  if (only_spaces (line))
+    {
+      return EXIT_SUCCESS;
+    }
+  if (sscanf (line, "%d %d%n", &first, &second, &length) == 2
+      && only_spaces (line + length))
+    {
+      if (board->cells == NULL || !add_transition (board, first, second))
+        {
+          printf (ERR_MSG_BOARD_LINE, line_number);
+          return EXIT_FAILURE;
+        }
+      return EXIT_SUCCESS;
+    }
+  if (sscanf (line, " %4s%n", keyword, &length) != 1)
+    {
+      printf (ERR_MSG_BOARD_LINE, line_number);
+      return EXIT_FAILURE;
+    }
+  line += length;
+  if (strcmp (keyword, "size") == 0)
+    {
+      if (board->cells != NULL || sscanf (line, "%d%n", &first, &length) != 1
+          || !only_spaces (line + length) || first < 1)
+        {
+          printf (ERR_MSG_BOARD_LINE, line_number);
+          return EXIT_FAILURE;
+        }
+      return alloc_cells (board, first);
+    }
+  if (strcmp (keyword, "dice") == 0)
+    {
+      if (sscanf (line, "%d %d%n", &first, &second, &length) != 2
+          || !only_spaces (line + length))
+        {
+          printf (ERR_MSG_BOARD_LINE, line_number);
           return EXIT_FAILURE;
         }
-      *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
+      return set_dice (board, first, second, line_number);
     }
+  if (strcmp (keyword, "roll") == 0)
+    {
+      return set_roll_weights (board, line, line_number);
+    }
+  printf (ERR_MSG_BOARD_LINE, line_number);
+  return EXIT_FAILURE;
+}
 
-  for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
+/**
+ * check that following ladders and snakes always ends at a cell without
+ * one (otherwise a player could move forever without rolling).
+ * @return EXIT_SUCCESS or EXIT_FAILURE (with the error printed).
+ */
+static int check_redirect_cycles (const Board *board)
+{
+  // 0 for cells not reached yet, 1 for the cells of the current path, 2
+  // for the ones checked already.
+  unsigned char *state = calloc (board->size, 1);
+  if (state == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+  for (int i = 0; i < board->size; i++)
     {
-      int from = transitions[i][0];
-      int to = transitions[i][1];
-      if (from < to)
+      int cell = i;
+      int redirect;
+      while (state[cell] == 0
+             && (redirect = MAX(board->cells[cell].ladder_to,
+                                board->cells[cell].snake_to)) != EMPTY)
+        {
+          state[cell] = 1;
+          cell = redirect - 1;
+        }
+      if (state[cell] == 1)
         {
-          cells[from - 1]->ladder_to = to;
+          printf (ERR_MSG_BOARD_CYCLE, cell + 1);
+          free (state);
+          return EXIT_FAILURE;
         }
-      else
+      for (cell = i; state[cell] == 1;
+           cell = MAX(board->cells[cell].ladder_to,
+                      board->cells[cell].snake_to) - 1)
         {
-          cells[from - 1]->snake_to = to;
+          state[cell] = 2;
         }
+      state[cell] = 2;
     }
+  free (state);
   return EXIT_SUCCESS;
 }
 
 /**
- * fills database
- * @param markov_chain
+ * the built in board: BOARD_SIZE cells, one die of DICE_MAX faces, and the
+ * ladders and snakes of transitions.
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-static int fill_database (MarkovChain *markov_chain)
+static int create_board (Board *board)
 {
-  Cell *cells[BOARD_SIZE];
-  if (create_board (cells) == EXIT_FAILURE)
+  *board = (Board) {0};
+  if (alloc_cells (board, BOARD_SIZE) == EXIT_FAILURE
+      || set_dice (board, 1, DICE_MAX, 0) == EXIT_FAILURE)
     {
+      free_board (board);
       return EXIT_FAILURE;
     }
-  MarkovNode *from_node = NULL, *to_node = NULL;
-  size_t index_to;
-  for (size_t i = 0; i < BOARD_SIZE; i++)
+  for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
     {
-      add_to_database (markov_chain, cells[i]);
+      add_transition (board, transitions[i][0], transitions[i][1]);
     }
+  return EXIT_SUCCESS;
+}
 
-  for (size_t i = 0; i < BOARD_SIZE; i++)
+/**
+ * load a board from a text file. Every line is one of (anything after a
+ * '#' is a comment):
+ *   size <cells>            the amount of cells, before any ladder or snake
+ *   dice <count> <faces>    a roll is the sum of count dice (1 6 if not
+ *                           given)
+ *   roll <w1> <w2> ...      or, a roll is r with weight wr
+ *   <from> <to>             a ladder from cell from to cell to if from < to,
+ *                           a snake otherwise
+ * Rolls that go past the last cell are not moves, so a game also ends on
+ * a cell whose rolls all go past it.
+ * @param board filled with the board
+ * @param path path of the file
+ * @return EXIT_SUCCESS or EXIT_FAILURE (with the error printed).
+ */
+static int load_board (Board *board, const char *path)
+{
+  *board = (Board) {0};
+  FILE *fp = fopen (path, "r");
+  if (fp == NULL)
+    {
+      printf (ERR_MSG_BOARD_FILE);
+      return EXIT_FAILURE;
+    }
+  char *line = NULL;
+  size_t line_capacity = 0;
+  int line_number = 0;
+  int ans = EXIT_SUCCESS;
+  while (ans == EXIT_SUCCESS && getline (&line, &line_capacity, fp) != -1)
     {
-      from_node = get_node_from_database (markov_chain, cells[i])->data;
+      line_number++;
+      line[strcspn (line, "#")] = '\0';
+      ans = parse_board_line (board, line, line_number);
+    }
+  free (line);
+  fclose (fp);
 
-      if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY)
+  if (ans == EXIT_SUCCESS && board->cells == NULL)
+    {
+      printf (ERR_MSG_BOARD_NO_SIZE);
+      ans = EXIT_FAILURE;
+    }
+  if (ans == EXIT_SUCCESS && board->roll_weights == NULL)
+    {
+      ans = set_dice (board, 1, DICE_MAX, line_number);
+    }
+  if (ans == EXIT_SUCCESS)
+    {
+      ans = check_redirect_cycles (board);
+    }
+  if (ans == EXIT_FAILURE)
+    {
+      free_board (board);
+    }
+  return ans;
+}
+
+/**
+ * fills database with the cells of the board, and the moves between them,
+ * by cell index.
+ * @param markov_chain
+ * @param board the board
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int fill_database (MarkovChain *markov_chain, const Board *board)
+{
+  MarkovNode **nodes = malloc (board->size * sizeof (MarkovNode *));
+  if (nodes == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_INSERT);
+  for (int i = 0; i < board->size; i++)
+    {
+      Node *node = add_to_database (markov_chain, &board->cells[i]);
+      if (node == NULL)
         {
-          index_to = MAX(cells[i]->snake_to, cells[i]->ladder_to) - 1;
-          to_node = get_node_from_database (markov_chain, cells[index_to])
-              ->data;
-          add_node_to_frequencies_list (from_node, to_node, markov_chain);
+          MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+          free (nodes);
+          return EXIT_FAILURE;
         }
-      else
+      nodes[i] = node->data;
+    }
+
+  MARKOV_STATS_PHASE (MARKOV_PHASE_LINK);
+  bool added = true;
+  for (int i = 0; i < board->size - 1 && added; i++)
+    {
+      const Cell *cell = &board->cells[i];
+      int redirect = MAX(cell->snake_to, cell->ladder_to);
+      if (redirect != EMPTY)
         {
-          for (int j = 1; j <= DICE_MAX; j++)
+          added = add_node_to_frequencies_list (nodes[i], nodes[redirect - 1],
+                                                markov_chain);
+          continue;
+        }
+      added = reserve_frequencies_list (nodes[i], board->max_roll,
+                                        markov_chain);
+      for (int roll = 1; roll <= board->max_roll && i + roll < board->size
+                         && added; roll++)
+        {
+          if (board->roll_weights[roll] > 0)
             {
-              index_to = ((Cell *) (from_node->data))->number + j - 1;
-              if (index_to >= BOARD_SIZE)
-                {
-                  break;
-                }
-              to_node = get_node_from_database (markov_chain, cells[index_to])
-                  ->data;
-              add_node_to_frequencies_list (from_node, to_node, markov_chain);
+              added = add_weighted_node_to_frequencies_list
+                  (nodes[i], nodes[i + roll], markov_chain,
+                   board->roll_weights[roll]);
             }
         }
     }
-  // free temp arr
-  for (size_t i = 0; i < BOARD_SIZE; i++)
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  free (nodes);
+  if (!added || !markov_chain_finish_training (markov_chain))
     {
-      free (cells[i]);
+      return EXIT_FAILURE;
     }
   return EXIT_SUCCESS;
 }
 
-static bool ok_arguments_amount_s (int argc)
+static void append_walk_header (unsigned int walk_number,
+                                OutputBuffer *buffer)
+{
+  output_buffer_append_str (buffer, "Random Walk ");
+  output_buffer_append_int (buffer, walk_number);
+  output_buffer_append_str (buffer, ": ");
+}
+
+static bool ok_arguments_amount_s (int argc, const Options *options)
 {
+  if (options->exact)
+    {
+      return argc == EXACT_ARG_COUNT;
+    }
   bool valid = true;
   if (argc != ACCEPTED_ARG_COUNT)
     { valid = false; }
@@ -247,13 +678,17 @@ static bool parse_integer_from_string_s (int *changed_source, char *source)
 }
 
 static int validate_input_s (int argc, char *argv[], int *seed, int
-*paths_amount)
+*paths_amount, const Options *options)
 {
-  if (!ok_arguments_amount_s (argc))
+  if (!ok_arguments_amount_s (argc, options))
     {
       fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
       return EXIT_FAILURE;
     }
+  if (options->exact)
+    {
+      return EXIT_SUCCESS;
+    }
 
   if (parse_integer_from_string_s (seed, argv[SEED]) == false)
     { return EXIT_FAILURE; }
@@ -265,6 +700,237 @@ static int validate_input_s (int argc, char *argv[], int *seed, int
   return EXIT_SUCCESS;
 }
 
+/**
+ * parse the optional flags (see Options), given before the positional
+ * arguments.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int parse_options_s (int argc, char *argv[], Options *options)
+{
+  static const struct option long_options[] = {
+      {"jobs", required_argument, NULL, 'j'},
+      {"exact", no_argument, NULL, 'e'},
+      {"simulate", no_argument, NULL, 'm'},
+      {"max-rolls", required_argument, NULL, 'c'},
+      {"unbatched", no_argument, NULL, 'u'},
+      {"board", required_argument, NULL, 'b'},
+      {"stats", required_argument, NULL, STATS_OPTION},
+      {NULL, 0, NULL, 0}
+  };
+
+  int option;
+  // '+' stops at the first positional argument, so negative seeds work.
+  while ((option = getopt_long (argc, argv, "+j:emc:ub:", long_options, NULL))
+         != -1)
+    {
+      switch (option)
+        {
+          case 'j':
+            if (!parse_integer_from_string_s (&options->generation_threads,
+                                              optarg)
+                || options->generation_threads < 1)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+          break;
+          case 'e':
+            options->exact = true;
+          break;
+          case 'm':
+            options->simulate = true;
+          break;
+          case 'u':
+            options->unbatched = true;
+          break;
+          case 'b':
+            options->board_path = optarg;
+          break;
+          case 'c':
+            if (!parse_integer_from_string_s (&options->max_rolls, optarg)
+                || options->max_rolls < 0)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+          break;
+          case STATS_OPTION:
+            if (strcmp (optarg, STATS_FORMAT_JSON) != 0)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+            options->print_stats = true;
+          break;
+          default:
+            fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+          return EXIT_FAILURE;
+        }
+    }
+  if (options->exact && options->simulate)
+    {
+      fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @param frozen the frozen chain of the board
+ * @return a new array, telling for every cell if the step from it is a dice
+ * roll (and not a ladder or a snake), NULL in case of allocation error.
+ */
+static bool *roll_cells (const FrozenChain *frozen)
+{
+  bool *counts_step = malloc ((frozen->node_count + 1) * sizeof (bool));
+  if (counts_step == NULL)
+    {
+      return NULL;
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const Cell *cell = frozen_node_data (frozen, i);
+      counts_step[i] = cell->ladder_to == EMPTY && cell->snake_to == EMPTY;
+    }
+  return counts_step;
+}
+
+/**
+ * print the exact statistics of a game on the board, from the frozen
+ * chain (see absorbing_chain.h). The length of a game is the amount of
+ * dice rolls, so following a ladder or a snake is not counted.
+ * @param markov_chain the frozen chain of the board
+ * @param first the cell every game starts from
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int print_exact_stats (const MarkovChain *markov_chain,
+                              const MarkovNode *first)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  bool *counts_step = roll_cells (frozen);
+  if (counts_step == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+
+  AbsorbingChainStats stats;
+  bool analyzed = absorbing_chain_analyze (frozen, (uint32_t) first->index,
+                                           counts_step, EXACT_HORIZON,
+                                           EXACT_CURVE_TAIL, &stats);
+  free (counts_step);
+  if (!analyzed)
+    {
+      return EXIT_FAILURE;
+    }
+
+  if (!stats.converged)
+    {
+      printf (ERR_MSG_NOT_CONVERGED);
+    }
+  printf ("Expected game length: %.6f\n", stats.expected_length);
+  printf ("Game length variance: %.6f\n", stats.length_variance);
+  printf ("P(finish <= k):\n");
+  for (uint32_t k = 1; k <= stats.horizon; k++)
+    {
+      printf ("%u %.9f\n", k, stats.finish_probability[k]);
+    }
+  printf ("Expected visits per cell:\n");
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const Cell *cell = frozen_node_data (frozen, i);
+      printf ("[%d] %.6f\n", cell->number, stats.expected_visits[i]);
+    }
+  absorbing_chain_stats_free (&stats);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * play games on the board without printing them, and print their
+ * statistics: how many finished within the roll cap, the histograms of
+ * the game length (in rolls) and of the amount of ladders and snakes taken
+ * per game, and the average visits of every cell per game.
+ * @param markov_chain the frozen chain of the board
+ * @param first the cell every game starts from
+ * @param games amount of games to play
+ * @param seed the seed of the run
+ * @param options the flags of the run
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int print_simulation_stats (const MarkovChain *markov_chain,
+                                   const MarkovNode *first,
+                                   uint64_t games, uint64_t seed,
+                                   const Options *options)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  bool *counts_step = roll_cells (frozen);
+  if (counts_step == NULL)
+    {
+      return handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+
+  WalkSimulationStats stats;
+  bool simulated = walk_simulation_run (frozen, (uint32_t) first->index,
+                                        counts_step,
+                                        (uint32_t) options->max_rolls,
+                                        games, seed,
+                                        options->generation_threads,
+                                        !options->unbatched, &stats);
+  free (counts_step);
+  if (!simulated)
+    {
+      return EXIT_FAILURE;
+    }
+
+  uint64_t ladder_hits = 0, snake_hits = 0;
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const Cell *cell = frozen_node_data (frozen, i);
+      if (cell->ladder_to != EMPTY)
+        {
+          ladder_hits += stats.visits[i];
+        }
+      else if (cell->snake_to != EMPTY)
+        {
+          snake_hits += stats.visits[i];
+        }
+    }
+
+  printf ("Games: %" PRIu64 "\n", stats.walks);
+  printf ("Finished within %u rolls: %" PRIu64 "\n", stats.max_steps,
+          stats.finished);
+  printf ("Mean game length: %.6f\n", stats.finished > 0
+                                       ? (double) stats.finished_steps
+                                         / stats.finished : 0);
+  printf ("Ladders taken: %" PRIu64 "\n", ladder_hits);
+  printf ("Snakes taken: %" PRIu64 "\n", snake_hits);
+  printf ("Game length histogram:\n");
+  for (uint32_t k = 0; k <= stats.max_steps; k++)
+    {
+      if (stats.length_histogram[k] != 0)
+        {
+          printf ("%u %" PRIu64 "\n", k, stats.length_histogram[k]);
+        }
+    }
+  printf ("Ladders and snakes per game histogram:\n");
+  for (uint32_t k = 0; k <= stats.max_steps + 1; k++)
+    {
+      if (stats.redirect_histogram[k] != 0)
+        {
+          printf ("%u %" PRIu64 "\n", k, stats.redirect_histogram[k]);
+        }
+    }
+  printf ("Visits per cell per game:\n");
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const Cell *cell = frozen_node_data (frozen, i);
+      printf ("[%d] %.6f\n", cell->number, stats.walks > 0
+                                           ? (double) stats.visits[i]
+                                             / stats.walks : 0);
+    }
+  walk_simulation_stats_free (&stats);
+  return EXIT_SUCCESS;
+}
+
 /**
  * @param argc num of arguments
  * @param argv 1) Seed
@@ -275,39 +941,93 @@ int main (int argc, char *argv[])
 {
   int seed = TEMP_NUMBER;
   int paths_amount = TEMP_NUMBER;
-  if (validate_input_s (argc, argv, &seed, &paths_amount) == EXIT_FAILURE)
+  Options options = {.generation_threads = 1,
+                     .max_rolls = DEFAULT_SIMULATION_ROLLS};
+  if (parse_options_s (argc, argv, &options) == EXIT_FAILURE)
+    { return EXIT_FAILURE; }
+
+  // from here on the positional arguments start at argv[1].
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (validate_input_s (argc, argv, &seed, &paths_amount, &options)
+      == EXIT_FAILURE)
     { return EXIT_FAILURE; }
 
-  return snakes_and_ladders_logic (seed, paths_amount);
+  return snakes_and_ladders_logic (seed, paths_amount, &options);
 }
 
-int snakes_and_ladders_logic (int seed, int paths_amount)
+int snakes_and_ladders_logic (int seed, int paths_amount,
+                              const Options *options)
 {
-  srand (seed);
-
   // defining the params.
   LinkedList linked_list = {.first = NULL, .last = NULL, .size = 0};
   MarkovChain markov_chain = {0};
   markov_chain.database = &linked_list;
   markov_chain.print_func = print_struct_cell;
+  markov_chain.append_func = append_struct_cell;
   markov_chain.comp_func = comp_struct_cell;
   markov_chain.free_data = free_struct_cell;
   markov_chain.copy_func = copy_struct_cell;
   markov_chain.is_last = is_last_struct_cell;
+  markov_chain.hash_func = hash_struct_cell;
+  markov_chain.size_func = size_struct_cell;
   MarkovChain *markov_chain_ptr = &markov_chain;
 
-  int ans = fill_database (markov_chain_ptr);
-  if (ans == EXIT_FAILURE) // check!
+  Board board;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_READ);
+  int ans = (options->board_path != NULL)
+            ? load_board (&board, options->board_path)
+            : create_board (&board);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  if (ans == EXIT_FAILURE)
     {
       return EXIT_FAILURE;
     }
+  last_cell_number = board.size;
+
+  // the cells are looked up by their number, and the chain points to the
+  // board's cells instead of copying them.
+  if (!markov_chain_use_arena (markov_chain_ptr)
+      || !markov_chain_use_dense_keys (markov_chain_ptr, key_struct_cell,
+                                       board.size, true)
+      || fill_database (markov_chain_ptr, &board) == EXIT_FAILURE
+      || !markov_chain_freeze (markov_chain_ptr))
+    {
+      free_database (&markov_chain_ptr);
+      free_board (&board);
+      return EXIT_FAILURE;
+    }
 
   MarkovNode *first = markov_chain_ptr->database->first->data;
-  for (int i = 0; i < paths_amount; i++)
+  if (options->exact)
     {
-      printf ("Random Walk %d: ", i + 1);
-      generate_tweet (markov_chain_ptr, first, MAX_GENERATION_LENGTH);
+      ans = print_exact_stats (markov_chain_ptr, first);
+    }
+  else if (options->simulate)
+    {
+      ans = print_simulation_stats (markov_chain_ptr, first,
+                                    paths_amount > 0
+                                    ? (uint64_t) paths_amount : 0,
+                                    (unsigned int) seed, options);
+    }
+  else
+    {
+      // every walk has a stream of its own, so it depends only on the seed
+      // and its index, and not on the amount of threads.
+      ans = generate_sequences (markov_chain_ptr, first,
+                                MAX_GENERATION_LENGTH,
+                                paths_amount > 0 ? (unsigned int) paths_amount
+                                                 : 0,
+                                (unsigned int) seed,
+                                options->generation_threads,
+                                append_walk_header);
     }
   free_database (&markov_chain_ptr);
-  return EXIT_SUCCESS;
+  free_board (&board);
+  if (options->print_stats)
+    {
+      MarkovStats stats = markov_chain_stats ();
+      markov_stats_print_json (&stats, stderr);
+    }
+  return ans;
 }
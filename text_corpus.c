@@ -0,0 +1,743 @@
+#define _GNU_SOURCE // for getline()
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "text_corpus.h"
+#include "markov_chain_str.h"
+#include "markov_chain_view.h"
+
+#define INITIAL_TOKEN_CAPACITY 64
+
+// bytes read at once from a non regular file.
+#define STREAM_CHUNK_SIZE (1UL << 16)
+
+// shards smaller than this are not worth a thread of their own.
+#define MIN_SHARD_SIZE (1UL << 16)
+#define MAX_TRAINING_THREADS 256
+
+/**
+ * A byte range of the corpus, trained into a chain of its own.
+ */
+typedef struct TrainingShard {
+    const char *text;
+    size_t length;
+    LinkedList database;
+    MarkovChain markov_chain;
+    TextCursor cursor;
+    int ans;
+} TrainingShard;
+
+/**
+ * How the words of a chain of words are added: through the function
+ * pointers, or inlined for the chains of markov_chain_str and of
+ * markov_chain_view.
+ */
+typedef enum WordKind {
+    WORD_GENERIC,
+    WORD_STR,
+    WORD_VIEW
+} WordKind;
+
+#define ERR_MSG_VIEWS_NEED_ARENA \
+  "Error: a chain of token views must use an arena.\n"
+
+#define ERR_MSG_NGRAMS_NEED_ARENA \
+  "Error: a chain of n-grams must use an arena.\n"
+
+static bool is_delimiter (char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void text_cursor_init (TextCursor *cursor, int words_to_read)
+{
+  cursor->prev = NULL;
+  cursor->word_count = 0;
+  cursor->words_to_read = words_to_read;
+  cursor->token = NULL;
+  cursor->token_capacity = 0;
+  cursor->tokens = NULL;
+  cursor->context.state = NULL;
+  cursor->pending = NULL;
+  cursor->pending_length = 0;
+  cursor->pending_capacity = 0;
+}
+
+bool text_cursor_set_order (TextCursor *cursor,
+                            const MarkovChain *markov_chain, uint32_t order)
+{
+  if (order <= 1)
+    {
+      return true;
+    }
+  if (markov_chain->arena == NULL)
+    {
+      fprintf (stdout, ERR_MSG_NGRAMS_NEED_ARENA);
+      return false;
+    }
+  cursor->tokens = token_table_create (markov_chain->arena);
+  if (cursor->tokens == NULL || !ngram_context_init (&cursor->context, order))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  return true;
+}
+
+void text_cursor_free (TextCursor *cursor)
+{
+  free (cursor->token);
+  cursor->token = NULL;
+  cursor->token_capacity = 0;
+  token_table_free (cursor->tokens);
+  cursor->tokens = NULL;
+  ngram_context_free (&cursor->context);
+  free (cursor->pending);
+  cursor->pending = NULL;
+  cursor->pending_length = 0;
+  cursor->pending_capacity = 0;
+}
+
+/**
+ * build the state of an order > 1 chain that ends with the given word.
+ * @return the state, NULL in case of allocation error.
+ */
+static void *ngram_key (const char *word, size_t length, TextCursor *cursor)
+{
+  if (cursor->prev == NULL)
+    {
+      ngram_context_reset (&cursor->context);
+    }
+  uint32_t token;
+  if (!token_table_intern (cursor->tokens, word, length, &token))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+  ngram_context_push (&cursor->context, cursor->tokens, token);
+  return cursor->context.state;
+}
+
+bool text_cursor_done (const TextCursor *cursor)
+{
+  return cursor->words_to_read != TEXT_CORPUS_ALL_WORDS
+         && cursor->word_count >= cursor->words_to_read;
+}
+
+/**
+ * make room for size bytes in a buffer, doubling its capacity.
+ * @return true on success, false in case of allocation error.
+ */
+static bool reserve_buffer (char **buffer, size_t *capacity, size_t size)
+{
+  if (size <= *capacity)
+    {
+      return true;
+    }
+  size_t new_capacity = *capacity ? *capacity : INITIAL_TOKEN_CAPACITY;
+  while (new_capacity < size)
+    {
+      new_capacity *= 2;
+    }
+  MARKOV_STATS_ALLOCATION (new_capacity);
+  char *new_buffer = realloc (*buffer, new_capacity);
+  if (new_buffer == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  *buffer = new_buffer;
+  *capacity = new_capacity;
+  return true;
+}
+
+static WordKind word_kind (const MarkovChain *markov_chain,
+                           const TextCursor *cursor)
+{
+  if (cursor->tokens != NULL)
+    {
+      return WORD_GENERIC;
+    }
+  if (markov_chain_view_matches (markov_chain))
+    {
+      return WORD_VIEW;
+    }
+  return markov_chain_str_matches (markov_chain) ? WORD_STR : WORD_GENERIC;
+}
+
+/**
+ * @return true if a sentence continues after the given state.
+ */
+static bool state_is_last (const MarkovChain *markov_chain, WordKind kind,
+                           const void *state)
+{
+  switch (kind)
+    {
+      case WORD_VIEW:
+        return markov_chain_view_is_last (state);
+      case WORD_STR:
+        return markov_chain_str_is_last (state);
+      default:
+        return markov_chain->is_last (state);
+    }
+}
+
+/**
+ * keep length bytes of corpus in the chain's arena, for a chain of token
+ * views to point into.
+ * @return the bytes, NULL in case of allocation error or if the chain has
+ * no arena.
+ */
+static char *retain_text (MarkovChain *markov_chain, size_t length)
+{
+  if (markov_chain->arena == NULL)
+    {
+      fprintf (stdout, ERR_MSG_VIEWS_NEED_ARENA);
+      return NULL;
+    }
+  char *text = arena_alloc (markov_chain->arena, length);
+  if (text == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+    }
+  return text;
+}
+
+/**
+ * make the arena of a chain of token views own the mapping of a corpus.
+ * @return true on success, false in case of allocation error or if the
+ * chain has no arena.
+ */
+static bool retain_mapping (MarkovChain *markov_chain, void *text,
+                            size_t length)
+{
+  if (markov_chain->arena == NULL)
+    {
+      fprintf (stdout, ERR_MSG_VIEWS_NEED_ARENA);
+      return false;
+    }
+  if (!arena_adopt_mapping (markov_chain->arena, text, length))
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * add one word to the chain and link it to the previous word of the line.
+ * A chain of token views keeps pointing at word.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int add_word (MarkovChain *markov_chain, const char *word,
+                     size_t length, TextCursor *cursor)
+{
+  WordKind kind = word_kind (markov_chain, cursor);
+  TokenView view = {word, (uint32_t) length};
+  void *key = &view;
+  if (cursor->tokens != NULL)
+    {
+      key = ngram_key (word, length, cursor);
+      if (key == NULL)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+  else if (kind != WORD_VIEW)
+    {
+      if (!reserve_buffer (&cursor->token, &cursor->token_capacity,
+                           length + 1))
+        {
+          return EXIT_FAILURE;
+        }
+      memcpy (cursor->token, word, length);
+      cursor->token[length] = '\0';
+      key = cursor->token;
+    }
+
+  MARKOV_STATS_PHASE (MARKOV_PHASE_INSERT);
+  // chains of words take the lookup with the hash and comparison inlined.
+  Node *curr;
+  switch (kind)
+    {
+      case WORD_VIEW:
+        curr = markov_chain_view_add_to_database (markov_chain, &view);
+      break;
+      case WORD_STR:
+        curr = markov_chain_str_add_to_database (markov_chain, key);
+      break;
+      default:
+        curr = add_to_database (markov_chain, key);
+    }
+  cursor->word_count++;
+  if (curr == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_LINK);
+  if (cursor->prev == NULL
+      || !state_is_last (markov_chain, kind, cursor->prev->data->data))
+    {
+      mark_sentence_start (markov_chain, curr->data);
+    }
+  if (cursor->prev != NULL)
+    {
+      if (!add_node_to_frequencies_list (cursor->prev->data, curr->data,
+                                         markov_chain))
+        {
+          return EXIT_FAILURE;
+        }
+    }
+  cursor->prev = curr;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_TOKENIZE);
+  return EXIT_SUCCESS;
+}
+
+int train_on_text (MarkovChain *markov_chain, const char *text,
+                   size_t length, TextCursor *cursor)
+{
+  size_t position = 0;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_TOKENIZE);
+  while (position < length && !text_cursor_done (cursor))
+    {
+      if (text[position] == '\n')
+        {
+          cursor->prev = NULL;
+          position++;
+          continue;
+        }
+      if (is_delimiter (text[position]))
+        {
+          position++;
+          continue;
+        }
+
+      size_t word_start = position;
+      while (position < length && !is_delimiter (text[position]))
+        {
+          position++;
+        }
+      if (add_word (markov_chain, text + word_start, position - word_start,
+                    cursor) == EXIT_FAILURE)
+        {
+          MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+          return EXIT_FAILURE;
+        }
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  return EXIT_SUCCESS;
+}
+
+int train_on_chunk (MarkovChain *markov_chain, const char *text,
+                    size_t length, TextCursor *cursor)
+{
+  size_t position = 0;
+  if (cursor->pending_length > 0)
+    {
+      // the first bytes of the chunk may complete the pending word.
+      while (position < length && !is_delimiter (text[position]))
+        {
+          position++;
+        }
+      if (!reserve_buffer (&cursor->pending, &cursor->pending_capacity,
+                           cursor->pending_length + position))
+        {
+          return EXIT_FAILURE;
+        }
+      memcpy (cursor->pending + cursor->pending_length, text, position);
+      cursor->pending_length += position;
+      if (position == length)
+        {
+          return EXIT_SUCCESS;
+        }
+      if (text_cursor_flush (markov_chain, cursor) == EXIT_FAILURE)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+
+  // a word at the end of the chunk may continue in the next one.
+  size_t end = length;
+  while (end > position && !is_delimiter (text[end - 1]))
+    {
+      end--;
+    }
+  if (train_on_text (markov_chain, text + position, end - position,
+                     cursor) == EXIT_FAILURE)
+    {
+      return EXIT_FAILURE;
+    }
+  if (end < length && !text_cursor_done (cursor))
+    {
+      if (!reserve_buffer (&cursor->pending, &cursor->pending_capacity,
+                           length - end))
+        {
+          return EXIT_FAILURE;
+        }
+      memcpy (cursor->pending, text + end, length - end);
+      cursor->pending_length = length - end;
+    }
+  return EXIT_SUCCESS;
+}
+
+int text_cursor_flush (MarkovChain *markov_chain, TextCursor *cursor)
+{
+  if (cursor->pending_length == 0 || text_cursor_done (cursor))
+    {
+      cursor->pending_length = 0;
+      return EXIT_SUCCESS;
+    }
+  const char *word = cursor->pending;
+  if (word_kind (markov_chain, cursor) == WORD_VIEW)
+    {
+      // the pending bytes are overwritten by the next chunk.
+      char *retained = retain_text (markov_chain, cursor->pending_length);
+      if (retained == NULL)
+        {
+          return EXIT_FAILURE;
+        }
+      memcpy (retained, cursor->pending, cursor->pending_length);
+      word = retained;
+    }
+  int ans = add_word (markov_chain, word, cursor->pending_length, cursor);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  cursor->pending_length = 0;
+  return ans;
+}
+
+/**
+ * @return true if a line break comes before the first word of text (or
+ * anywhere in text, if it has no words).
+ */
+static bool starts_with_line_break (const char *text, size_t length)
+{
+  for (size_t i = 0; i < length && is_delimiter (text[i]); i++)
+    {
+      if (text[i] == '\n')
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+static void *train_shard (void *arg)
+{
+  TrainingShard *shard = (TrainingShard *) arg;
+  shard->ans = train_on_text (&shard->markov_chain, shard->text,
+                              shard->length, &shard->cursor);
+  return NULL;
+}
+
+/**
+ * set up an empty chain with the same callbacks (and allocation mode) as
+ * markov_chain.
+ * @return true on success, false in case of allocation error.
+ */
+static bool init_shard_chain (TrainingShard *shard,
+                              const MarkovChain *markov_chain)
+{
+  shard->database = (LinkedList) {NULL, NULL, 0};
+  shard->markov_chain = (MarkovChain) {0};
+  shard->markov_chain.database = &shard->database;
+  shard->markov_chain.print_func = markov_chain->print_func;
+  shard->markov_chain.comp_func = markov_chain->comp_func;
+  shard->markov_chain.free_data = markov_chain->free_data;
+  shard->markov_chain.copy_func = markov_chain->copy_func;
+  shard->markov_chain.is_last = markov_chain->is_last;
+  shard->markov_chain.hash_func = markov_chain->hash_func;
+  shard->markov_chain.size_func = markov_chain->size_func;
+  shard->markov_chain.flat_size_func = markov_chain->flat_size_func;
+  shard->markov_chain.pack_func = markov_chain->pack_func;
+  text_cursor_init (&shard->cursor, TEXT_CORPUS_ALL_WORDS);
+  shard->ans = EXIT_SUCCESS;
+  if (markov_chain->arena != NULL)
+    {
+      return markov_chain_use_arena (&shard->markov_chain);
+    }
+  return true;
+}
+
+/**
+ * split text into shard_count byte ranges, each ending on a delimiter.
+ */
+static void split_to_shards (const char *text, size_t length,
+                             TrainingShard *shards, int shard_count)
+{
+  size_t start = 0;
+  for (int i = 0; i < shard_count; i++)
+    {
+      size_t end = length;
+      if (i < shard_count - 1)
+        {
+          end = length / shard_count * (i + 1);
+          if (end < start)
+            {
+              end = start;
+            }
+          while (end < length && !is_delimiter (text[end]))
+            {
+              end++;
+            }
+        }
+      shards[i].text = text + start;
+      shards[i].length = end - start;
+      start = end;
+    }
+}
+
+/**
+ * merge the chain of one shard into markov_chain, and add the transition
+ * from the last word before the shard to its first word, if they are on
+ * the same line.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int merge_shard (MarkovChain *markov_chain, TrainingShard *shard,
+                        TextCursor *cursor)
+{
+  Node **merged_nodes = malloc ((shard->database.size + 1) * sizeof (Node *));
+  if (merged_nodes == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_INSERT);
+  bool merged = markov_chain_merge_states (markov_chain,
+                                           &shard->markov_chain,
+                                           merged_nodes);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_LINK);
+  if (!merged)
+    {
+      MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+      free (merged_nodes);
+      return EXIT_FAILURE;
+    }
+
+  bool line_break = starts_with_line_break (shard->text, shard->length);
+  if (shard->database.size == 0)
+    {
+      if (line_break)
+        {
+          cursor->prev = NULL;
+        }
+    }
+  else
+    {
+      // the first word of the shard is the first state of its database.
+      MarkovNode *first_node = merged_nodes[0]->data;
+      if (cursor->prev != NULL && !line_break)
+        {
+          if (!add_node_to_frequencies_list (cursor->prev->data, first_node,
+                                             markov_chain))
+            {
+              MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+              free (merged_nodes);
+              return EXIT_FAILURE;
+            }
+          // the shard counted its first word as the start of a sentence,
+          // which it is only if the word before ended one.
+          if (markov_chain->is_last (cursor->prev->data->data))
+            {
+              first_node->start_frequency--;
+            }
+        }
+      cursor->prev = (shard->cursor.prev != NULL)
+                     ? merged_nodes[shard->cursor.prev->data->index] : NULL;
+    }
+
+  merged = markov_chain_merge_frequencies (markov_chain,
+                                           &shard->markov_chain,
+                                           merged_nodes);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  free (merged_nodes);
+  cursor->word_count += shard->cursor.word_count;
+  return merged ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int train_on_text_parallel (MarkovChain *markov_chain, const char *text,
+                            size_t length, TextCursor *cursor, int threads)
+{
+  int shard_count = threads;
+  if (shard_count > MAX_TRAINING_THREADS)
+    {
+      shard_count = MAX_TRAINING_THREADS;
+    }
+  if ((size_t) shard_count > length / MIN_SHARD_SIZE)
+    {
+      shard_count = (int) (length / MIN_SHARD_SIZE);
+    }
+  if (shard_count <= 1 || cursor->words_to_read != TEXT_CORPUS_ALL_WORDS
+      || cursor->tokens != NULL)
+    {
+      // the word limit and the token ids can only be applied in order.
+      return train_on_text (markov_chain, text, length, cursor);
+    }
+
+  TrainingShard *shards = calloc (shard_count, sizeof (TrainingShard));
+  pthread_t *thread_ids = calloc (shard_count, sizeof (pthread_t));
+  bool *started = calloc (shard_count, sizeof (bool));
+  if (shards == NULL || thread_ids == NULL || started == NULL)
+    {
+      free (shards);
+      free (thread_ids);
+      free (started);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  split_to_shards (text, length, shards, shard_count);
+
+  int ans = EXIT_SUCCESS;
+  for (int i = 0; i < shard_count; i++)
+    {
+      if (!init_shard_chain (&shards[i], markov_chain))
+        {
+          shards[i].ans = EXIT_FAILURE;
+          continue;
+        }
+      started[i] = pthread_create (&thread_ids[i], NULL, train_shard,
+                                   &shards[i]) == 0;
+      if (!started[i])
+        {
+          train_shard (&shards[i]);
+        }
+    }
+
+  for (int i = 0; i < shard_count; i++)
+    {
+      if (started[i])
+        {
+          pthread_join (thread_ids[i], NULL);
+        }
+    }
+
+  // merging in corpus order keeps the order of the states and of every
+  // frequencies list the same as in sequential training.
+  for (int i = 0; i < shard_count; i++)
+    {
+      if (ans == EXIT_SUCCESS)
+        {
+          ans = shards[i].ans;
+        }
+      if (ans == EXIT_SUCCESS)
+        {
+          ans = merge_shard (markov_chain, &shards[i], cursor);
+        }
+      MarkovChain *shard_chain = &shards[i].markov_chain;
+      free_database (&shard_chain);
+      text_cursor_free (&shards[i].cursor);
+    }
+
+  free (shards);
+  free (thread_ids);
+  free (started);
+  return ans;
+}
+
+/**
+ * read the next chunk of a file.
+ * @return the amount of bytes read, 0 at the end of the file.
+ */
+static size_t read_chunk (char *chunk, FILE *fp)
+{
+  MARKOV_STATS_PHASE (MARKOV_PHASE_READ);
+  size_t chunk_length = fread (chunk, 1, STREAM_CHUNK_SIZE, fp);
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  return chunk_length;
+}
+
+/**
+ * read a non regular file chunk by chunk, with no limit on the line length.
+ */
+static int train_on_stream (FILE *fp, MarkovChain *markov_chain,
+                            TextCursor *cursor)
+{
+  // a chain of token views points into every chunk, so each one is read
+  // into the chain's arena; the others reuse one buffer.
+  bool views = word_kind (markov_chain, cursor) == WORD_VIEW;
+  char *chunk = views ? NULL : malloc (STREAM_CHUNK_SIZE);
+  if (!views && chunk == NULL)
+    {
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  int ans = EXIT_SUCCESS;
+  size_t chunk_length;
+  while (!text_cursor_done (cursor))
+    {
+      if (views
+          && (chunk = retain_text (markov_chain, STREAM_CHUNK_SIZE)) == NULL)
+        {
+          ans = EXIT_FAILURE;
+          break;
+        }
+      chunk_length = read_chunk (chunk, fp);
+      if (chunk_length == 0)
+        {
+          break;
+        }
+      ans = train_on_chunk (markov_chain, chunk, chunk_length, cursor);
+      if (ans == EXIT_FAILURE)
+        {
+          break;
+        }
+    }
+  if (!views)
+    {
+      free (chunk);
+    }
+  if (ans == EXIT_SUCCESS)
+    {
+      ans = text_cursor_flush (markov_chain, cursor);
+    }
+  return ans;
+}
+
+int train_on_file (FILE *fp, MarkovChain *markov_chain, TextCursor *cursor,
+                   int threads)
+{
+  if (fp == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+
+  struct stat file_stat;
+  int fd = fileno (fp);
+  if (fstat (fd, &file_stat) != 0 || !S_ISREG (file_stat.st_mode))
+    {
+      return train_on_stream (fp, markov_chain, cursor);
+    }
+  if (file_stat.st_size == 0)
+    {
+      return EXIT_SUCCESS;
+    }
+
+  size_t length = (size_t) file_stat.st_size;
+  MARKOV_STATS_PHASE (MARKOV_PHASE_READ);
+  char *text = mmap (NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text != MAP_FAILED)
+    {
+      madvise (text, length, MADV_SEQUENTIAL);
+    }
+  MARKOV_STATS_PHASE (MARKOV_PHASE_NONE);
+  if (text == MAP_FAILED)
+    {
+      return train_on_stream (fp, markov_chain, cursor);
+    }
+
+  // a chain of token views points into the mapping, so the chain's arena
+  // keeps it until the training state is released.
+  bool views = word_kind (markov_chain, cursor) == WORD_VIEW;
+  if (views && !retain_mapping (markov_chain, text, length))
+    {
+      munmap (text, length);
+      return EXIT_FAILURE;
+    }
+  int ans = train_on_text_parallel (markov_chain, text, length, cursor,
+                                    threads);
+  if (!views)
+    {
+      munmap (text, length);
+    }
+  return ans;
+}
@@ -0,0 +1,148 @@
+#ifndef _TEXT_CORPUS_H_
+#define _TEXT_CORPUS_H_
+
+#include "markov_chain.h"
+#include "ngram.h"
+
+// words_to_read value of a cursor that reads the whole corpus.
+#define TEXT_CORPUS_ALL_WORDS (-1)
+
+/**
+ * State of the training over a text corpus. Words are separated by
+ * spaces, tabs and line breaks, and a line break ends the current chain of
+ * words.
+ */
+typedef struct TextCursor {
+    // last word of the current line, NULL at the start of a line.
+    Node *prev;
+
+    int word_count;
+
+    // maximum amount of words to read, or TEXT_CORPUS_ALL_WORDS.
+    int words_to_read;
+
+    // NUL terminated copy of the word being added.
+    char *token;
+    size_t token_capacity;
+
+    // interned words of an order > 1 chain, NULL for a chain of words.
+    TokenTable *tokens;
+    // the last words of the current line, the key of an order > 1 chain.
+    NgramContext context;
+
+    // the end of the last chunk given to train_on_chunk, when it ended in
+    // the middle of a word.
+    char *pending;
+    size_t pending_length;
+    size_t pending_capacity;
+} TextCursor;
+
+/**
+ * Initialize a cursor at the start of a corpus.
+ * @param cursor the cursor to initialize
+ * @param words_to_read maximum amount of words to read, or
+ * TEXT_CORPUS_ALL_WORDS
+ */
+void text_cursor_init (TextCursor *cursor, int words_to_read);
+
+/**
+ * Make the cursor train a chain of order k: the states are the last k
+ * words of a line, as NgramState. An order of 1 keeps states of words.
+ * The words of the states are interned into the chain's arena, so they
+ * live as long as the chain and not only as the cursor.
+ * @param cursor the cursor, before reading any word
+ * @param markov_chain the chain the cursor trains, which must use an arena
+ * for an order > 1 (see markov_chain_use_arena)
+ * @param order amount of words in a state, 1 .. NGRAM_MAX_ORDER
+ * @return true on success, false if the chain has no arena or in case of
+ * allocation error.
+ */
+bool text_cursor_set_order (TextCursor *cursor,
+                            const MarkovChain *markov_chain, uint32_t order);
+
+/**
+ * Free the memory held by a cursor.
+ * @param cursor the cursor to free
+ */
+void text_cursor_free (TextCursor *cursor);
+
+/**
+ * @param cursor the cursor
+ * @return true if the cursor already read all the words it may read.
+ */
+bool text_cursor_done (const TextCursor *cursor);
+
+/**
+ * Add the words of text to the chain, scanning the bytes in place (text
+ * doesn't have to be NUL terminated). A chain of token views (see
+ * markov_chain_view.h) points into text, which must then outlive it.
+ * @param markov_chain the chain to train
+ * @param text the text to read
+ * @param length length of text in bytes
+ * @param cursor the training state, updated
+ * @return EXIT_SUCCESS or EXIT_FAILURE in case of allocation error.
+ */
+int train_on_text (MarkovChain *markov_chain, const char *text,
+                   size_t length, TextCursor *cursor);
+
+/**
+ * Add the words of the next chunk of a corpus to the chain, for corpora
+ * that arrive piece by piece. Unlike train_on_text, a word at the end of
+ * the chunk is kept in the cursor, since the next chunk may continue it,
+ * and the line goes on in the next chunk too; so training on the chunks
+ * of a text one by one gives the same chain as training on the whole
+ * text. The chain may be frozen and generate between chunks, once
+ * markov_chain_finish_training updated it. A chain of token views points
+ * into the chunks, which must outlive it (a word split between chunks is
+ * kept in the chain's arena).
+ * @param markov_chain the chain to train
+ * @param text the chunk to read
+ * @param length length of the chunk in bytes
+ * @param cursor the training state, updated
+ * @return EXIT_SUCCESS or EXIT_FAILURE in case of allocation error.
+ */
+int train_on_chunk (MarkovChain *markov_chain, const char *text,
+                    size_t length, TextCursor *cursor);
+
+/**
+ * Add the word the last chunk ended with, if any, once the corpus ended.
+ * @param markov_chain the chain to train
+ * @param cursor the training state, updated
+ * @return EXIT_SUCCESS or EXIT_FAILURE in case of allocation error.
+ */
+int text_cursor_flush (MarkovChain *markov_chain, TextCursor *cursor);
+
+/**
+ * Same as train_on_text, but the text is split into byte ranges (on word
+ * boundaries) that are trained by several threads into chains of their
+ * own, and then merged in order. The result is identical to train_on_text.
+ * Falls back to train_on_text for small texts, when the cursor has a
+ * word limit, or when it trains an order > 1 chain (the token ids are
+ * given in order).
+ * @param markov_chain the chain to train
+ * @param text the text to read
+ * @param length length of text in bytes
+ * @param cursor the training state, updated
+ * @param threads maximum amount of threads to use
+ * @return EXIT_SUCCESS or EXIT_FAILURE in case of allocation error.
+ */
+int train_on_text_parallel (MarkovChain *markov_chain, const char *text,
+                            size_t length, TextCursor *cursor, int threads);
+
+/**
+ * Add the words of a whole file to the chain. Regular files are mapped to
+ * memory and read sequentially (by up to threads threads, see
+ * train_on_text_parallel); other files (pipes, terminals) are read chunk
+ * by chunk with stdio (see train_on_chunk). A chain of token views points
+ * into the corpus, so no word is copied: the chain's arena keeps the
+ * mapping of a regular file, and the chunks of other files.
+ * @param fp the file to read, at its start
+ * @param markov_chain the chain to train
+ * @param cursor the training state, updated
+ * @param threads maximum amount of training threads
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int train_on_file (FILE *fp, MarkovChain *markov_chain, TextCursor *cursor,
+                   int threads);
+
+#endif //_TEXT_CORPUS_H_
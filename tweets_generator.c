@@ -1,14 +1,29 @@
 #include "markov_chain.h"
+#include "markov_chain_str.h"
+#include "markov_chain_view.h"
+#include "text_corpus.h"
+#include "parallel_generation.h"
+#include "ngram.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h> // for getopt_long()
 
 #define WORD_MAX_LENGTH 100
-#define BUFFER_SIZE 1000
 #define FULL_AMOUNT_OF_ARGC 5
 #define ACCEPTED_AMOUNT_OF_ARGC 4
+#define SNAPSHOT_AMOUNT_OF_ARGC 3
 #define TEMP_NUMBER (-100)
-#define DELIMITERS "\n\r\t "
+
+// long options without a short letter.
+#define STATS_OPTION 256
+#define MEMORY_OPTION 257
+#define MIN_COUNT_OPTION 258
+#define TOP_K_OPTION 259
+#define BUDGET_OPTION 260
+#define QUANTIZE_OPTION 261
+#define PRUNE_REPORT_OPTION 262
+#define STATS_FORMAT_JSON "json"
 
 typedef enum Program {
     SEED = 1,
@@ -17,32 +32,94 @@ typedef enum Program {
     WORD_TO_READ
 } Program;
 
+/**
+ * the optional flags of the program, given before the positional arguments
+ */
+typedef struct Options {
+    // -t, --train-threads <n>: amount of threads used for training.
+    int training_threads;
+
+    // -s, --save <path>: snapshot file to write the trained chain to.
+    const char *snapshot_to_save;
+
+    // -l, --load <path>: snapshot file to generate from, instead of
+    // training on a text corpus (which is then not given).
+    const char *snapshot_to_load;
+
+    // -w, --weighted-start: start tweets with words that started sentences
+    // in the corpus, as often as they did.
+    bool weighted_start;
+
+    // -j, --jobs <n>: amount of threads generating the tweets.
+    int generation_threads;
+
+    // -n, --order <k>: amount of previous words a word depends on. A
+    // snapshot has to be loaded with the order it was trained with.
+    int order;
+
+    // --stats=json: print the hot path counters (see markov_stats.h) to
+    // stderr at the end.
+    bool print_stats;
+
+    // --memory=json: print the memory the chain took for training, and
+    // after it was compacted (and pruned) for generation, to stderr.
+    bool print_memory;
+
+    // --min-count <n>, --top-k <k>, --budget <bytes>, --quantize: prune
+    // the chain before generating (and saving) it, see PruneOptions.
+    PruneOptions prune_options;
+    bool prune;
+
+    // --prune-report=json: print how pruning changed the chain to stderr.
+    bool print_prune_report;
+} Options;
+
 
 // ERROR MESSAGE'S SECTION:
 
 #define ERR_MSG_FILE_PATH "Error: the program have an invalid file path.\n"
 
 #define ERR_MSG_USAGE_PROBLEM "Usage: Please fill the following command's \
-./tweets_generator_logic <seed> <number of tweets> <text corpus path> \
-[words to read].\n"
+./tweets_generator_logic [-t <training threads>] [-s <snapshot to save>] \
+[-w] [-j <generation threads>] [-n <order>] <seed> <number of tweets> \
+<text corpus path> [words to read], or ./tweets_generator_logic \
+-l <snapshot to load> [-j <generation threads>] [-n <order>] <seed> \
+<number of tweets>. Both take [--stats=json] [--memory=json] \
+[--min-count <n>] [--top-k <k>] [--budget <bytes>] [--quantize] \
+[--prune-report=json].\n"
+
+#define ERR_MSG_NO_START_WORD "Error: no word in the corpus can start a \
+tweet.\n"
 
 #define ERR_MSG_ALLOCATION_FAILURE \
   "Allocation failure: Something went wrong! we couldn't allocate enough "\
   "memory for your program, pleas try again.\n"
 
-#define END_TWIT_CONST '.'
-// the ASCII value of 46
 
 // COMPILATION & DECLARATION SECTION:
 
-static bool ok_arguments_amount (int argc);
+static bool ok_arguments_amount (int argc, const Options *options);
+static int parse_options (int argc, char *argv[], Options *options);
 static int validate_input (int argc, char *argv[], int *seed, int
-*tweets_amount, int *words_to_read);
+*tweets_amount, int *words_to_read, const Options *options);
 static bool parse_integer_from_string (int *changed_source, char *source);
+static bool parse_prune_option (int option, const char *argument,
+                                PruneOptions *prune_options);
 static int tweets_generator_logic (unsigned int seed, unsigned int
-tweets_number, char *text_corpus_path, int words_to_read);
+tweets_number, char *text_corpus_path, int words_to_read,
+                                   const Options *options);
 static int fill_database (FILE *fp, int words_to_read, MarkovChain
-*markov_chain);
+*markov_chain, const Options *options);
+static int train_chain (char *text_corpus_path, int words_to_read,
+                        MarkovChain *markov_chain, const Options *options);
+
+static void append_tweet_header (unsigned int tweet_number,
+                                 OutputBuffer *buffer)
+{
+  output_buffer_append_str (buffer, "Tweet ");
+  output_buffer_append_int (buffer, tweet_number);
+  output_buffer_append_str (buffer, ": ");
+}
 
 static void print_str (const void *ptr)
 {
@@ -50,52 +127,60 @@ static void print_str (const void *ptr)
   printf ("%s", str);
 }
 
-static int comp_str (const void *ptr1, const void *ptr2)
+static void append_str (const void *ptr, OutputBuffer *buffer)
 {
-  const char *str1 = (const char *) ptr1;
-  const char *str2 = (const char *) ptr2;
-  return strcmp (str1, str2);
+  output_buffer_append_str (buffer, (const char *) ptr);
 }
 
-static void free_str (void *ptr)
+static void print_ngram (const void *ptr)
 {
-  char *str = (char *) ptr;
-  free ((char *) str);
+  print_str (ngram_flat_state_word ((const NgramFlatState *) ptr));
 }
 
-static void *copy_str (const void *ptr)
+static void append_ngram (const void *ptr, OutputBuffer *buffer)
 {
-  const char *str = (const char *) ptr;
-  if (str == NULL)
-    {
-      return NULL;
-    }
-  unsigned long length = strlen ((char *) str);
-  char *new_str = malloc (sizeof (char) * length + 1);
-  if (new_str == NULL)
-    {
-      return NULL;
-    }
-  strcpy (new_str, (const char *) str);
-  return (void *) new_str;
+  append_str (ngram_flat_state_word ((const NgramFlatState *) ptr),
+              buffer);
 }
 
-static bool is_last_str (const void *ptr)
+static bool is_last_ngram (const void *ptr)
 {
-  const char *str = (const char *) ptr;
-  unsigned long length = strlen (str);
-  unsigned long last_char_loc = length - 1;
-
-  bool didnt_found_colon = false;
+  return markov_str_is_last (((const NgramState *) ptr)->word);
+}
 
-  if (str[last_char_loc] == END_TWIT_CONST)
+/**
+ * set the callbacks of the chain's states: words for an order 1 chain,
+ * and NgramState for higher orders. The order is the state kind, so a
+ * snapshot is only loaded with the order it was trained with.
+ * @param markov_chain the chain
+ * @param order the order of the chain
+ */
+static void set_state_functions (MarkovChain *markov_chain, int order)
+{
+  markov_chain->state_kind = (uint32_t) order;
+  if (order == 1)
     {
-      didnt_found_colon = true;
+      // words are views into the corpus, which the chain keeps, so they
+      // aren't copied (see markov_chain_view.h). They are printed from the
+      // frozen chain, as strings.
+      markov_chain_view_init (markov_chain);
+      markov_chain->print_func = print_str;
+      markov_chain->append_func = append_str;
+      return;
     }
-  return !didnt_found_colon;
+  markov_chain->comp_func = ngram_state_compare;
+  markov_chain->free_data = ngram_state_free;
+  markov_chain->copy_func = ngram_state_copy;
+  markov_chain->is_last = is_last_ngram;
+  markov_chain->print_func = print_ngram;
+  markov_chain->append_func = append_ngram;
+  markov_chain->hash_func = ngram_state_hash;
+  markov_chain->size_func = ngram_state_size;
+  markov_chain->flat_size_func = ngram_state_flat_size;
+  markov_chain->pack_func = ngram_state_pack;
+  markov_chain->check_func = ngram_flat_state_check;
 }
 
-
 // _______________________________starts____________________________________ //
 
 int main (int argc, char *argv[])
@@ -105,21 +190,138 @@ int main (int argc, char *argv[])
   int tweets_amount = TEMP_NUMBER;
   int words_to_read = TEMP_NUMBER;
   char *text_corpus_path = NULL;
-  if (validate_input (argc, argv, &seed, &tweets_amount, &words_to_read)
-      == EXIT_FAILURE)
+  Options options = {.training_threads = 1, .generation_threads = 1,
+                     .order = 1};
+  if (parse_options (argc, argv, &options) == EXIT_FAILURE)
+    { return EXIT_FAILURE; }
+
+  // from here on the positional arguments start at argv[1].
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (validate_input (argc, argv, &seed, &tweets_amount, &words_to_read,
+                      &options) == EXIT_FAILURE)
 
     { return EXIT_FAILURE; }
 
-  text_corpus_path = argv[TEXT_CORPUS_PATH];
+  if (options.snapshot_to_load == NULL)
+    {
+      text_corpus_path = argv[TEXT_CORPUS_PATH];
+    }
 
   return tweets_generator_logic (seed, tweets_amount,
-                                 text_corpus_path, words_to_read);
+                                 text_corpus_path, words_to_read, &options);
+}
+
+static int parse_options (int argc, char *argv[], Options *options)
+{
+  static const struct option long_options[] = {
+      {"train-threads", required_argument, NULL, 't'},
+      {"save", required_argument, NULL, 's'},
+      {"load", required_argument, NULL, 'l'},
+      {"weighted-start", no_argument, NULL, 'w'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"order", required_argument, NULL, 'n'},
+      {"stats", required_argument, NULL, STATS_OPTION},
+      {"memory", required_argument, NULL, MEMORY_OPTION},
+      {"min-count", required_argument, NULL, MIN_COUNT_OPTION},
+      {"top-k", required_argument, NULL, TOP_K_OPTION},
+      {"budget", required_argument, NULL, BUDGET_OPTION},
+      {"quantize", no_argument, NULL, QUANTIZE_OPTION},
+      {"prune-report", required_argument, NULL, PRUNE_REPORT_OPTION},
+      {NULL, 0, NULL, 0}
+  };
+
+  int option;
+  // '+' stops at the first positional argument, so negative seeds work.
+  while ((option = getopt_long (argc, argv, "+t:s:l:wj:n:", long_options,
+                                 NULL))
+         != -1)
+    {
+      switch (option)
+        {
+          case 't':
+            if (!parse_integer_from_string (&options->training_threads,
+                                            optarg)
+                || options->training_threads < 1)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+          break;
+          case 's':
+            options->snapshot_to_save = optarg;
+          break;
+          case 'l':
+            options->snapshot_to_load = optarg;
+          break;
+          case 'w':
+            options->weighted_start = true;
+          break;
+          case 'j':
+            if (!parse_integer_from_string (&options->generation_threads,
+                                            optarg)
+                || options->generation_threads < 1)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+          break;
+          case 'n':
+            if (!parse_integer_from_string (&options->order, optarg)
+                || options->order < 1 || options->order > NGRAM_MAX_ORDER)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+          break;
+          case STATS_OPTION:
+            if (strcmp (optarg, STATS_FORMAT_JSON) != 0)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+            options->print_stats = true;
+          break;
+          case MEMORY_OPTION:
+            if (strcmp (optarg, STATS_FORMAT_JSON) != 0)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+            options->print_memory = true;
+          break;
+          case MIN_COUNT_OPTION:
+          case TOP_K_OPTION:
+          case BUDGET_OPTION:
+          case QUANTIZE_OPTION:
+            if (!parse_prune_option (option, optarg,
+                                     &options->prune_options))
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+            options->prune = true;
+          break;
+          case PRUNE_REPORT_OPTION:
+            if (strcmp (optarg, STATS_FORMAT_JSON) != 0)
+              {
+                fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+                return EXIT_FAILURE;
+              }
+            options->print_prune_report = true;
+          break;
+          default:
+            fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
+          return EXIT_FAILURE;
+        }
+    }
+  return EXIT_SUCCESS;
 }
 
 static int validate_input (int argc, char *argv[], int *seed, int
-*tweets_amount, int *words_to_read)
+*tweets_amount, int *words_to_read, const Options *options)
 {
-  if (!ok_arguments_amount (argc))
+  if (!ok_arguments_amount (argc, options))
     {
       fprintf (stdout, ERR_MSG_USAGE_PROBLEM);
       return EXIT_FAILURE;
@@ -147,9 +349,15 @@ static int validate_input (int argc, char *argv[], int *seed, int
   return EXIT_SUCCESS;
 }
 
-static bool ok_arguments_amount (int argc)
+static bool ok_arguments_amount (int argc, const Options *options)
 {
   bool valid = true;
+  if (options->snapshot_to_load != NULL)
+    {
+      // a loaded snapshot replaces the corpus, and can't be saved again.
+      return argc == SNAPSHOT_AMOUNT_OF_ARGC
+             && options->snapshot_to_save == NULL;
+    }
   if (!((argc == ACCEPTED_AMOUNT_OF_ARGC) || (argc == FULL_AMOUNT_OF_ARGC)))
     { valid = false; }
 
@@ -165,126 +373,186 @@ static bool parse_integer_from_string (int *changed_source, char *source)
   return flag;
 }
 
-int tweets_generator_logic (unsigned int seed, unsigned int
-tweets_number, char *text_corpus_path, int words_to_read)
+/**
+ * set the prune option of a long option.
+ * @param option MIN_COUNT_OPTION, TOP_K_OPTION, BUDGET_OPTION or
+ * QUANTIZE_OPTION
+ * @param argument the option's argument, a positive number (none for
+ * QUANTIZE_OPTION)
+ * @param prune_options the options to set
+ * @return false if the argument is not valid.
+ */
+static bool parse_prune_option (int option, const char *argument,
+                                PruneOptions *prune_options)
 {
-// opening the file and define the seed.
-  FILE *fp = fopen (text_corpus_path, "r");
-  if (fp == NULL)
+  if (option == QUANTIZE_OPTION)
     {
-      fprintf (stdout, ERR_MSG_FILE_PATH);
-      return EXIT_FAILURE;
+      prune_options->quantize = true;
+      return true;
+    }
+  unsigned long long value;
+  char extra;
+  if (sscanf (argument, "%llu%c", &value, &extra) != 1 || value == 0)
+    {
+      return false;
+    }
+  if (option == BUDGET_OPTION)
+    {
+      prune_options->budget_bytes = (size_t) value;
+      return true;
+    }
+  if (value > UINT32_MAX)
+    {
+      return false;
+    }
+  if (option == MIN_COUNT_OPTION)
+    {
+      prune_options->min_count = (uint32_t) value;
     }
-  srand (seed);
+  else
+    {
+      prune_options->top_k = (uint32_t) value;
+    }
+  return true;
+}
 
+int tweets_generator_logic (unsigned int seed, unsigned int
+tweets_number, char *text_corpus_path, int words_to_read,
+                            const Options *options)
+{
   // defining the params.
   LinkedList linked_list = {NULL, NULL, 0};
   MarkovChain markov_chain = {0};
   markov_chain.database = &linked_list;
-  markov_chain.comp_func = comp_str;
-  markov_chain.free_data = free_str;
-  markov_chain.copy_func = copy_str;
-  markov_chain.is_last = is_last_str;
-  markov_chain.print_func = print_str;
+  set_state_functions (&markov_chain, options->order);
+  markov_chain.weighted_start = options->weighted_start;
   MarkovChain *markov_chain_pointer = &markov_chain;
 
-  int ans = fill_database (fp, words_to_read, markov_chain_pointer);
-  if (ans == EXIT_SUCCESS)
+  int ans;
+  if (options->snapshot_to_load != NULL)
     {
-      for (unsigned int index_of_tweet = 0;
-           index_of_tweet < tweets_number; index_of_tweet++)
-        {
-          fprintf (stdout, "Tweet %d: ", index_of_tweet + 1);
-          generate_tweet (markov_chain_pointer, NULL, WORD_MAX_LENGTH);
-        }
-
-      fclose (fp);
-      free_database (&markov_chain_pointer);
-      return EXIT_SUCCESS;
+      ans = markov_chain_load (markov_chain_pointer,
+                               options->snapshot_to_load)
+            ? EXIT_SUCCESS : EXIT_FAILURE;
     }
   else
     {
-      fclose (fp);
-      free_database (&markov_chain_pointer);
-      return EXIT_FAILURE;
+      ans = train_chain (text_corpus_path, words_to_read,
+                         markov_chain_pointer, options);
     }
-}
 
-static bool continue_reading (int count, int max)
-{
-  if (max == TEMP_NUMBER)
+  // generating needs only the frozen form, the rest is released.
+  MemoryUsage training_usage = markov_chain_memory_usage (&markov_chain);
+  if (ans == EXIT_SUCCESS && !markov_chain_compact (markov_chain_pointer))
     {
-      return true;
+      ans = EXIT_FAILURE;
+    }
+  PruneReport prune_report;
+  if (ans == EXIT_SUCCESS && options->prune
+      && !markov_chain_prune (markov_chain_pointer, &options->prune_options,
+                              &prune_report))
+    {
+      ans = EXIT_FAILURE;
+    }
+  if (ans == EXIT_SUCCESS && options->snapshot_to_save != NULL
+      && !markov_chain_save (markov_chain_pointer,
+                             options->snapshot_to_save))
+    {
+      ans = EXIT_FAILURE;
+    }
+  if (ans == EXIT_SUCCESS && options->print_memory)
+    {
+      MemoryUsage compact_usage = frozen_chain_memory_usage
+          (markov_chain.frozen);
+      memory_report_print_json (&training_usage, &compact_usage, stderr);
+    }
+  if (ans == EXIT_SUCCESS && options->prune && options->print_prune_report)
+    {
+      prune_report_print_json (&prune_report, stderr);
     }
 
-  if (count < max)
+  if (ans == EXIT_SUCCESS && markov_chain.frozen->start_count == 0)
     {
-      return true;
+      fprintf (stdout, ERR_MSG_NO_START_WORD);
+      ans = EXIT_FAILURE;
+    }
+  if (ans == EXIT_SUCCESS)
+    {
+      // every tweet has a stream of its own, so it depends only on the seed
+      // and its index, and not on the amount of threads.
+      ans = generate_sequences (markov_chain_pointer, NULL, WORD_MAX_LENGTH,
+                                tweets_number, seed,
+                                options->generation_threads,
+                                append_tweet_header);
+    }
+  free_database (&markov_chain_pointer);
+  if (options->print_stats)
+    {
+      MarkovStats stats = markov_chain_stats ();
+      markov_stats_print_json (&stats, stderr);
     }
-  return false;
+  return ans;
 }
 
-/***
- * @param line the current line to parse and add to the chain
- * @param markov_chain the chain to add the words into
- * @return the amount of words added to the chain
+/**
+ * train the chain on the text corpus and freeze it.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-static int parse_one_line (char *line, MarkovChain *markov_chain,
-                           const int words_to_read, int word_count)
+static int train_chain (char *text_corpus_path, int words_to_read,
+                        MarkovChain *markov_chain, const Options *options)
 {
-  char *current_word;
-  Node *curr = NULL;
-  Node *prev = NULL;
-  current_word = strtok (line, DELIMITERS);
-  while (current_word != NULL && continue_reading (word_count,
-                                                   words_to_read))
+  FILE *fp = fopen (text_corpus_path, "r");
+  if (fp == NULL)
     {
-      curr = add_to_database (markov_chain, current_word);
-      word_count++;
-      if (curr == NULL)
-        {
-          return EXIT_FAILURE;
-        }
-
-      if (prev)
-        {
-          add_node_to_frequencies_list ((prev)->data,
-                                        (curr)->data, markov_chain);
-        }
+      fprintf (stdout, ERR_MSG_FILE_PATH);
+      return EXIT_FAILURE;
+    }
+  if (!markov_chain_use_arena (markov_chain))
+    {
+      fclose (fp);
+      return EXIT_FAILURE;
+    }
 
-      prev = curr;
-      current_word = strtok (NULL, DELIMITERS);
+  int ans = fill_database (fp, words_to_read, markov_chain, options);
+  fclose (fp);
+  if (ans == EXIT_SUCCESS && !markov_chain_freeze (markov_chain))
+    {
+      ans = EXIT_FAILURE;
     }
-  return word_count;
+  return ans;
 }
 
+/**
+ * fills database with the words of the corpus
+ * @param fp the text corpus
+ * @param words_to_read amount of words to read, TEMP_NUMBER for all of them
+ * @param markov_chain the chain to fill
+ * @param options the program's options
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
 static int fill_database (FILE *fp, int words_to_read, MarkovChain
-*markov_chain)
+*markov_chain, const Options *options)
 {
-  int word_count = 0;
-
-  if (fp == NULL)
+  TextCursor cursor;
+  text_cursor_init (&cursor, (words_to_read == TEMP_NUMBER)
+                             ? TEXT_CORPUS_ALL_WORDS : words_to_read);
+  if (!text_cursor_set_order (&cursor, markov_chain, options->order))
     {
+      text_cursor_free (&cursor);
       return EXIT_FAILURE;
     }
 
-  char line_buffer[BUFFER_SIZE];
-
-  while (fgets (line_buffer, BUFFER_SIZE, fp) != NULL)
+  int ans = train_on_file (fp, markov_chain, &cursor,
+                           options->training_threads);
+  text_cursor_free (&cursor);
+  if (ans == EXIT_FAILURE)
     {
-      word_count = parse_one_line (line_buffer, markov_chain,
-                                   words_to_read, word_count);
-      if (word_count == EXIT_FAILURE)
-        {
-          return EXIT_FAILURE;
-        }
-
-      if (words_to_read != TEMP_NUMBER && word_count >= words_to_read)
-        {
-          break;
-        }
+      return EXIT_FAILURE;
     }
 
+  if (!markov_chain_finish_training (markov_chain))
+    {
+      return EXIT_FAILURE;
+    }
   return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,330 @@
+#include <string.h>
+#include <pthread.h>
+#include "walk_simulation.h"
+#include "batched_walker.h"
+#include "markov_chain.h"
+
+// the walks of a run are split between the threads, but a thread gets at
+// least this many.
+#define MIN_WALKS_PER_THREAD 4096
+
+// SimulationNode flags:
+// the walk stops at the node.
+#define SIMULATION_NODE_ABSORBING 1u
+// a step from the node adds to the length of the walk.
+#define SIMULATION_NODE_COUNTS_STEP 2u
+// all the out-edges of the node have the same frequency.
+#define SIMULATION_NODE_UNIFORM 4u
+
+/**
+ * What a walk needs to know about a node of the frozen chain, in one
+ * place.
+ */
+typedef struct SimulationNode {
+    uint32_t first_edge;
+    uint32_t edge_count;
+    uint32_t flags;
+} SimulationNode;
+
+/**
+ * A range of walks of a run, aggregated into stats of its own.
+ */
+typedef struct SimulationShard {
+    const FrozenChain *frozen;
+    const SimulationNode *nodes;
+    // walks the shard BATCHED_WALKER_LANES at a time when not NULL.
+    const BatchedWalker *walker;
+    uint32_t start_node;
+    uint64_t seed;
+    uint64_t first_walk;
+    uint64_t end_walk;
+    WalkSimulationStats stats;
+    bool ans;
+} SimulationShard;
+
+static bool stats_alloc (WalkSimulationStats *stats, uint32_t node_count,
+                         uint32_t max_steps)
+{
+  *stats = (WalkSimulationStats) {0};
+  stats->node_count = node_count;
+  stats->max_steps = max_steps;
+  stats->length_histogram = calloc ((size_t) max_steps + 1,
+                                    sizeof (uint64_t));
+  stats->redirect_histogram = calloc ((size_t) max_steps + 2,
+                                      sizeof (uint64_t));
+  stats->visits = calloc ((size_t) node_count + 1, sizeof (uint64_t));
+  if (stats->length_histogram == NULL || stats->redirect_histogram == NULL
+      || stats->visits == NULL)
+    {
+      walk_simulation_stats_free (stats);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * add the counters of source to target, of the same chain and max_steps.
+ */
+static void stats_merge (WalkSimulationStats *target,
+                         const WalkSimulationStats *source)
+{
+  target->walks += source->walks;
+  target->finished += source->finished;
+  target->finished_steps += source->finished_steps;
+  for (uint32_t k = 0; k <= target->max_steps; k++)
+    {
+      target->length_histogram[k] += source->length_histogram[k];
+    }
+  for (uint32_t k = 0; k <= target->max_steps + 1; k++)
+    {
+      target->redirect_histogram[k] += source->redirect_histogram[k];
+    }
+  for (uint32_t i = 0; i < target->node_count; i++)
+    {
+      target->visits[i] += source->visits[i];
+    }
+}
+
+/**
+ * @return a new array of the simulation nodes of frozen, NULL in case of
+ * allocation error.
+ */
+static SimulationNode *build_simulation_nodes (const FrozenChain *frozen,
+                                               const bool *counts_step)
+{
+  SimulationNode *nodes = malloc ((frozen->node_count + 1)
+                                  * sizeof (SimulationNode));
+  if (nodes == NULL)
+    {
+      return NULL;
+    }
+  for (uint32_t i = 0; i < frozen->node_count; i++)
+    {
+      const FrozenNode *frozen_node = &frozen->nodes[i];
+      uint32_t first_edge = frozen_node->first_edge;
+      nodes[i] = (SimulationNode) {frozen_node->first_edge,
+                                   frozen_node->edge_count, 0};
+      if (!(frozen_node->flags & FROZEN_NODE_CONTINUES)
+          || frozen_node->edge_count == 0)
+        {
+          nodes[i].flags |= SIMULATION_NODE_ABSORBING;
+        }
+      if (counts_step == NULL || counts_step[i])
+        {
+          nodes[i].flags |= SIMULATION_NODE_COUNTS_STEP;
+        }
+      bool uniform = true;
+      for (uint32_t j = 0; j < frozen_node->edge_count; j++)
+        {
+          if (frozen_edge_cumulative_frequency (frozen, first_edge + j)
+              != (j + 1) * frozen_edge_cumulative_frequency (frozen,
+                                                             first_edge))
+            {
+              uniform = false;
+              break;
+            }
+        }
+      if (uniform)
+        {
+          nodes[i].flags |= SIMULATION_NODE_UNIFORM;
+        }
+    }
+  return nodes;
+}
+
+/**
+ * the next node of a walk, like frozen_next_random_node, but with no search
+ * when all the out-edges have the same frequency, and no draw when there
+ * is one.
+ */
+static inline uint32_t simulation_step (const FrozenChain *frozen,
+                                        const SimulationNode *node,
+                                        uint32_t node_index,
+                                        RandomStream *stream)
+{
+  if (node->edge_count == 1)
+    {
+      return frozen_edge_target (frozen, node->first_edge);
+    }
+  if (node->flags & SIMULATION_NODE_UNIFORM)
+    {
+      return frozen_edge_target (frozen, node->first_edge
+                                         + random_stream_below
+                                             (stream, node->edge_count));
+    }
+  return frozen_next_random_node (frozen, node_index, stream);
+}
+
+static void *run_shard (void *arg)
+{
+  SimulationShard *shard = (SimulationShard *) arg;
+  const FrozenChain *frozen = shard->frozen;
+  const SimulationNode *nodes = shard->nodes;
+  WalkSimulationStats *stats = &shard->stats;
+  uint32_t max_steps = stats->max_steps;
+
+  if (shard->walker != NULL)
+    {
+      shard->ans = batched_walker_run (shard->walker, shard->start_node,
+                                       shard->seed, shard->first_walk,
+                                       shard->end_walk, stats);
+      return NULL;
+    }
+  for (uint64_t walk = shard->first_walk; walk < shard->end_walk; walk++)
+    {
+      RandomStream stream;
+      random_stream_init (&stream, shard->seed, walk);
+      uint32_t node_index = shard->start_node;
+      uint32_t steps = 0;
+      uint32_t redirects = 0;
+      bool finished = false;
+      while (true)
+        {
+          const SimulationNode *node = &nodes[node_index];
+          if (node->flags & SIMULATION_NODE_ABSORBING)
+            {
+              stats->visits[node_index]++;
+              finished = true;
+              break;
+            }
+          if (node->flags & SIMULATION_NODE_COUNTS_STEP)
+            {
+              if (steps == max_steps)
+                {
+                  break;
+                }
+              steps++;
+            }
+          else
+            {
+              redirects++;
+            }
+          stats->visits[node_index]++;
+          node_index = simulation_step (frozen, node, node_index, &stream);
+        }
+
+      if (finished)
+        {
+          stats->finished++;
+          stats->finished_steps += steps;
+          stats->length_histogram[steps]++;
+        }
+      if (redirects > max_steps + 1)
+        {
+          redirects = max_steps + 1;
+        }
+      stats->redirect_histogram[redirects]++;
+    }
+  stats->walks = shard->end_walk - shard->first_walk;
+  shard->ans = true;
+  return NULL;
+}
+
+bool walk_simulation_run (const FrozenChain *frozen, uint32_t start_node,
+                          const bool *counts_step, uint32_t max_steps,
+                          uint64_t walks, uint64_t seed, int threads,
+                          bool batched, WalkSimulationStats *stats)
+{
+  SimulationNode *nodes = build_simulation_nodes (frozen, counts_step);
+  BatchedWalker batched_walker = {0};
+  const BatchedWalker *walker = NULL;
+  if (nodes != NULL && batched && batched_walker_fits (frozen))
+    {
+      walker = &batched_walker;
+      if (!batched_walker_init (&batched_walker, frozen, counts_step))
+        {
+          free (nodes);
+          nodes = NULL;
+        }
+    }
+  if (nodes == NULL || !stats_alloc (stats, frozen->node_count, max_steps))
+    {
+      free (nodes);
+      batched_walker_free (&batched_walker);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+
+  uint64_t shard_count = threads < 1 ? 1 : (uint64_t) threads;
+  if (shard_count > MAX_SIMULATION_THREADS)
+    {
+      shard_count = MAX_SIMULATION_THREADS;
+    }
+  if (shard_count > walks / MIN_WALKS_PER_THREAD)
+    {
+      shard_count = walks / MIN_WALKS_PER_THREAD;
+    }
+  if (shard_count <= 1)
+    {
+      SimulationShard shard = {frozen, nodes, walker, start_node, seed, 0,
+                               walks, *stats, false};
+      run_shard (&shard);
+      *stats = shard.stats;
+      free (nodes);
+      batched_walker_free (&batched_walker);
+      if (!shard.ans)
+        {
+          walk_simulation_stats_free (stats);
+          fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+        }
+      return shard.ans;
+    }
+
+  SimulationShard *shards = calloc (shard_count, sizeof (SimulationShard));
+  pthread_t *thread_ids = calloc (shard_count, sizeof (pthread_t));
+  bool *started = calloc (shard_count, sizeof (bool));
+  bool ans = shards != NULL && thread_ids != NULL && started != NULL;
+  for (uint64_t i = 0; ans && i < shard_count; i++)
+    {
+      shards[i] = (SimulationShard) {frozen, nodes, walker, start_node,
+                                     seed, walks * i / shard_count,
+                                     walks * (i + 1) / shard_count, {0},
+                                     false};
+      if (!stats_alloc (&shards[i].stats, frozen->node_count, max_steps))
+        {
+          ans = false;
+          break;
+        }
+      started[i] = pthread_create (&thread_ids[i], NULL, run_shard,
+                                   &shards[i]) == 0;
+      if (!started[i])
+        {
+          run_shard (&shards[i]);
+        }
+    }
+
+  for (uint64_t i = 0; shards != NULL && i < shard_count; i++)
+    {
+      if (started != NULL && started[i])
+        {
+          pthread_join (thread_ids[i], NULL);
+        }
+      ans = ans && shards[i].ans;
+      if (ans)
+        {
+          stats_merge (stats, &shards[i].stats);
+        }
+      walk_simulation_stats_free (&shards[i].stats);
+    }
+  free (shards);
+  free (thread_ids);
+  free (started);
+  free (nodes);
+  batched_walker_free (&batched_walker);
+  if (!ans)
+    {
+      walk_simulation_stats_free (stats);
+      fprintf (stdout, ALLOCATION_ERROR_MASSAGE);
+    }
+  return ans;
+}
+
+void walk_simulation_stats_free (WalkSimulationStats *stats)
+{
+  free (stats->length_histogram);
+  free (stats->redirect_histogram);
+  free (stats->visits);
+  stats->length_histogram = NULL;
+  stats->redirect_histogram = NULL;
+  stats->visits = NULL;
+}
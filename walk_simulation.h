@@ -0,0 +1,74 @@
+#ifndef _WALK_SIMULATION_H_
+#define _WALK_SIMULATION_H_
+
+#include "frozen_chain.h"
+
+#define MAX_SIMULATION_THREADS 256
+
+/**
+ * Aggregated results of many random walks on a frozen chain, from a start
+ * node until they are absorbed (see AbsorbingChainStats) or reach the step
+ * cap. The length of a walk is the amount of steps it takes that count
+ * (see walk_simulation_run); the other steps are redirects.
+ */
+typedef struct WalkSimulationStats {
+    uint32_t node_count;
+    uint32_t max_steps;
+
+    uint64_t walks;
+    // walks absorbed within max_steps counted steps, and the sum of their
+    // lengths.
+    uint64_t finished;
+    uint64_t finished_steps;
+
+    // length_histogram[k] is the amount of finished walks of length k, for
+    // k = 0 .. max_steps.
+    uint64_t *length_histogram;
+
+    // redirect_histogram[k] is the amount of walks that took k redirects,
+    // for k = 0 .. max_steps + 1 (the last entry also counts the walks that
+    // took more).
+    uint64_t *redirect_histogram;
+
+    // visits[i] is the amount of times a walk was at node i (the start
+    // counts as a visit). For an absorbing node it is the amount of walks
+    // that ended there.
+    uint64_t *visits;
+} WalkSimulationStats;
+
+/**
+ * Run random walks on a frozen chain and aggregate their statistics,
+ * without storing or rendering the walks. Walk i is drawn from the stream
+ * (seed, i) (see random_stream_init), so the results are the same for
+ * every amount of threads. Steps from a node with a single out-edge take
+ * no random number. When batched, and every node picks its next node
+ * uniformly (see batched_walker_fits), the walks are run many at a time by
+ * a BatchedWalker instead, which gives other walks of the same
+ * distribution.
+ * @param frozen the frozen chain
+ * @param start_node index of the node every walk starts from
+ * @param counts_step counts_step[i] tells if a step from node i adds to the
+ * length of the walk (steps that don't count, e.g. following a ladder,
+ * must not form a cycle). NULL to count every step.
+ * @param max_steps a walk that took this many counted steps without being
+ * absorbed is stopped, and is not finished
+ * @param walks amount of walks to run
+ * @param seed the seed of the run
+ * @param threads amount of threads running the walks
+ * @param batched true to run the walks with a BatchedWalker when the chain
+ * fits one
+ * @param stats filled with the statistics, its arrays are allocated
+ * @return true on success, false in case of allocation error.
+ */
+bool walk_simulation_run (const FrozenChain *frozen, uint32_t start_node,
+                          const bool *counts_step, uint32_t max_steps,
+                          uint64_t walks, uint64_t seed, int threads,
+                          bool batched, WalkSimulationStats *stats);
+
+/**
+ * Free the arrays of stats filled by walk_simulation_run.
+ * @param stats the stats to free
+ */
+void walk_simulation_stats_free (WalkSimulationStats *stats);
+
+#endif //_WALK_SIMULATION_H_
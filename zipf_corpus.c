@@ -0,0 +1,74 @@
+#include <math.h>
+#include "zipf_corpus.h"
+
+#define ALPHABET_SIZE 26
+
+// weight of the most frequent word; the rest are scaled down from it.
+#define ZIPF_TOP_WEIGHT 4294967295.0
+
+bool zipf_corpus_init (ZipfCorpus *corpus, uint32_t vocabulary,
+                       double exponent, uint64_t seed)
+{
+  corpus->vocabulary = vocabulary;
+  random_stream_init (&corpus->stream, seed, 0);
+  uint32_t *weights = malloc (vocabulary * sizeof (uint32_t));
+  if (weights == NULL)
+    {
+      return false;
+    }
+  for (uint32_t rank = 0; rank < vocabulary; rank++)
+    {
+      double weight = ZIPF_TOP_WEIGHT / pow (rank + 1.0, exponent);
+      // the rarest words must not vanish.
+      weights[rank] = (weight < 1) ? 1 : (uint32_t) weight;
+    }
+  bool built = alias_table_build (&corpus->ranks, weights, vocabulary);
+  free (weights);
+  return built;
+}
+
+size_t zipf_corpus_word (uint32_t rank, char *word)
+{
+  char reversed[ZIPF_WORD_MAX_LENGTH];
+  size_t length = 0;
+  uint32_t rest = rank;
+  do
+    {
+      reversed[length++] = (char) ('a' + rest % ALPHABET_SIZE);
+      rest /= ALPHABET_SIZE;
+    }
+  while (rest > 0);
+
+  for (size_t i = 0; i < length; i++)
+    {
+      word[i] = reversed[length - 1 - i];
+    }
+  if (rank % ZIPF_SENTENCE_END_PERIOD == ZIPF_SENTENCE_END_PERIOD - 1)
+    {
+      word[length++] = '.';
+    }
+  word[length] = '\0';
+  return length;
+}
+
+void zipf_corpus_append (ZipfCorpus *corpus, uint64_t tokens,
+                         OutputBuffer *buffer)
+{
+  char word[ZIPF_WORD_MAX_LENGTH];
+  for (uint64_t i = 0; i < tokens; i++)
+    {
+      uint32_t rank = zipf_corpus_next (corpus);
+      output_buffer_append (buffer, word, zipf_corpus_word (rank, word));
+      bool line_end = rank % ZIPF_SENTENCE_END_PERIOD
+                      == ZIPF_SENTENCE_END_PERIOD - 1
+                      && random_stream_below (&corpus->stream,
+                                              ZIPF_LINE_END_PERIOD) == 0;
+      output_buffer_append_char (buffer, (line_end || i + 1 == tokens)
+                                         ? '\n' : ' ');
+    }
+}
+
+void zipf_corpus_free (ZipfCorpus *corpus)
+{
+  alias_table_free (&corpus->ranks);
+}
@@ -0,0 +1,77 @@
+#ifndef _ZIPF_CORPUS_H_
+#define _ZIPF_CORPUS_H_
+
+#include <stdint.h>  // for uint32_t, uint64_t
+#include <stdbool.h> // for bool
+#include "alias_table.h"
+#include "random_stream.h"
+#include "output_buffer.h"
+
+// longest word of a synthetic corpus, with its NUL.
+#define ZIPF_WORD_MAX_LENGTH 16
+
+// one rank in this many is a word that ends a sentence.
+#define ZIPF_SENTENCE_END_PERIOD 16
+
+// one sentence in this many ends its line too.
+#define ZIPF_LINE_END_PERIOD 4
+
+/**
+ * Generator of synthetic text corpora whose words follow Zipf's law: the
+ * word of rank k (0 based) is drawn with probability proportional to
+ * 1 / (k + 1)^exponent, in O(1) with an alias table. The words are the
+ * ranks written in base 26 ("a", "b", .. "ba", ..), and some of them end
+ * a sentence (see ZIPF_SENTENCE_END_PERIOD), so the corpus reads like the
+ * tweets corpus.
+ */
+typedef struct ZipfCorpus {
+    uint32_t vocabulary;
+    AliasTable ranks;
+    RandomStream stream;
+} ZipfCorpus;
+
+/**
+ * Initialize a generator.
+ * @param corpus the generator to initialize
+ * @param vocabulary amount of distinct words, bigger than 0
+ * @param exponent the exponent of the distribution, 0 for uniform words
+ * @param seed the seed of the generator
+ * @return true on success, false in case of allocation error.
+ */
+bool zipf_corpus_init (ZipfCorpus *corpus, uint32_t vocabulary,
+                       double exponent, uint64_t seed);
+
+/**
+ * @param corpus the generator
+ * @return the rank of the next word.
+ */
+static inline uint32_t zipf_corpus_next (ZipfCorpus *corpus)
+{
+  return alias_table_sample (&corpus->ranks, &corpus->stream);
+}
+
+/**
+ * Write the word of a rank.
+ * @param rank the rank
+ * @param word output, of ZIPF_WORD_MAX_LENGTH chars, NUL terminated
+ * @return the length of the word.
+ */
+size_t zipf_corpus_word (uint32_t rank, char *word);
+
+/**
+ * Append the next words of the corpus to a buffer, separated by spaces,
+ * with a line break after some of the sentences.
+ * @param corpus the generator
+ * @param tokens amount of words to append
+ * @param buffer the buffer to append to
+ */
+void zipf_corpus_append (ZipfCorpus *corpus, uint64_t tokens,
+                         OutputBuffer *buffer);
+
+/**
+ * Free the memory held by a generator.
+ * @param corpus the generator to free
+ */
+void zipf_corpus_free (ZipfCorpus *corpus);
+
+#endif //_ZIPF_CORPUS_H_